@@ -0,0 +1,43 @@
+#include "Annotation.h"
+
+#include <stdio.h>
+#include <string.h>
+
+AnnotationText::AnnotationText()
+    : second_(-1), day_(-1), speed_kmh_(-1), frame_(0) {
+  date_[0] = 0;
+  clock_[0] = 0;
+  text_[0] = 0;
+}
+
+bool AnnotationText::update(int64_t wallclock_us, const GPS_FIX *fix,
+                            uint32_t frame) {
+  time_t second = wallclock_us / 1000000;
+  int speed_kmh = fix ? (int)(fix->speed_mps * 3.6 + 0.5) : -1;
+
+  if (second == second_ && speed_kmh == speed_kmh_ && frame == frame_)
+    return false;
+
+  if (second != second_) {
+    struct tm tm;
+
+    localtime_r(&second, &tm);
+    // The date changes once a day, only the time is formatted every second
+    if (tm.tm_yday != day_) {
+      strftime(date_, sizeof(date_), "%Y-%m-%d", &tm);
+      day_ = tm.tm_yday;
+    }
+    snprintf(clock_, sizeof(clock_), "%s %02d:%02d:%02d", date_, tm.tm_hour,
+             tm.tm_min, tm.tm_sec);
+    second_ = second;
+  }
+  speed_kmh_ = speed_kmh;
+  frame_ = frame;
+
+  if (speed_kmh >= 0)
+    snprintf(text_, sizeof(text_), "%s  %d km/h  #%u", clock_, speed_kmh,
+             frame);
+  else
+    snprintf(text_, sizeof(text_), "%s  #%u", clock_, frame);
+  return true;
+}
@@ -0,0 +1,49 @@
+/**
+ * \file Annotation.h
+ * Text of the on-frame overlay: clock, speed and frame number.
+ *
+ * The text is only rebuilt when something shown in it changed: the clock
+ * is formatted once per second, from a cached date, and the speed and frame
+ * number are compared as numbers first. update() tells the caller whether
+ * there is anything new to send to the camera, so an unchanged overlay
+ * costs a few comparisons and no camera traffic.
+ */
+
+#ifndef ANNOTATION_H_
+#define ANNOTATION_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "Gps.h"
+
+/// Longest overlay text the firmware takes, terminator included
+#define ANNOTATION_MAX_TEXT 256
+
+class AnnotationText {
+public:
+  AnnotationText();
+
+  /**
+   * Bring the text up to date
+   *
+   * @param wallclock_us Current wall clock time
+   * @param fix Position to show the speed of, NULL if there is none
+   * @param frame Frame number of the next still
+   * @return true if the text changed
+   */
+  bool update(int64_t wallclock_us, const GPS_FIX *fix, uint32_t frame);
+
+  const char *text() const { return text_; }
+
+private:
+  time_t second_;  /// Second the clock shows, -1 before the first update
+  int day_;        /// Day of the cached date, tm_yday
+  int speed_kmh_;  /// -1 without a fix
+  uint32_t frame_;
+  char date_[16];
+  char clock_[32];
+  char text_[ANNOTATION_MAX_TEXT];
+};
+
+#endif /* ANNOTATION_H_ */
@@ -0,0 +1,103 @@
+#include "CameraBackend.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "SoftJpegCamera.h"
+#include "SyntheticCamera.h"
+#ifdef HAVE_MMAL
+#include "MmalCamera.h"
+#endif
+
+void camera_default_params(CAMERA_PARAMS *params) {
+  memset(params, 0, sizeof(*params));
+  params->camera_num = 0;
+  params->width = 1280;
+  params->height = 720;
+  params->quality = 85;
+  params->burst = 1;
+  params->zsl = 0;
+  params->soft_jpeg_threads = 0;
+  params->video_width = 1920;
+  params->video_height = 1080;
+  params->video_framerate = 30;
+  params->annotate = 0;
+  params->verbose = 0;
+  params->record_dir = NULL;
+  params->bitrate = 17000000;
+  params->segment_seconds = 60;
+  params->segment_count = 60;
+  params->pre_event_seconds = 10;
+  params->post_event_seconds = 10;
+  params->event_buffer_bytes = (size_t)32 << 20;
+}
+
+/** The backend named by spec, not opened. @return NULL if unknown */
+static CameraBackend *create_backend(const char *spec,
+                                     const CAMERA_PARAMS &params,
+                                     const CameraBackend::Handlers &handlers) {
+  CameraBackend *camera = NULL;
+
+  if (!strcmp(spec, "mmal")) {
+#ifdef HAVE_MMAL
+    camera = new MmalCamera(params, handlers);
+#else
+    fprintf(stderr, "Built without MMAL, no Pi camera\n");
+#endif
+  } else if (!strcmp(spec, "synthetic") || !strncmp(spec, "synthetic:", 10)) {
+    int fps = spec[9] ? atoi(spec + 10) : 30;
+
+    if (fps >= 0)
+      camera = new SyntheticCamera(params, handlers, fps, NULL);
+  } else if (!strncmp(spec, "replay:", 7) && spec[7]) {
+    // replay:<dir>[:<fps>], the rate follows the last ':', so a directory
+    // with a ':' in its name needs the rate given as well
+    std::string dir(spec + 7);
+    size_t colon = dir.rfind(':');
+    int fps = 30;
+
+    if (colon != std::string::npos) {
+      fps = atoi(dir.c_str() + colon + 1);
+      dir.erase(colon);
+    }
+    if (fps >= 0 && !dir.empty())
+      camera = new SyntheticCamera(params, handlers, fps, dir.c_str());
+  }
+
+  return camera;
+}
+
+CameraBackend *camera_create(const char *spec, const CAMERA_PARAMS &params,
+                             const CameraBackend::Handlers &handlers) {
+  CameraBackend *camera;
+
+  if (params.soft_jpeg_threads > 0) {
+    // The source's raw frames become the stills, its still port is unused
+    SoftJpegCamera *soft = new SoftJpegCamera(params, handlers);
+    CameraBackend::Handlers source_handlers = handlers;
+    source_handlers.yuv = soft->yuv_handler();
+
+    CameraBackend *source = create_backend(spec, params, source_handlers);
+    if (!source) {
+      delete soft;
+      soft = NULL;
+    } else {
+      soft->set_source(source);
+    }
+    camera = soft;
+  } else {
+    camera = create_backend(spec, params, handlers);
+  }
+
+  if (!camera) {
+    fprintf(stderr, "Unknown camera '%s'\n", spec);
+    return NULL;
+  }
+  if (camera->open() != 0) {
+    delete camera;
+    return NULL;
+  }
+  return camera;
+}
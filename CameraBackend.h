@@ -0,0 +1,208 @@
+/**
+ * \file CameraBackend.h
+ * What the capture loop needs from a camera.
+ *
+ * A backend delivers three things through handlers given at construction:
+ * raw luma frames for analysis, encoded stills in chunks, and control
+ * events. The capture loop only calls capture() and wait_capture(), so it
+ * runs unchanged on the Pi camera (MmalCamera) or on a workstation
+ * (SyntheticCamera) generating or replaying frames at a set rate.
+ */
+
+#ifndef CAMERABACKEND_H_
+#define CAMERABACKEND_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <functional>
+
+#include "Gps.h"
+
+/// Flags on a chunk of still output
+#define CAMERA_OUTPUT_FRAME_END 0x1 /// Last chunk of the still
+#define CAMERA_OUTPUT_FAILED 0x2    /// Still is broken, drop what came so far
+
+/** One chunk of an encoded still */
+typedef struct {
+  const uint8_t *data;
+  size_t length;        /// May be 0 on the last chunk
+  uint32_t flags;       /// CAMERA_OUTPUT_*
+  uint32_t frame;       /// Frame number passed to capture(), plus burst_index
+  uint32_t burst_index; /// Position of the still in its burst, 0 for the first
+  int64_t timestamp_us; /// Wall clock time the still was requested
+  int64_t pts_us;       /// Sensor timestamp of the still, 0 if unknown
+} CAMERA_OUTPUT;
+
+/** One raw I420 frame, the planes are only valid during the call */
+typedef struct {
+  const uint8_t *y;
+  const uint8_t *u;
+  const uint8_t *v;
+  int width;            /// Visible size, both even
+  int height;
+  int y_stride;         /// Bytes between luma rows
+  int uv_stride;        /// Bytes between chroma rows
+  int64_t arrival_us;   /// Monotonic time the frame arrived
+} CAMERA_YUV;
+
+typedef enum {
+  CAMERA_EVENT_SETTINGS, /// Exposure or gains changed
+  CAMERA_EVENT_ERROR     /// The sensor stopped delivering
+} CAMERA_EVENT_TYPE;
+
+typedef struct {
+  CAMERA_EVENT_TYPE type;
+  uint32_t exposure_us; /// CAMERA_EVENT_SETTINGS only
+  double analog_gain;
+  double digital_gain;
+  double awb_red_gain;
+  double awb_blue_gain;
+  const char *message;  /// CAMERA_EVENT_ERROR only
+} CAMERA_EVENT;
+
+typedef struct {
+  int camera_num;           /// Sensor on a Compute Module, 0 or 1
+  int width;                /// Still size
+  int height;
+  int quality;              /// JPEG quality 1-100
+  int burst;                /// Stills taken by each capture()
+  int zsl;                  /// Zero shutter lag, keep the still path primed
+  int soft_jpeg_threads;    /// Encode raw frames as stills on this many
+                            /// threads instead of using the still port
+  int video_width;          /// Raw frame and recording size
+  int video_height;
+  int video_framerate;
+  int settings_events;      /// Report exposure and gain changes
+  int annotate;             /// Draw set_annotation() text onto the frames
+  int verbose;
+  const char *record_dir;   /// H.264 loop recording, NULL to disable
+  uint32_t bitrate;         /// Recording bitrate, bits per second
+  int segment_seconds;      /// Length of each recorded segment
+  int segment_count;        /// Segments kept before the oldest is reused
+  int pre_event_seconds;    /// Video kept in RAM ahead of an event
+  int post_event_seconds;   /// Video saved after an event
+  size_t event_buffer_bytes; /// Memory limit of the pre-event buffer
+} CAMERA_PARAMS;
+
+/** Defaults of the dashcam: 1280x720 stills, 1080p30 recording disabled */
+void camera_default_params(CAMERA_PARAMS *params);
+
+class CameraBackend {
+public:
+  /**
+   * A raw frame, called on the camera thread. Must not block, copy what is
+   * needed and return.
+   *
+   * @param y First luma row
+   * @param width Visible width
+   * @param height Visible height
+   * @param stride Bytes between rows
+   * @param arrival_us Monotonic time the frame arrived
+   */
+  typedef std::function<void(const uint8_t *y, int width, int height,
+                             int stride, int64_t arrival_us)>
+      FrameHandler;
+
+  /** The same raw frame with its chroma, same rules as FrameHandler */
+  typedef std::function<void(const CAMERA_YUV &frame)> YuvHandler;
+
+  /**
+   * A chunk of still output, called in order on the backend's I/O thread.
+   * May block; the data is only valid during the call.
+   */
+  typedef std::function<void(const CAMERA_OUTPUT &output)> OutputHandler;
+
+  /** A control event, called on the camera thread */
+  typedef std::function<void(const CAMERA_EVENT &event)> EventHandler;
+
+  struct Handlers {
+    FrameHandler frame;   /// Raw frames, may be empty
+    YuvHandler yuv;       /// Raw frames with chroma, may be empty
+    OutputHandler output; /// Encoded stills
+    EventHandler event;   /// Control events, may be empty
+  };
+
+  CameraBackend(const CAMERA_PARAMS &params, const Handlers &handlers)
+      : params_(params), handlers_(handlers) {}
+  virtual ~CameraBackend() {}
+
+  /** Start the camera and the raw frames. @return 0 on success */
+  virtual int open() = 0;
+
+  /**
+   * Start a capture of params.burst stills, numbered frame upwards. The
+   * output handler sees the chunks of each still, tagged with its frame
+   * number, ending in one with CAMERA_OUTPUT_FRAME_END or
+   * CAMERA_OUTPUT_FAILED set. The first still carries timestamp_us, the
+   * rest the time they were requested.
+   *
+   * @return 0 if the capture was started
+   */
+  virtual int capture(uint32_t frame, int64_t timestamp_us) = 0;
+
+  /**
+   * Block until every still of the capture started last has been encoded.
+   * The stills of a burst follow each other as fast as the camera allows.
+   */
+  virtual void wait_capture() = 0;
+
+  /**
+   * When the sensor exposed the first still of the last capture, on the
+   * monotonic_us() clock. Valid after wait_capture(); with zero shutter lag
+   * it can be before the capture() call.
+   *
+   * @return 0 if the backend can't tell
+   */
+  virtual int64_t last_exposure_us() const { return 0; }
+
+  /**
+   * Save the recent video around now as an event, if recording. Only sets
+   * a flag, safe from any thread.
+   */
+  virtual void trigger_event() {}
+
+  /**
+   * Refresh the metadata of the stills that follow: the time, the frame
+   * number of the next capture, and the position when fix is given. May talk
+   * to the camera, so call it between captures, never on the trigger path.
+   */
+  virtual void update_tags(const GPS_FIX *fix, uint32_t frame) {}
+
+  /**
+   * Draw text onto the frames that follow, with params.annotate set. Only
+   * talks to the camera when the text differs from the last, but like
+   * update_tags() belongs between captures.
+   */
+  virtual void set_annotation(const char *text) {}
+
+  /** Stop the raw frames, the frame handler is not called after this */
+  virtual void stop_frames() = 0;
+
+  /** Print output queue and recording statistics */
+  virtual void report(FILE *out) const = 0;
+
+  /** Short description used in the startup banner */
+  virtual const char *describe() const = 0;
+
+protected:
+  CAMERA_PARAMS params_;
+  Handlers handlers_;
+};
+
+/**
+ * Create and open a backend from a command line spec:
+ *   "mmal"                  the Pi camera
+ *   "synthetic[:<fps>]"     generated frames, 30 fps by default
+ *   "replay:<dir>[:<fps>]"  the JPEG files in dir, in name order, looped
+ *
+ * With params.soft_jpeg_threads set, the backend is wrapped in a
+ * SoftJpegCamera that takes its stills from the raw frames.
+ *
+ * @return NULL if the spec is invalid or the backend failed to open
+ */
+CameraBackend *camera_create(const char *spec, const CAMERA_PARAMS &params,
+                             const CameraBackend::Handlers &handlers);
+
+#endif /* CAMERABACKEND_H_ */
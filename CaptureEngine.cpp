@@ -0,0 +1,105 @@
+#include "CaptureEngine.h"
+
+#include <inttypes.h>
+
+#include "Trace.h"
+
+CaptureEngine::CaptureEngine(uint32_t camera)
+    : camera_(camera), need_crc_(false), need_settings_(false), gps_(NULL),
+      reserve_(0), frames_(0), failed_(0), last_end_us_(0),
+      fanout_("sink fan-out"), spacing_("burst spacing") {}
+
+CaptureEngine::~CaptureEngine() {
+  for (size_t i = 0; i < sinks_.size(); i++)
+    delete sinks_[i];
+}
+
+void CaptureEngine::add_sink(FrameSink *sink) {
+  sinks_.push_back(sink);
+  if (sink->needs_crc())
+    need_crc_ = true;
+  if (sink->needs_settings())
+    need_settings_ = true;
+}
+
+void CaptureEngine::set_settings(const CAMERA_EVENT &event) {
+  FrameSettings &settings = settings_.back();
+
+  settings.exposure_us = event.exposure_us;
+  settings.analog_gain = event.analog_gain;
+  settings.digital_gain = event.digital_gain;
+  settings.awb_red_gain = event.awb_red_gain;
+  settings.awb_blue_gain = event.awb_blue_gain;
+  settings_.publish();
+}
+
+void CaptureEngine::write(const CAMERA_OUTPUT &output) {
+  if (output.length) {
+    if (!frame_) {
+      frame_ = std::make_shared<Frame>();
+      frame_->camera = camera_;
+      // Sinks may still hold the last frame, so its buffer can't be reused,
+      // but its size keeps this one from growing in steps
+      frame_->data.reserve(reserve_);
+      // A few loads from the reader's slot, never waits on the serial line
+      GPS_FIX fix;
+      if (gps_ && gps_->latest(&fix)) {
+        frame_->location.valid = true;
+        frame_->location.latitude = fix.latitude;
+        frame_->location.longitude = fix.longitude;
+        frame_->location.altitude_m = fix.altitude_m;
+        frame_->location.speed_mps = fix.speed_mps;
+        frame_->location.course_deg = fix.course_deg;
+      }
+    }
+    frame_->data.insert(frame_->data.end(), output.data,
+                        output.data + output.length);
+    // While the chunk is still in cache
+    if (need_crc_)
+      frame_->crc = crc32_update(frame_->crc, output.data, output.length);
+  }
+
+  if (output.flags & CAMERA_OUTPUT_FAILED) {
+    // The sinks keep the previous frame
+    failed_++;
+    frame_.reset();
+    return;
+  }
+  if (!(output.flags & CAMERA_OUTPUT_FRAME_END) || !frame_)
+    return;
+
+  FramePtr frame;
+  frame.swap(frame_);
+  frame->number = output.frame;
+  frame->timestamp_us = output.timestamp_us;
+  frame->pts_us = output.pts_us;
+  // Settings stay in effect until the next change is reported
+  settings_.update();
+  frame->settings = settings_.front();
+  reserve_ = frame->data.size() + frame->data.size() / 8;
+
+  int64_t start = monotonic_us();
+  // Stills of one burst, as they come out of the encoder
+  if (output.burst_index > 0 && last_end_us_)
+    spacing_.add(start - last_end_us_);
+  last_end_us_ = start;
+  for (size_t i = 0; i < sinks_.size(); i++)
+    sinks_[i]->write(frame);
+  int64_t end = monotonic_us();
+  fanout_.add(end - start);
+  frames_++;
+  trace_event(TRACE_INSTANT, "write complete", frame->number, camera_, end);
+  trace_event(TRACE_END, "frame", frame->number, camera_, end);
+}
+
+void CaptureEngine::report(FILE *out) const {
+  fprintf(out, "Frames %" PRIu64 ", failed %" PRIu64 ", %d sinks\n",
+          frames_.load(), failed_.load(), (int)sinks_.size());
+  fanout_.report(out);
+  if (spacing_.count() && spacing_.mean() > 0) {
+    fprintf(out, "Burst rate %.1f fps\n", 1e6 / spacing_.mean());
+    spacing_.report(out);
+  }
+  for (size_t i = 0; i < sinks_.size(); i++)
+    sinks_[i]->report(out);
+}
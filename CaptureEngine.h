@@ -0,0 +1,87 @@
+/**
+ * \file CaptureEngine.h
+ * Turns camera output into frames and fans them out to the sinks.
+ *
+ * The chunks of each still are appended to one Frame as they arrive, with
+ * the CRC computed on the way if any sink sends it. At the end of the still
+ * the frame is handed, by reference, to every sink in the order they were
+ * added. This is the only copy of the encoder output, however many sinks
+ * there are.
+ */
+
+#ifndef CAPTUREENGINE_H_
+#define CAPTUREENGINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <vector>
+
+#include "CameraBackend.h"
+#include "Frame.h"
+#include "FrameSink.h"
+#include "Gps.h"
+#include "Stats.h"
+#include "TripleBuffer.h"
+
+class CaptureEngine {
+public:
+  /** @param camera Camera id the frames are tagged with, CAMERA_* */
+  explicit CaptureEngine(uint32_t camera);
+  ~CaptureEngine();
+
+  /** Add a sink, before the camera starts. Takes ownership. */
+  void add_sink(FrameSink *sink);
+
+  /** Camera output handler, run on the camera's I/O thread */
+  void write(const CAMERA_OUTPUT &output);
+
+  /** Handler to give the camera backend */
+  CameraBackend::OutputHandler handler() {
+    return [this](const CAMERA_OUTPUT &output) { write(output); };
+  }
+
+  /**
+   * Latest sensor settings, tagged onto the frames that follow. Call it from
+   * the camera's event handler, one thread only; it never blocks.
+   */
+  void set_settings(const CAMERA_EVENT &event);
+
+  /** Tag frames with the latest fix of gps, before the camera starts */
+  void set_gps(const GpsReader *gps) { gps_ = gps; }
+
+  /** A sink records the sensor settings, have the camera report them */
+  bool needs_settings() const { return need_settings_; }
+
+  size_t sinks() const { return sinks_.size(); }
+  const FrameSink *sink(size_t i) const { return sinks_[i]; }
+
+  uint64_t frames() const { return frames_; }
+  uint64_t failed() const { return failed_; }
+  /** Time to pass one frame through all sinks */
+  const LatencyStats &fanout_stats() const { return fanout_; }
+  /** Time from one still of a burst to the next, for the achieved rate */
+  const LatencyStats &burst_stats() const { return spacing_; }
+
+  /** Print frame counts, the fan-out time and every sink's statistics */
+  void report(FILE *out) const;
+
+private:
+  uint32_t camera_;
+  std::vector<FrameSink *> sinks_;
+  bool need_crc_;
+  bool need_settings_;
+  TripleBuffer<FrameSettings> settings_; /// Event thread to I/O thread
+  const GpsReader *gps_;
+  FramePtr frame_;  /// Still being assembled
+  size_t reserve_;  /// Capacity to start the next frame with
+  std::atomic<uint64_t> frames_;
+  std::atomic<uint64_t> failed_;
+  int64_t last_end_us_; /// When the last still was complete
+  LatencyStats fanout_; /// Time to pass one frame through all sinks
+  LatencyStats spacing_; /// Between the stills of a burst
+};
+
+#endif /* CAPTUREENGINE_H_ */
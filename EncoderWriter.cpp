@@ -0,0 +1,93 @@
+#include "EncoderWriter.h"
+
+#include "interface/vcos/vcos.h"
+#include "interface/mmal/mmal_logging.h"
+
+EncoderWriter::EncoderWriter(MMAL_PORT_T *port, MMAL_POOL_T *pool,
+                             Handler handler, void *context)
+    : port_(port), pool_(pool), handler_(handler), context_(context),
+      // Every header of the pool can be queued at once, so push never fails
+      queue_(pool->headers_num), running_(true), max_depth_(0), held_(0),
+      stalls_(0) {
+  sem_init(&ready_, 0, 0);
+  thread_ = std::thread(&EncoderWriter::run, this);
+}
+
+EncoderWriter::~EncoderWriter() {
+  ENCODER_OUTPUT output;
+
+  running_ = false;
+  sem_post(&ready_);
+  thread_.join();
+
+  while (queue_.pop(&output))
+    mmal_buffer_header_release(output.buffer);
+  sem_destroy(&ready_);
+}
+
+/**
+ * Give the port a buffer from the pool, if the port is still enabled
+ *
+ * @return 0 if a buffer was sent or none was needed, -1 if the pool was empty
+ */
+int EncoderWriter::send_free_buffer() {
+  MMAL_BUFFER_HEADER_T *new_buffer;
+
+  if (!port_->is_enabled)
+    return 0;
+
+  new_buffer = mmal_queue_get(pool_->queue);
+  if (!new_buffer)
+    return -1;
+
+  if (mmal_port_send_buffer(port_, new_buffer) != MMAL_SUCCESS) {
+    // Lost a race with the port being disabled, keep the buffer for later
+    mmal_queue_put(pool_->queue, new_buffer);
+  }
+  return 0;
+}
+
+void EncoderWriter::submit(const ENCODER_OUTPUT &output) {
+  held_++;
+  if (!queue_.push(output)) {
+    held_--;
+    vcos_log_error("Encoder writer queue full, dropping buffer");
+    mmal_buffer_header_release(output.buffer);
+  } else {
+    sem_post(&ready_);
+  }
+
+  size_t depth = queue_.size();
+  if (depth > max_depth_)
+    max_depth_ = depth;
+
+  // The buffer we were handed is still in flight on the I/O thread, feed the
+  // encoder another one now so it can carry on with the frame. The pool is
+  // usually empty because the port has the rest, it only starves when this
+  // thread and the I/O thread hold every header between them.
+  if (send_free_buffer() != 0 && held_ >= pool_->headers_num)
+    stalls_++;
+}
+
+void EncoderWriter::run() {
+  ENCODER_OUTPUT output;
+
+  while (1) {
+    sem_wait(&ready_);
+    if (!queue_.pop(&output)) {
+      if (!running_)
+        break;
+      continue;
+    }
+
+    mmal_buffer_header_mem_lock(output.buffer);
+    handler_(&output, context_);
+    mmal_buffer_header_mem_unlock(output.buffer);
+
+    held_--;
+    mmal_buffer_header_release(output.buffer);
+
+    // If the encoder ran dry while we held its buffers, restart it
+    send_free_buffer();
+  }
+}
@@ -0,0 +1,82 @@
+/**
+ * \file EncoderWriter.h
+ * Moves encoder output off the MMAL callback thread.
+ *
+ * The encoder buffer callback hands each filled buffer header to submit(),
+ * which only queues it. A dedicated I/O thread runs the (possibly blocking)
+ * write handler, releases the header back to the encoder pool and sends a
+ * free buffer back to the encoder port. A slow SD card or network link then
+ * delays the buffers it is holding, but never the callback thread.
+ */
+
+#ifndef ENCODERWRITER_H_
+#define ENCODERWRITER_H_
+
+#include <stdint.h>
+#include <semaphore.h>
+
+#include <atomic>
+#include <thread>
+
+#include "interface/mmal/mmal.h"
+
+#include "SpscQueue.h"
+
+/** One filled encoder buffer plus the capture it belongs to */
+typedef struct {
+  MMAL_BUFFER_HEADER_T *buffer;
+  uint32_t frame;       /// Frame number of the still
+  uint32_t burst_index; /// Position of the still in its burst
+  int64_t timestamp_us; /// Wall clock time the still was requested
+} ENCODER_OUTPUT;
+
+class EncoderWriter {
+public:
+  /**
+   * Called on the I/O thread with the buffer data locked
+   *
+   * @param output Buffer and capture information
+   * @param context Context pointer given to the constructor
+   */
+  typedef void (*Handler)(const ENCODER_OUTPUT *output, void *context);
+
+  /**
+   * @param port Encoder output port buffers are returned to
+   * @param pool Pool the port's buffers come from
+   * @param handler Write handler run on the I/O thread
+   * @param context Passed through to the handler
+   */
+  EncoderWriter(MMAL_PORT_T *port, MMAL_POOL_T *pool, Handler handler,
+                void *context);
+  ~EncoderWriter();
+
+  /**
+   * Queue a filled buffer and give the port a free one in its place. Takes
+   * ownership of the header. Only call from the encoder callback thread.
+   */
+  void submit(const ENCODER_OUTPUT &output);
+
+  size_t depth() const { return queue_.size(); }
+  size_t max_depth() const { return max_depth_; }
+  /// Times the encoder port was left without a buffer to fill because the
+  /// I/O thread was still holding them all
+  uint64_t stalls() const { return stalls_; }
+
+private:
+  void run();
+  int send_free_buffer();
+
+  MMAL_PORT_T *port_;
+  MMAL_POOL_T *pool_;
+  Handler handler_;
+  void *context_;
+  SpscQueue<ENCODER_OUTPUT> queue_;
+  sem_t ready_;
+  std::atomic<bool> running_;
+  std::atomic<size_t> max_depth_;
+  std::atomic<unsigned int> held_; /// Headers submitted and not yet released
+  std::atomic<uint64_t> stalls_;
+  std::thread thread_;
+};
+
+#endif /* ENCODERWRITER_H_ */
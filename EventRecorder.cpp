@@ -0,0 +1,265 @@
+#include "EventRecorder.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "Publisher.h"
+#include "SegmentRecorder.h"
+
+EventRecorder::EventRecorder(const char *dir, int pre_seconds,
+                             int post_seconds, size_t max_bytes)
+    : dir_(dir), pre_us_((int64_t)pre_seconds * 1000000),
+      post_us_((int64_t)post_seconds * 1000000), max_bytes_(max_bytes),
+      event_end_pts_(SEGMENT_NO_PTS), skipping_(false), ring_bytes_(0),
+      triggered_(0), trigger_us_(0), events_(0), dropped_(0),
+      queued_bytes_(0), running_(true), flush_latency_("event pre-flush") {
+  thread_ = std::thread(&EventRecorder::run, this);
+}
+
+EventRecorder::~EventRecorder() {
+  // A trigger no frame has followed yet still saves the video before it
+  if (triggered_.exchange(0) && event_end_pts_ == SEGMENT_NO_PTS &&
+      !ring_.empty()) {
+    Job job;
+    job.begin = true;
+    job.end = false;
+    job.trigger_us = trigger_us_;
+    job.wallclock_us = wallclock_us();
+    job.chunks.assign(ring_.begin(), ring_.end());
+    queue(job);
+    events_++;
+    event_end_pts_ = ring_.back()->pts_us;
+  }
+
+  // Close off an event in progress with what we have
+  if (event_end_pts_ != SEGMENT_NO_PTS) {
+    Job job;
+    job.begin = false;
+    job.end = true;
+    queue(job);
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    running_ = false;
+  }
+  ready_.notify_one();
+  thread_.join();
+}
+
+void EventRecorder::trigger() {
+  trigger_us_ = monotonic_us();
+  triggered_ = 1;
+}
+
+/**
+ * Hand a job to the flush thread.
+ *
+ * @return false if post-event frames would take the queue past max_bytes_ and
+ *         were not queued
+ */
+bool EventRecorder::queue(const Job &job) {
+  size_t bytes = 0;
+  size_t i;
+
+  for (i = 0; i < job.chunks.size(); i++)
+    bytes += job.chunks[i]->data.size();
+
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    // The pre-event frames are shared with the ring and so already bounded
+    if (!job.begin && bytes && queued_bytes_ + bytes > max_bytes_)
+      return false;
+    jobs_.push_back(job);
+    jobs_.back().bytes = bytes;
+    queued_bytes_ += bytes;
+  }
+  ready_.notify_one();
+  return true;
+}
+
+void EventRecorder::write(const uint8_t *data, size_t len, int64_t pts_us,
+                          unsigned flags) {
+  if (!building_) {
+    building_ = std::make_shared<EncodedChunk>();
+    building_->pts_us = SEGMENT_NO_PTS;
+    building_->keyframe = false;
+  }
+
+  // SPS/PPS go in front of the keyframe they belong to
+  building_->data.insert(building_->data.end(), data, data + len);
+  if (flags & SEGMENT_CONFIG)
+    return;
+
+  if (flags & SEGMENT_KEYFRAME)
+    building_->keyframe = true;
+  if (pts_us != SEGMENT_NO_PTS)
+    building_->pts_us = pts_us;
+
+  if (flags & SEGMENT_FRAME_END) {
+    ChunkPtr chunk = building_;
+    building_.reset();
+    append(chunk);
+  }
+}
+
+/**
+ * Drop the oldest group of pictures while the ring is longer than the
+ * pre-event time, or bigger than allowed
+ */
+void EventRecorder::evict() {
+  while (ring_.size() > 1) {
+    int64_t newest = ring_.back()->pts_us;
+    size_t next_key;
+
+    for (next_key = 1; next_key < ring_.size(); next_key++) {
+      if (ring_[next_key]->keyframe)
+        break;
+    }
+
+    // Would the ring still cover pre_us_ if it started at the next keyframe?
+    bool long_enough = next_key < ring_.size() &&
+                       newest - ring_[next_key]->pts_us >= pre_us_;
+    bool too_big = ring_bytes_ > max_bytes_;
+    if (!long_enough && !too_big)
+      break;
+
+    // With no other keyframe in the ring only the byte limit can force this,
+    // the flush thread skips to the next keyframe
+    if (next_key == ring_.size())
+      next_key = 1;
+    while (next_key--) {
+      ring_bytes_ -= ring_.front()->data.size();
+      ring_.pop_front();
+    }
+  }
+}
+
+void EventRecorder::append(const ChunkPtr &chunk) {
+  if (triggered_.exchange(0)) {
+    if (event_end_pts_ == SEGMENT_NO_PTS) {
+      Job job;
+      job.begin = true;
+      job.end = false;
+      job.trigger_us = trigger_us_;
+      job.wallclock_us = wallclock_us();
+      // Copies references only, the frames stay shared with the ring
+      job.chunks.assign(ring_.begin(), ring_.end());
+      queue(job);
+      events_++;
+      skipping_ = false;
+    }
+    // A trigger during an event extends it
+    event_end_pts_ = chunk->pts_us + post_us_;
+  }
+
+  ring_.push_back(chunk);
+  ring_bytes_ += chunk->data.size();
+  evict();
+
+  if (event_end_pts_ != SEGMENT_NO_PTS) {
+    Job job;
+    job.begin = false;
+    job.end = chunk->pts_us >= event_end_pts_;
+
+    // After a drop the file can only carry on from a keyframe
+    if (chunk->keyframe)
+      skipping_ = false;
+    if (!skipping_) {
+      job.chunks.push_back(chunk);
+      if (!queue(job)) {
+        job.chunks.clear();
+        skipping_ = true;
+      }
+    }
+    if (job.chunks.empty()) {
+      dropped_++;
+      if (job.end)
+        queue(job);
+    }
+    if (job.end)
+      event_end_pts_ = SEGMENT_NO_PTS;
+  }
+}
+
+void EventRecorder::run() {
+  FilePublisher *file = NULL;
+  int64_t first_pts = SEGMENT_NO_PTS;
+  int64_t trigger_pts = SEGMENT_NO_PTS;
+  int64_t last_pts = SEGMENT_NO_PTS;
+  size_t bytes = 0;
+  std::string path;
+
+  while (1) {
+    Job job;
+    size_t i;
+
+    {
+      std::unique_lock<std::mutex> guard(lock_);
+      while (running_ && jobs_.empty())
+        ready_.wait(guard);
+      if (jobs_.empty())
+        break;
+      job = jobs_.front();
+      jobs_.pop_front();
+      queued_bytes_ -= job.bytes;
+    }
+
+    if (job.begin) {
+      char name[64];
+      time_t seconds = job.wallclock_us / 1000000;
+      struct tm tm;
+
+      localtime_r(&seconds, &tm);
+      strftime(name, sizeof(name), "/event-%Y%m%d-%H%M%S.h264", &tm);
+      path = dir_ + name;
+
+      delete file;
+      file = new FilePublisher(path.c_str(), PUBLISH_SYNC_DATA);
+      if (file->begin() != 0) {
+        delete file;
+        file = NULL;
+      }
+      first_pts = SEGMENT_NO_PTS;
+      trigger_pts = SEGMENT_NO_PTS;
+      bytes = 0;
+    }
+
+    for (i = 0; file && i < job.chunks.size(); i++) {
+      const EncodedChunk &chunk = *job.chunks[i];
+
+      // A file has to start at a keyframe to be playable
+      if (first_pts == SEGMENT_NO_PTS && !chunk.keyframe)
+        continue;
+      if (first_pts == SEGMENT_NO_PTS)
+        first_pts = chunk.pts_us;
+      if (file->append(chunk.data.data(), chunk.data.size()) != 0) {
+        delete file;
+        file = NULL;
+        break;
+      }
+      last_pts = chunk.pts_us;
+      bytes += chunk.data.size();
+    }
+
+    if (job.begin && file) {
+      flush_latency_.add(monotonic_us() - job.trigger_us);
+      trigger_pts = last_pts;
+    }
+
+    if (job.end && file) {
+      if (file->commit() == 0)
+        fprintf(stderr, "Event %s: %.1f s before, %.1f s after, %zu bytes\n",
+                path.c_str(),
+                trigger_pts != SEGMENT_NO_PTS ? (trigger_pts - first_pts) / 1e6
+                                              : 0.0,
+                trigger_pts != SEGMENT_NO_PTS ? (last_pts - trigger_pts) / 1e6
+                                              : 0.0,
+                bytes);
+      delete file;
+      file = NULL;
+    }
+  }
+
+  delete file;
+}
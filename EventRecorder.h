@@ -0,0 +1,124 @@
+/**
+ * \file EventRecorder.h
+ * In-RAM pre-event buffer for the H.264 stream.
+ *
+ * The last few seconds of encoded video are kept in a ring of frames that
+ * always starts at a keyframe and is bounded both in time and in bytes.
+ * When an event is triggered the ring is snapshotted, which only copies
+ * references, and handed to a flush thread together with the frames that
+ * follow until the post-event time has passed. The encoder side never waits
+ * for the disk.
+ *
+ * Frames waiting for a slow disk are bounded by the same byte limit as the
+ * ring. Past it the post-event frames are dropped up to the next keyframe
+ * and counted, so the file stays playable.
+ *
+ * Each event is written to <dir>/event-YYYYmmdd-HHMMSS.h264 and only appears
+ * under that name once complete.
+ */
+
+#ifndef EVENTRECORDER_H_
+#define EVENTRECORDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Stats.h"
+
+/** One encoded frame, SPS/PPS included for keyframes. Immutable once built. */
+struct EncodedChunk {
+  int64_t pts_us;
+  bool keyframe;
+  std::vector<uint8_t> data;
+};
+
+typedef std::shared_ptr<const EncodedChunk> ChunkPtr;
+
+class EventRecorder {
+public:
+  /**
+   * @param dir Directory the event files go to, must exist
+   * @param pre_seconds Footage kept from before the trigger
+   * @param post_seconds Footage written after the trigger
+   * @param max_bytes Upper bound on the memory held by the ring, and on the
+   *                  frames queued for the flush thread
+   */
+  EventRecorder(const char *dir, int pre_seconds, int post_seconds,
+                size_t max_bytes);
+  ~EventRecorder();
+
+  /**
+   * Add one encoder buffer. Only call from the thread that writes the
+   * stream.
+   *
+   * @param data Buffer payload
+   * @param len Payload length
+   * @param pts_us Presentation time, SEGMENT_NO_PTS if unknown
+   * @param flags SEGMENT_* flags from SegmentRecorder.h
+   */
+  void write(const uint8_t *data, size_t len, int64_t pts_us, unsigned flags);
+
+  /** Save the buffered and upcoming footage. Safe from any thread. */
+  void trigger();
+
+  /** Bytes held by the ring */
+  size_t ring_bytes() const { return ring_bytes_; }
+  uint64_t events() const { return events_; }
+  /** Post-event frames not saved because the flush thread fell behind */
+  uint64_t dropped() const { return dropped_; }
+
+  /** Time from trigger() to the pre-event footage being on disk */
+  const LatencyStats &flush_latency() const { return flush_latency_; }
+
+private:
+  struct Job {
+    std::vector<ChunkPtr> chunks;
+    bool begin;          /// Start a new event file with these chunks
+    bool end;            /// Complete the event file after these chunks
+    int64_t trigger_us;  /// Monotonic time of the trigger, for begin
+    int64_t wallclock_us; /// Names the file, for begin
+    size_t bytes;        /// Payload of chunks, set by queue()
+  };
+
+  void append(const ChunkPtr &chunk);
+  void evict();
+  bool queue(const Job &job);
+  void run();
+
+  std::string dir_;
+  int64_t pre_us_;
+  int64_t post_us_;
+  size_t max_bytes_;
+
+  // Writer thread only
+  std::shared_ptr<EncodedChunk> building_; /// Frame being assembled
+  std::deque<ChunkPtr> ring_;
+  int64_t event_end_pts_; /// SEGMENT_NO_PTS unless an event is running
+  bool skipping_;         /// Dropping post-event frames until a keyframe
+  std::atomic<size_t> ring_bytes_;
+
+  std::atomic<int> triggered_;
+  std::atomic<int64_t> trigger_us_;
+  std::atomic<uint64_t> events_;
+  std::atomic<uint64_t> dropped_;
+
+  // Flush thread
+  std::mutex lock_;
+  std::condition_variable ready_;
+  std::deque<Job> jobs_;
+  size_t queued_bytes_;
+  bool running_;
+  std::thread thread_;
+  LatencyStats flush_latency_;
+};
+
+#endif /* EVENTRECORDER_H_ */
@@ -0,0 +1,60 @@
+/**
+ * \file Frame.h
+ * One complete encoded frame and the metadata that travels with it.
+ */
+
+#ifndef FRAME_H_
+#define FRAME_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+/// Camera ids carried in the frame header
+#define CAMERA_LEFT 0
+#define CAMERA_RIGHT 1
+
+/** Sensor settings a frame was taken with, all 0 if unknown */
+struct FrameSettings {
+  FrameSettings()
+      : exposure_us(0), analog_gain(0), digital_gain(0), awb_red_gain(0),
+        awb_blue_gain(0) {}
+
+  uint32_t exposure_us;
+  float analog_gain;
+  float digital_gain;
+  float awb_red_gain;
+  float awb_blue_gain;
+};
+
+/** Where a frame was taken, from the GPS */
+struct FrameLocation {
+  FrameLocation()
+      : valid(false), latitude(0), longitude(0), altitude_m(0), speed_mps(0),
+        course_deg(0) {}
+
+  bool valid;          /// There was a recent fix, the rest is set
+  double latitude;     /// Degrees, north positive
+  double longitude;    /// Degrees, east positive
+  float altitude_m;
+  float speed_mps;
+  float course_deg;
+};
+
+struct Frame {
+  Frame() : camera(0), number(0), timestamp_us(0), pts_us(0), crc(0) {}
+
+  uint32_t camera;          /// Which camera of the rig produced the frame
+  uint32_t number;          /// Frame counter of the producing process
+  int64_t timestamp_us;     /// Wall clock time the capture was issued
+  int64_t pts_us;           /// Sensor timestamp on the camera clock, 0 unknown
+  FrameSettings settings;   /// Latest settings reported before the frame
+  FrameLocation location;   /// GPS fix when the still began
+  uint32_t crc;             /// CRC-32 of data, 0 unless computed
+  std::vector<uint8_t> data; /// Encoded image
+};
+
+typedef std::shared_ptr<Frame> FramePtr;
+
+#endif /* FRAME_H_ */
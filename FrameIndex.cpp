@@ -0,0 +1,260 @@
+#include "FrameIndex.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+/// Written as is, so a reader on the other byte order sees it reversed
+#define FRAME_INDEX_BYTE_ORDER 0x01020304
+
+static_assert(sizeof(FRAME_INDEX_HEADER) == 64, "index header layout");
+static_assert(sizeof(FRAME_INDEX_RECORD) == 96, "index record layout");
+
+/** @return 0 if the header is one this build can read */
+static int check_header(const FRAME_INDEX_HEADER *header, const char *path) {
+  if (memcmp(header->magic, FRAME_INDEX_MAGIC, sizeof(header->magic)) != 0) {
+    fprintf(stderr, "%s is not a frame index\n", path);
+    return -1;
+  }
+  if (header->byte_order != FRAME_INDEX_BYTE_ORDER ||
+      header->version != FRAME_INDEX_VERSION ||
+      header->record_size != sizeof(FRAME_INDEX_RECORD)) {
+    fprintf(stderr, "%s: unsupported frame index version or byte order\n",
+            path);
+    return -1;
+  }
+  return 0;
+}
+
+/** write() until all of data is written. @return 0 on success */
+static int write_all(int fd, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+FrameIndexWriter::FrameIndexWriter(const char *index_path,
+                                   const char *data_path)
+    : index_path_(index_path), data_path_(data_path), index_fd_(-1),
+      data_fd_(-1), records_(0), data_end_(0) {}
+
+FrameIndexWriter::~FrameIndexWriter() {
+  if (index_fd_ >= 0)
+    close(index_fd_);
+  if (data_fd_ >= 0)
+    close(data_fd_);
+}
+
+int FrameIndexWriter::open() {
+  FRAME_INDEX_HEADER header;
+  struct stat st;
+
+  index_fd_ = ::open(index_path_.c_str(),
+                     O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (index_fd_ < 0 || fstat(index_fd_, &st) != 0) {
+    fprintf(stderr, "Cannot open %s: %s\n", index_path_.c_str(),
+            strerror(errno));
+    return -1;
+  }
+
+  if (st.st_size == 0) {
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FRAME_INDEX_MAGIC, sizeof(header.magic));
+    header.version = FRAME_INDEX_VERSION;
+    header.record_size = sizeof(FRAME_INDEX_RECORD);
+    header.byte_order = FRAME_INDEX_BYTE_ORDER;
+    if (write_all(index_fd_, &header, sizeof(header)) != 0) {
+      fprintf(stderr, "Cannot write %s: %s\n", index_path_.c_str(),
+              strerror(errno));
+      return -1;
+    }
+  } else {
+    if (pread(index_fd_, &header, sizeof(header), 0) != sizeof(header)) {
+      fprintf(stderr, "%s is not a frame index\n", index_path_.c_str());
+      return -1;
+    }
+    if (check_header(&header, index_path_.c_str()) != 0)
+      return -1;
+
+    records_ = (st.st_size - sizeof(header)) / sizeof(FRAME_INDEX_RECORD);
+    off_t end = sizeof(header) + records_ * sizeof(FRAME_INDEX_RECORD);
+    // The tail of a record cut short would misalign every one after it
+    if (st.st_size != end && ftruncate(index_fd_, end) != 0) {
+      fprintf(stderr, "Cannot truncate %s: %s\n", index_path_.c_str(),
+              strerror(errno));
+      return -1;
+    }
+    if (records_) {
+      FRAME_INDEX_RECORD last;
+      if (pread(index_fd_, &last, sizeof(last), end - sizeof(last)) !=
+          sizeof(last)) {
+        fprintf(stderr, "Cannot read %s: %s\n", index_path_.c_str(),
+                strerror(errno));
+        return -1;
+      }
+      data_end_ = last.offset + last.size;
+    }
+  }
+
+  data_fd_ = ::open(data_path_.c_str(),
+                    O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (data_fd_ < 0 || fstat(data_fd_, &st) != 0) {
+    fprintf(stderr, "Cannot open %s: %s\n", data_path_.c_str(),
+            strerror(errno));
+    return -1;
+  }
+  if ((uint64_t)st.st_size > data_end_) {
+    // A still written without its record, nothing can find it
+    if (ftruncate(data_fd_, data_end_) != 0) {
+      fprintf(stderr, "Cannot truncate %s: %s\n", data_path_.c_str(),
+              strerror(errno));
+      return -1;
+    }
+  } else if ((uint64_t)st.st_size < data_end_) {
+    fprintf(stderr, "%s is shorter than its index, the last stills are lost\n",
+            data_path_.c_str());
+    data_end_ = st.st_size;
+  }
+  return 0;
+}
+
+int FrameIndexWriter::append(const Frame &frame, bool sync) {
+  FRAME_INDEX_RECORD record;
+
+  if (write_all(data_fd_, frame.data.data(), frame.data.size()) != 0 ||
+      (sync && fdatasync(data_fd_) != 0)) {
+    fprintf(stderr, "Cannot write %s: %s\n", data_path_.c_str(),
+            strerror(errno));
+    // The next record starts at the real end of the data
+    struct stat st;
+    if (fstat(data_fd_, &st) == 0)
+      data_end_ = st.st_size;
+    return -1;
+  }
+
+  memset(&record, 0, sizeof(record));
+  record.frame = frame.number;
+  record.camera = frame.camera;
+  record.wallclock_us = frame.timestamp_us;
+  record.pts_us = frame.pts_us;
+  record.offset = data_end_;
+  record.size = frame.data.size();
+  record.crc = frame.crc;
+  record.exposure_us = frame.settings.exposure_us;
+  record.analog_gain = frame.settings.analog_gain;
+  record.digital_gain = frame.settings.digital_gain;
+  record.awb_red_gain = frame.settings.awb_red_gain;
+  record.awb_blue_gain = frame.settings.awb_blue_gain;
+  if (frame.location.valid) {
+    record.gps_valid = 1;
+    record.latitude = frame.location.latitude;
+    record.longitude = frame.location.longitude;
+    record.altitude_m = frame.location.altitude_m;
+    record.speed_mps = frame.location.speed_mps;
+    record.course_deg = frame.location.course_deg;
+  }
+  data_end_ += frame.data.size();
+
+  // One write of one record, O_APPEND keeps it whole unless the disk is full
+  if (write(index_fd_, &record, sizeof(record)) != sizeof(record)) {
+    fprintf(stderr, "Cannot write %s: %s\n", index_path_.c_str(),
+            strerror(errno));
+    if (ftruncate(index_fd_, sizeof(FRAME_INDEX_HEADER) +
+                                 records_ * sizeof(FRAME_INDEX_RECORD)) != 0)
+      fprintf(stderr, "Cannot truncate %s: %s\n", index_path_.c_str(),
+              strerror(errno));
+    return -1;
+  }
+  records_++;
+  return 0;
+}
+
+FrameIndexReader::FrameIndexReader()
+    : fd_(-1), map_(NULL), map_size_(0), records_(NULL), count_(0) {}
+
+FrameIndexReader::~FrameIndexReader() {
+  unmap();
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+int FrameIndexReader::open(const char *path) {
+  path_ = path;
+  fd_ = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) {
+    fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  return map();
+}
+
+int FrameIndexReader::refresh() {
+  struct stat st;
+
+  if (fstat(fd_, &st) != 0)
+    return -1;
+  if ((size_t)st.st_size == map_size_)
+    return 0;
+  unmap();
+  return map();
+}
+
+int FrameIndexReader::map() {
+  struct stat st;
+
+  if (fstat(fd_, &st) != 0 || (size_t)st.st_size < sizeof(FRAME_INDEX_HEADER)) {
+    fprintf(stderr, "%s is not a frame index\n", path_.c_str());
+    return -1;
+  }
+  map_ = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd_, 0);
+  if (map_ == MAP_FAILED) {
+    map_ = NULL;
+    fprintf(stderr, "Cannot map %s: %s\n", path_.c_str(), strerror(errno));
+    return -1;
+  }
+  map_size_ = st.st_size;
+  if (check_header((const FRAME_INDEX_HEADER *)map_, path_.c_str()) != 0) {
+    unmap();
+    return -1;
+  }
+  records_ = (const FRAME_INDEX_RECORD *)((const uint8_t *)map_ +
+                                          sizeof(FRAME_INDEX_HEADER));
+  // A record being appended right now is left for the next refresh()
+  count_ = (map_size_ - sizeof(FRAME_INDEX_HEADER)) /
+           sizeof(FRAME_INDEX_RECORD);
+  return 0;
+}
+
+void FrameIndexReader::unmap() {
+  if (map_)
+    munmap(map_, map_size_);
+  map_ = NULL;
+  map_size_ = 0;
+  records_ = NULL;
+  count_ = 0;
+}
+
+size_t FrameIndexReader::lower_bound(int64_t wallclock_us) const {
+  const FRAME_INDEX_RECORD *found = std::lower_bound(
+      records_, records_ + count_, wallclock_us,
+      [](const FRAME_INDEX_RECORD &record, int64_t us) {
+        return record.wallclock_us < us;
+      });
+  return found - records_;
+}
@@ -0,0 +1,136 @@
+/**
+ * \file FrameIndex.h
+ * Append-only index of every captured still, one fixed-size record each.
+ *
+ * The index file is a header followed by FRAME_INDEX_RECORDs in capture
+ * order. Records are never rewritten, so a reader can map the file while the
+ * camera keeps appending, and a time range is found by binary search over
+ * the mapping without opening any image. Each record points at its still in
+ * a data file of the stills written back to back.
+ *
+ * Records are in host byte order; the header says which, and readers refuse
+ * a file from the other order.
+ */
+
+#ifndef FRAMEINDEX_H_
+#define FRAMEINDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "Frame.h"
+
+/// First bytes of an index file
+#define FRAME_INDEX_MAGIC "DCFIDX1\n"
+/// Record layout version, bumped when FRAME_INDEX_RECORD changes
+#define FRAME_INDEX_VERSION 2
+
+typedef struct {
+  char magic[8];         /// FRAME_INDEX_MAGIC
+  uint32_t version;      /// FRAME_INDEX_VERSION
+  uint32_t record_size;  /// sizeof(FRAME_INDEX_RECORD)
+  uint32_t byte_order;   /// 0x01020304 as written by the host
+  uint32_t reserved[11];
+} FRAME_INDEX_HEADER;
+
+typedef struct {
+  uint32_t frame;        /// Frame number of the producing process
+  uint32_t camera;       /// CAMERA_*
+  int64_t wallclock_us;  /// Wall clock time the capture was issued
+  int64_t pts_us;        /// Sensor timestamp on the camera clock, 0 unknown
+  uint64_t offset;       /// Where the still starts in the data file
+  uint32_t size;         /// Still size in bytes
+  uint32_t crc;          /// CRC-32 of the still, 0 if not computed
+  uint32_t exposure_us;  /// Sensor settings, 0 if unknown
+  float analog_gain;
+  float digital_gain;
+  float awb_red_gain;
+  float awb_blue_gain;
+  uint32_t gps_valid;    /// 1 if the location fields are set
+  double latitude;       /// Degrees, north positive
+  double longitude;      /// Degrees, east positive
+  float altitude_m;
+  float speed_mps;
+  float course_deg;
+  uint32_t reserved;
+} FRAME_INDEX_RECORD;
+
+/**
+ * Appends stills to the data file and their records to the index. Not
+ * thread safe, run it from the one thread that writes the frames.
+ */
+class FrameIndexWriter {
+public:
+  /**
+   * @param index_path Index file, created if missing
+   * @param data_path Data file the stills go to, created if missing
+   */
+  FrameIndexWriter(const char *index_path, const char *data_path);
+  ~FrameIndexWriter();
+
+  /**
+   * Open both files for appending. A record cut short by a crash is dropped
+   * from the index, and anything in the data file past the last record.
+   *
+   * @return 0 on success, -1 on error
+   */
+  int open();
+
+  /**
+   * Append the frame's data, then its record
+   *
+   * @param sync Sync the data before the record goes in, so a record never
+   * points past the end of the data after a power loss
+   * @return 0 on success, -1 on error
+   */
+  int append(const Frame &frame, bool sync);
+
+  uint64_t records() const { return records_; }
+
+private:
+  std::string index_path_;
+  std::string data_path_;
+  int index_fd_;
+  int data_fd_;
+  uint64_t records_;
+  uint64_t data_end_;  /// Where the next still goes
+};
+
+/**
+ * Read-only view of an index file, which may still be growing
+ */
+class FrameIndexReader {
+public:
+  FrameIndexReader();
+  ~FrameIndexReader();
+
+  /** Map the index. @return 0 on success, -1 if missing or not an index */
+  int open(const char *path);
+
+  /** Map the records appended since open() or the last refresh() */
+  int refresh();
+
+  size_t count() const { return count_; }
+  const FRAME_INDEX_RECORD &record(size_t i) const { return records_[i]; }
+
+  /**
+   * First record taken at or after wallclock_us, count() if none. Assumes
+   * the wall clock only moves forward, which a clock step breaks around it.
+   */
+  size_t lower_bound(int64_t wallclock_us) const;
+
+private:
+  int map();
+  void unmap();
+
+  std::string path_;
+  int fd_;
+  void *map_;
+  size_t map_size_;
+  const FRAME_INDEX_RECORD *records_;
+  size_t count_;
+};
+
+#endif /* FRAMEINDEX_H_ */
@@ -0,0 +1,339 @@
+#include "FrameLink.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/// Reconnect backoff limits
+#define BACKOFF_MIN_MS 100
+#define BACKOFF_MAX_MS 5000
+/// Give up on a connect() that has not completed in this time
+#define CONNECT_TIMEOUT_MS 1000
+/// Unacknowledged data this old means the peer is gone (half-open link)
+#define USER_TIMEOUT_MS 5000
+
+static uint32_t crc_table[4][256];
+
+static void crc32_init_table() {
+  uint32_t i, j, c;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (j = 0; j < 8; j++)
+      c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    crc_table[0][i] = c;
+  }
+  for (i = 0; i < 256; i++) {
+    c = crc_table[0][i];
+    for (j = 1; j < 4; j++) {
+      c = crc_table[0][c & 0xff] ^ (c >> 8);
+      crc_table[j][i] = c;
+    }
+  }
+}
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len) {
+  static const bool initialised = (crc32_init_table(), true);
+  const uint8_t *p = (const uint8_t *)data;
+
+  (void)initialised;
+  crc = ~crc;
+
+  // Slice by four, one table lookup per byte but no serial dependency
+  // between the four bytes of a word
+  while (len >= 4) {
+    crc ^= (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[3] << 24);
+    crc = crc_table[3][crc & 0xff] ^ crc_table[2][(crc >> 8) & 0xff] ^
+          crc_table[1][(crc >> 16) & 0xff] ^ crc_table[0][crc >> 24];
+    p += 4;
+    len -= 4;
+  }
+  while (len--)
+    crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+  return ~crc;
+}
+
+static void put32(uint8_t *out, uint32_t v) {
+  v = htonl(v);
+  memcpy(out, &v, 4);
+}
+
+static uint32_t get32(const uint8_t *in) {
+  uint32_t v;
+  memcpy(&v, in, 4);
+  return ntohl(v);
+}
+
+void frame_link_pack(const FRAME_LINK_HEADER *header, uint8_t *out) {
+  put32(out + 0, header->magic);
+  put32(out + 4, ((uint32_t)header->version << 16) | header->camera);
+  put32(out + 8, header->frame);
+  put32(out + 12, header->size);
+  put32(out + 16, (uint32_t)(header->timestamp_us >> 32));
+  put32(out + 20, (uint32_t)header->timestamp_us);
+  put32(out + 24, header->crc);
+  put32(out + 28, header->reserved);
+}
+
+int frame_link_unpack(const uint8_t *in, FRAME_LINK_HEADER *header) {
+  uint32_t version_camera = get32(in + 4);
+
+  header->magic = get32(in + 0);
+  header->version = version_camera >> 16;
+  header->camera = version_camera & 0xffff;
+  header->frame = get32(in + 8);
+  header->size = get32(in + 12);
+  header->timestamp_us = ((uint64_t)get32(in + 16) << 32) | get32(in + 20);
+  header->crc = get32(in + 24);
+  header->reserved = get32(in + 28);
+
+  if (header->magic != FRAME_LINK_MAGIC ||
+      header->version != FRAME_LINK_VERSION ||
+      header->size > FRAME_LINK_MAX_FRAME)
+    return -1;
+
+  return 0;
+}
+
+/**
+ * Read exactly len bytes
+ *
+ * @return len on success, 0 on end of stream before any byte, -1 on error or
+ * a stream that ends part way
+ */
+static ssize_t read_full(int fd, uint8_t *buf, size_t len) {
+  size_t got = 0;
+
+  while (got < len) {
+    ssize_t n = read(fd, buf + got, len - got);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return (n == 0 && got == 0) ? 0 : -1;
+    got += n;
+  }
+
+  return got;
+}
+
+int frame_link_read(int fd, Frame *frame, int64_t *transfer_us) {
+  uint8_t raw[FRAME_LINK_HEADER_SIZE];
+  FRAME_LINK_HEADER header;
+  ssize_t n;
+
+  n = read_full(fd, raw, sizeof(raw));
+  if (n <= 0)
+    return n;
+
+  int64_t start = monotonic_us();
+
+  if (frame_link_unpack(raw, &header) != 0) {
+    fprintf(stderr, "Bad frame header\n");
+    return -1;
+  }
+
+  frame->camera = header.camera;
+  frame->number = header.frame;
+  frame->timestamp_us = header.timestamp_us;
+  frame->data.resize(header.size);
+
+  if (header.size && read_full(fd, frame->data.data(), header.size) <= 0)
+    return -1;
+
+  *transfer_us = monotonic_us() - start;
+
+  if (crc32_update(0, frame->data.data(), header.size) != header.crc) {
+    fprintf(stderr, "CRC mismatch on frame %u\n", header.frame);
+    return -1;
+  }
+  frame->crc = header.crc;
+
+  return 1;
+}
+
+FrameLinkClient::FrameLinkClient(const char *host, int port,
+                                 int send_timeout_ms)
+    : host_(host), port_(port), send_timeout_ms_(send_timeout_ms), fd_(-1),
+      backoff_ms_(BACKOFF_MIN_MS), next_attempt_us_(0), dropped_(0),
+      reconnects_(0), transfer_("link send") {}
+
+FrameLinkClient::~FrameLinkClient() { disconnect(); }
+
+void FrameLinkClient::disconnect() {
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+/**
+ * Connect with a bounded timeout, so an unreachable peer costs at most
+ * CONNECT_TIMEOUT_MS instead of the kernel SYN retry time.
+ *
+ * @return 0 if connected, -1 otherwise
+ */
+int FrameLinkClient::connect_now() {
+  struct addrinfo hints, *res = NULL, *ai;
+  char port[8];
+  int err;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(port, sizeof(port), "%d", port_);
+
+  err = getaddrinfo(host_.c_str(), port, &hints, &res);
+  if (err) {
+    fprintf(stderr, "Cannot resolve %s: %s\n", host_.c_str(),
+            gai_strerror(err));
+    return -1;
+  }
+
+  for (ai = res; ai; ai = ai->ai_next) {
+    int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                    ai->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    int rc = connect(fd, ai->ai_addr, ai->ai_addrlen);
+    if (rc < 0 && errno == EINPROGRESS) {
+      struct pollfd pfd = {fd, POLLOUT, 0};
+      socklen_t len = sizeof(err);
+
+      rc = -1;
+      if (poll(&pfd, 1, CONNECT_TIMEOUT_MS) == 1 &&
+          getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0)
+        rc = 0;
+    }
+
+    if (rc == 0) {
+      int one = 1;
+      unsigned int user_timeout = USER_TIMEOUT_MS;
+      struct timeval timeout = {send_timeout_ms_ / 1000,
+                                (send_timeout_ms_ % 1000) * 1000};
+
+      fcntl(fd, F_SETFL, flags);
+      // Each frame goes out in one writev(), don't hold back the tail
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+      // A peer that stops reading must not block the writer thread, and
+      // every sink behind it, once the send buffer fills
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+      // A half-open link (dashgrab gone, cable pulled) is torn down by the
+      // kernel, with enough slack for Wi-Fi retransmissions
+      setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout,
+                 sizeof(user_timeout));
+      fd_ = fd;
+      break;
+    }
+
+    close(fd);
+  }
+
+  freeaddrinfo(res);
+  return fd_ >= 0 ? 0 : -1;
+}
+
+int FrameLinkClient::send_all(const uint8_t *header, const Frame &frame) {
+  struct iovec iov[2];
+  size_t total = FRAME_LINK_HEADER_SIZE + frame.data.size();
+  size_t sent = 0;
+
+  while (sent < total) {
+    struct msghdr msg;
+    int iovcnt = 0;
+
+    if (sent < FRAME_LINK_HEADER_SIZE) {
+      iov[iovcnt].iov_base = (void *)(header + sent);
+      iov[iovcnt].iov_len = FRAME_LINK_HEADER_SIZE - sent;
+      iovcnt++;
+    }
+    size_t payload_sent =
+        sent > FRAME_LINK_HEADER_SIZE ? sent - FRAME_LINK_HEADER_SIZE : 0;
+    if (payload_sent < frame.data.size()) {
+      iov[iovcnt].iov_base = (void *)(frame.data.data() + payload_sent);
+      iov[iovcnt].iov_len = frame.data.size() - payload_sent;
+      iovcnt++;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    ssize_t n = sendmsg(fd_, &msg, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    // SO_SNDTIMEO ran out, the peer has stopped reading
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      errno = ETIMEDOUT;
+    if (n <= 0)
+      return -1;
+    sent += n;
+  }
+
+  return 0;
+}
+
+int FrameLinkClient::send(const Frame &frame, uint32_t crc) {
+  uint8_t raw[FRAME_LINK_HEADER_SIZE];
+  FRAME_LINK_HEADER header;
+  int attempt;
+
+  header.magic = FRAME_LINK_MAGIC;
+  header.version = FRAME_LINK_VERSION;
+  header.camera = frame.camera;
+  header.frame = frame.number;
+  header.size = frame.data.size();
+  header.timestamp_us = frame.timestamp_us;
+  header.crc = crc;
+  header.reserved = 0;
+  frame_link_pack(&header, raw);
+
+  // A connection that was idle may have been dropped by the peer without us
+  // noticing, so allow one immediate reconnect before giving up on the frame
+  for (attempt = 0; attempt < 2; attempt++) {
+    if (fd_ < 0) {
+      int64_t now = monotonic_us();
+
+      if (now < next_attempt_us_)
+        break;
+      if (connect_now() != 0) {
+        next_attempt_us_ = now + backoff_ms_ * 1000LL;
+        backoff_ms_ = backoff_ms_ * 2 > BACKOFF_MAX_MS ? BACKOFF_MAX_MS
+                                                       : backoff_ms_ * 2;
+        break;
+      }
+      backoff_ms_ = BACKOFF_MIN_MS;
+      reconnects_++;
+    }
+
+    int64_t start = monotonic_us();
+    if (send_all(raw, frame) == 0) {
+      transfer_.add(monotonic_us() - start);
+      return 0;
+    }
+
+    fprintf(stderr, "Frame link to %s lost: %s\n", host_.c_str(),
+            strerror(errno));
+    disconnect();
+  }
+
+  dropped_++;
+  return -1;
+}
@@ -0,0 +1,124 @@
+/**
+ * \file FrameLink.h
+ * Length-prefixed frame protocol between the cameras and dashgrab.
+ *
+ * Each frame on the stream is a fixed FrameLinkHeader followed by exactly
+ * header.size bytes of payload. All header fields are in network byte order.
+ * The connection stays open for the lifetime of the camera process.
+ */
+
+#ifndef FRAMELINK_H_
+#define FRAMELINK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+#include "Frame.h"
+#include "Stats.h"
+
+#define FRAME_LINK_MAGIC 0x44434652 /* "DCFR" */
+#define FRAME_LINK_VERSION 1
+#define FRAME_LINK_HEADER_SIZE 32
+/// Anything bigger than this is treated as a corrupt stream
+#define FRAME_LINK_MAX_FRAME (32 * 1024 * 1024)
+/// Default time a send may make no progress before the link is dropped
+#define FRAME_LINK_SEND_TIMEOUT_MS 2000
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t camera;
+  uint32_t frame;
+  uint32_t size;
+  uint64_t timestamp_us;
+  uint32_t crc;
+  uint32_t reserved;
+} FRAME_LINK_HEADER;
+
+/**
+ * Update a CRC-32 (IEEE 802.3, as zlib) with more data. Start with crc = 0.
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len);
+
+/**
+ * Serialise a header for the wire
+ *
+ * @param header Header to pack
+ * @param out Buffer of FRAME_LINK_HEADER_SIZE bytes
+ */
+void frame_link_pack(const FRAME_LINK_HEADER *header, uint8_t *out);
+
+/**
+ * Parse and validate a header from the wire
+ *
+ * @param in Buffer of FRAME_LINK_HEADER_SIZE bytes
+ * @param header Filled in on success
+ * @return 0 if the header is valid, -1 otherwise
+ */
+int frame_link_unpack(const uint8_t *in, FRAME_LINK_HEADER *header);
+
+/**
+ * Blocking read of one frame from a connected socket
+ *
+ * @param fd Socket to read from
+ * @param frame Receives the frame metadata and payload
+ * @param transfer_us Set to the time between the header arriving and the
+ * last payload byte arriving
+ * @return 1 if a frame was read, 0 on orderly end of stream, -1 on error or
+ * a corrupt frame (bad header or CRC mismatch)
+ */
+int frame_link_read(int fd, Frame *frame, int64_t *transfer_us);
+
+/**
+ * Sending end of the link. Owns one long lived TCP connection and
+ * re-establishes it with exponential backoff when it drops. send() never
+ * sleeps for the backoff; frames arriving while the link is down are
+ * dropped and counted.
+ */
+class FrameLinkClient {
+public:
+  /**
+   * @param host Host running dashgrab
+   * @param port Port it listens on
+   * @param send_timeout_ms Drop the link when a send makes no progress for
+   *                        this long, a stalled peer blocks the writer at
+   *                        most that long
+   */
+  FrameLinkClient(const char *host, int port,
+                  int send_timeout_ms = FRAME_LINK_SEND_TIMEOUT_MS);
+  ~FrameLinkClient();
+
+  /**
+   * Send a frame
+   *
+   * @param frame Frame to send
+   * @param crc CRC-32 of frame.data, as computed with crc32_update()
+   * @return 0 if the frame was sent, -1 if it was dropped
+   */
+  int send(const Frame &frame, uint32_t crc);
+
+  /** Time spent handing each frame to the kernel */
+  const LatencyStats &transfer_stats() const { return transfer_; }
+  uint64_t dropped() const { return dropped_; }
+  uint64_t reconnects() const { return reconnects_; }
+
+private:
+  int connect_now();
+  void disconnect();
+  int send_all(const uint8_t *header, const Frame &frame);
+
+  std::string host_;
+  int port_;
+  int send_timeout_ms_;
+  int fd_;
+  int backoff_ms_;
+  int64_t next_attempt_us_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<uint64_t> reconnects_;
+  LatencyStats transfer_;
+};
+
+#endif /* FRAMELINK_H_ */
@@ -0,0 +1,218 @@
+#include "FrameSink.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/// Slots of a spool without a count
+#define SPOOL_DEFAULT_COUNT 1000
+
+/**
+ * A numbered file path has exactly one conversion, %u, %d or %x with an
+ * optional zero padded width
+ */
+static bool valid_numbered_path(const char *path) {
+  const char *p = strchr(path, '%');
+
+  if (!p)
+    return true;
+  p++;
+  while (*p >= '0' && *p <= '9')
+    p++;
+  if (*p != 'u' && *p != 'd' && *p != 'x')
+    return false;
+  return strchr(p, '%') == NULL;
+}
+
+FileSink::FileSink(const char *path, PUBLISH_SYNC_T sync)
+    : path_(path), sync_(sync), numbered_(strchr(path, '%') != NULL),
+      publisher_(path, sync), description_(std::string("file ") + path),
+      failed_(0), latency_("publish") {}
+
+void FileSink::write(const FramePtr &frame) {
+  int64_t start = monotonic_us();
+  int rc;
+
+  if (numbered_) {
+    char path[512];
+
+    snprintf(path, sizeof(path), path_.c_str(), frame->number);
+    FilePublisher publisher(path, sync_);
+    rc = publisher.publish(frame->data.data(), frame->data.size());
+  } else {
+    rc = publisher_.publish(frame->data.data(), frame->data.size());
+  }
+  if (rc != 0) {
+    failed_++;
+    return;
+  }
+  latency_.add(monotonic_us() - start);
+}
+
+void FileSink::report(FILE *out) const {
+  latency_.report(out);
+  if (failed_)
+    fprintf(out, "%s: %" PRIu64 " writes failed\n", description_.c_str(),
+            failed_.load());
+}
+
+LinkSink::LinkSink(const char *host, int port, int send_timeout_ms)
+    : link_(host, port, send_timeout_ms), down_(false) {
+  char text[128];
+
+  snprintf(text, sizeof(text), "link to %s:%d", host, port);
+  description_ = text;
+}
+
+void LinkSink::write(const FramePtr &frame) {
+  // Only the changes are logged, the drops are counted for report()
+  if (link_.send(*frame, frame->crc) != 0) {
+    if (!down_)
+      fprintf(stderr, "%s down, dropping frames from %u\n",
+              description_.c_str(), frame->number);
+    down_ = true;
+  } else if (down_) {
+    fprintf(stderr, "%s back at frame %u, %" PRIu64 " dropped so far\n",
+            description_.c_str(), frame->number, link_.dropped());
+    down_ = false;
+  }
+}
+
+void LinkSink::report(FILE *out) const {
+  link_.transfer_stats().report(out);
+  fprintf(out, "Frames dropped %" PRIu64 ", reconnects %" PRIu64 "\n",
+          link_.dropped(), link_.reconnects());
+}
+
+SpoolSink::SpoolSink(const char *dir, int count, PUBLISH_SYNC_T sync)
+    : dir_(dir), count_(count), sync_(sync), next_(0), failed_(0),
+      latency_("spool write") {
+  char text[256];
+
+  struct timespec oldest = {0, 0};
+
+  snprintf(text, sizeof(text), "spool of %d in %s", count, dir);
+  description_ = text;
+
+  // Carry on from the last run: start with an unused slot, or else the one
+  // written longest ago
+  for (int i = 0; i < count_; i++) {
+    char path[512];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s/still%04d.jpg", dir_.c_str(), i);
+    if (stat(path, &st) != 0) {
+      next_ = i;
+      break;
+    }
+    if (i == 0 || st.st_mtim.tv_sec < oldest.tv_sec ||
+        (st.st_mtim.tv_sec == oldest.tv_sec &&
+         st.st_mtim.tv_nsec < oldest.tv_nsec)) {
+      oldest = st.st_mtim;
+      next_ = i;
+    }
+  }
+}
+
+void SpoolSink::write(const FramePtr &frame) {
+  char path[512];
+  int64_t start = monotonic_us();
+
+  // Through a temporary file, so a reader never sees a slot half rewritten
+  snprintf(path, sizeof(path), "%s/still%04d.jpg", dir_.c_str(), next_);
+  FilePublisher publisher(path, sync_);
+  if (publisher.publish(frame->data.data(), frame->data.size()) != 0) {
+    failed_++;
+    return;
+  }
+  next_ = (next_ + 1) % count_;
+  latency_.add(monotonic_us() - start);
+}
+
+void SpoolSink::report(FILE *out) const {
+  latency_.report(out);
+  if (failed_)
+    fprintf(out, "%s: %" PRIu64 " writes failed\n", description_.c_str(),
+            failed_.load());
+}
+
+IndexSink::IndexSink(const char *dir, PUBLISH_SYNC_T sync)
+    : writer_((std::string(dir) + "/stills.idx").c_str(),
+              (std::string(dir) + "/stills.dat").c_str()),
+      sync_(sync != PUBLISH_SYNC_NONE),
+      description_(std::string("index in ") + dir), failed_(0),
+      latency_("index append") {}
+
+void IndexSink::write(const FramePtr &frame) {
+  int64_t start = monotonic_us();
+
+  if (writer_.append(*frame, sync_) != 0) {
+    failed_++;
+    return;
+  }
+  latency_.add(monotonic_us() - start);
+}
+
+void IndexSink::report(FILE *out) const {
+  latency_.report(out);
+  fprintf(out, "%s: %" PRIu64 " records", description_.c_str(),
+          writer_.records());
+  if (failed_)
+    fprintf(out, ", %" PRIu64 " appends failed", failed_.load());
+  fputc('\n', out);
+}
+
+FrameSink *frame_sink_create(const char *spec, LatestFrame *latest,
+                             PUBLISH_SYNC_T sync) {
+  if (!strncmp(spec, "file:", 5) && spec[5] && valid_numbered_path(spec + 5))
+    return new FileSink(spec + 5, sync);
+
+  if (!strncmp(spec, "link:", 5)) {
+    std::string host(spec + 5);
+    size_t comma = host.find(',');
+    int timeout_ms = FRAME_LINK_SEND_TIMEOUT_MS;
+
+    if (comma != std::string::npos) {
+      timeout_ms = atoi(host.c_str() + comma + 1);
+      host.erase(comma);
+    }
+
+    size_t colon = host.rfind(':');
+    if (colon != std::string::npos && colon > 0 &&
+        atoi(host.c_str() + colon + 1) > 0 && timeout_ms > 0) {
+      int port = atoi(host.c_str() + colon + 1);
+      host.erase(colon);
+      return new LinkSink(host.c_str(), port, timeout_ms);
+    }
+  }
+
+  if (!strcmp(spec, "latest"))
+    return new LatestSink(latest);
+
+  if (!strncmp(spec, "spool:", 6) && spec[6]) {
+    std::string dir(spec + 6);
+    size_t colon = dir.rfind(':');
+    int count = SPOOL_DEFAULT_COUNT;
+
+    if (colon != std::string::npos) {
+      count = atoi(dir.c_str() + colon + 1);
+      dir.erase(colon);
+    }
+    if (count > 0 && !dir.empty())
+      return new SpoolSink(dir.c_str(), count, sync);
+  }
+
+  if (!strncmp(spec, "index:", 6) && spec[6]) {
+    IndexSink *sink = new IndexSink(spec + 6, sync);
+    if (sink->open() != 0) {
+      delete sink;
+      return NULL;
+    }
+    return sink;
+  }
+
+  fprintf(stderr, "Unknown sink '%s'\n", spec);
+  return NULL;
+}
@@ -0,0 +1,165 @@
+/**
+ * \file FrameSink.h
+ * Destinations for complete encoded frames.
+ *
+ * The CaptureEngine assembles each still once and hands the same FramePtr
+ * to every sink. Frames are immutable once assembled, so a sink that needs
+ * the frame past write() keeps the pointer instead of copying the data.
+ */
+
+#ifndef FRAMESINK_H_
+#define FRAMESINK_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <string>
+
+#include "Frame.h"
+#include "FrameIndex.h"
+#include "FrameLink.h"
+#include "LatestFrame.h"
+#include "Publisher.h"
+#include "Stats.h"
+
+class FrameSink {
+public:
+  virtual ~FrameSink() {}
+
+  /** Take a complete frame, called in order on the camera's I/O thread */
+  virtual void write(const FramePtr &frame) = 0;
+
+  /** The sink uses Frame::crc, have the engine compute it */
+  virtual bool needs_crc() const { return false; }
+
+  /** The sink uses Frame::settings, have the camera report them */
+  virtual bool needs_settings() const { return false; }
+
+  virtual void report(FILE *out) const = 0;
+
+  /** Short description used in the startup banner */
+  virtual const char *describe() const = 0;
+};
+
+/**
+ * Each frame atomically replaces one file, e.g. left.jpg in the web root.
+ * A path with a printf conversion, e.g. burst/still%06u.jpg, is given the
+ * frame number instead, so every frame gets a file of its own.
+ */
+class FileSink : public FrameSink {
+public:
+  FileSink(const char *path, PUBLISH_SYNC_T sync);
+
+  void write(const FramePtr &frame);
+  void report(FILE *out) const;
+  const char *describe() const { return description_.c_str(); }
+
+  const LatencyStats &latency() const { return latency_; }
+  uint64_t failed() const { return failed_; }
+
+private:
+  std::string path_;
+  PUBLISH_SYNC_T sync_;
+  bool numbered_;
+  FilePublisher publisher_; /// Unused when numbered_
+  std::string description_;
+  std::atomic<uint64_t> failed_;
+  LatencyStats latency_;
+};
+
+/** Each frame goes to dashgrab over the persistent frame link */
+class LinkSink : public FrameSink {
+public:
+  LinkSink(const char *host, int port,
+           int send_timeout_ms = FRAME_LINK_SEND_TIMEOUT_MS);
+
+  void write(const FramePtr &frame);
+  bool needs_crc() const { return true; }
+  void report(FILE *out) const;
+  const char *describe() const { return description_.c_str(); }
+
+  const FrameLinkClient &link() const { return link_; }
+
+private:
+  FrameLinkClient link_;
+  std::string description_;
+  bool down_;  /// Frames are being dropped, logged once until it recovers
+};
+
+/** Each frame replaces the live view slot, no copy is made */
+class LatestSink : public FrameSink {
+public:
+  explicit LatestSink(LatestFrame *latest) : latest_(latest) {}
+
+  void write(const FramePtr &frame) { latest_->publish(frame); }
+  void report(FILE *out) const {}
+  const char *describe() const { return "live view"; }
+
+private:
+  LatestFrame *latest_;
+};
+
+/**
+ * Every frame is kept on disk, in a fixed set of slots <dir>/still0000.jpg
+ * upwards. Once all slots are used the oldest one is overwritten.
+ */
+class SpoolSink : public FrameSink {
+public:
+  SpoolSink(const char *dir, int count, PUBLISH_SYNC_T sync);
+
+  void write(const FramePtr &frame);
+  void report(FILE *out) const;
+  const char *describe() const { return description_.c_str(); }
+
+private:
+  std::string dir_;
+  int count_;
+  PUBLISH_SYNC_T sync_;
+  int next_;
+  std::string description_;
+  std::atomic<uint64_t> failed_;
+  LatencyStats latency_;
+};
+
+/**
+ * Every frame is appended to <dir>/stills.dat, with a fixed-size record of
+ * its time, sensor settings, location and offset in the index
+ * <dir>/stills.idx, so a time range of months of stills is found without
+ * opening any of them
+ */
+class IndexSink : public FrameSink {
+public:
+  IndexSink(const char *dir, PUBLISH_SYNC_T sync);
+
+  /** Open or create the files. @return 0 on success */
+  int open() { return writer_.open(); }
+
+  void write(const FramePtr &frame);
+  bool needs_settings() const { return true; }
+  void report(FILE *out) const;
+  const char *describe() const { return description_.c_str(); }
+
+private:
+  FrameIndexWriter writer_;
+  bool sync_;
+  std::string description_;
+  std::atomic<uint64_t> failed_;
+  LatencyStats latency_;
+};
+
+/**
+ * Create a sink from a command line spec:
+ *   "file:<path>"           FileSink, path may hold one %u for the frame
+ *   "link:<host>:<port>[,<ms>]" LinkSink, ms is the send timeout
+ *   "latest"                LatestSink on latest
+ *   "spool:<dir>[:<count>]" SpoolSink, 1000 slots by default
+ *   "index:<dir>"           IndexSink
+ *
+ * @param sync How far file and spool sinks sync each frame
+ * @return NULL if the spec is invalid or the sink can't open its files
+ */
+FrameSink *frame_sink_create(const char *spec, LatestFrame *latest,
+                             PUBLISH_SYNC_T sync);
+
+#endif /* FRAMESINK_H_ */
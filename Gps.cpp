@@ -0,0 +1,326 @@
+#include "Gps.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <time.h>
+#include <termios.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "Stats.h"
+
+/// NMEA caps sentences at 82 characters, anything longer is line noise
+#define NMEA_MAX_LINE 128
+#define NMEA_MAX_FIELDS 24
+#define KNOTS_TO_MPS 0.514444
+/// How often the reader thread checks whether it should stop
+#define GPS_POLL_MS 200
+/// Where the simulated receiver starts, driving east at 50 km/h
+#define SIM_LATITUDE 52.0
+#define SIM_LONGITUDE 4.0
+#define SIM_SPEED_MPS 13.9
+
+/** ddmm.mmmm and a hemisphere letter to signed degrees */
+static double nmea_degrees(const char *value, const char *hemisphere) {
+  double v = atof(value);
+  double degrees = floor(v / 100);
+  double result = degrees + (v - degrees * 100) / 60;
+
+  return *hemisphere == 'S' || *hemisphere == 'W' ? -result : result;
+}
+
+/** hhmmss.ss and ddmmyy to microseconds since the epoch, 0 if missing */
+static int64_t nmea_time(const char *hms, const char *dmy) {
+  struct tm tm;
+  double seconds;
+
+  if (strlen(hms) < 6 || strlen(dmy) != 6)
+    return 0;
+  memset(&tm, 0, sizeof(tm));
+  tm.tm_hour = (hms[0] - '0') * 10 + hms[1] - '0';
+  tm.tm_min = (hms[2] - '0') * 10 + hms[3] - '0';
+  seconds = atof(hms + 4);
+  tm.tm_mday = (dmy[0] - '0') * 10 + dmy[1] - '0';
+  tm.tm_mon = (dmy[2] - '0') * 10 + dmy[3] - '0' - 1;
+  tm.tm_year = (dmy[4] - '0') * 10 + dmy[5] - '0' + 100;
+  return (int64_t)timegm(&tm) * 1000000 + (int64_t)(seconds * 1e6);
+}
+
+int nmea_parse(const char *line, GPS_FIX *fix) {
+  char text[NMEA_MAX_LINE];
+  char *fields[NMEA_MAX_FIELDS];
+  const char *star;
+  uint8_t checksum = 0;
+  int count = 0;
+  const char *p;
+
+  if (line[0] != '$' || !(star = strchr(line, '*')) ||
+      star - line >= NMEA_MAX_LINE)
+    return -1;
+  for (p = line + 1; p < star; p++)
+    checksum ^= (uint8_t)*p;
+  if (strtoul(star + 1, NULL, 16) != checksum)
+    return -1;
+
+  memcpy(text, line + 1, star - line - 1);
+  text[star - line - 1] = 0;
+  fields[count++] = text;
+  for (char *c = text; *c && count < NMEA_MAX_FIELDS; c++) {
+    if (*c == ',') {
+      *c = 0;
+      fields[count++] = c + 1;
+    }
+  }
+  // Any talker, GP, GN, GL...
+  if (strlen(fields[0]) != 5)
+    return 0;
+
+  if (!strcmp(fields[0] + 2, "RMC") && count >= 10) {
+    fix->valid = fields[2][0] == 'A';
+    if (fix->valid) {
+      fix->latitude = nmea_degrees(fields[3], fields[4]);
+      fix->longitude = nmea_degrees(fields[5], fields[6]);
+      fix->speed_mps = atof(fields[7]) * KNOTS_TO_MPS;
+      fix->course_deg = atof(fields[8]);
+    }
+    fix->utc_us = nmea_time(fields[1], fields[9]);
+    return 1;
+  }
+  if (!strcmp(fields[0] + 2, "GGA") && count >= 10) {
+    fix->quality = atoi(fields[6]);
+    fix->satellites = atoi(fields[7]);
+    fix->altitude_m = atof(fields[9]);
+  }
+  return 0;
+}
+
+GpsReader::GpsReader(const char *spec)
+    : spec_(spec), fd_(-1), sim_fd_(-1), running_(false), sentences_(0),
+      errors_(0) {}
+
+GpsReader::~GpsReader() {
+  running_ = false;
+  if (sim_thread_.joinable())
+    sim_thread_.join();
+  if (thread_.joinable())
+    thread_.join();
+  if (fd_ >= 0)
+    close(fd_);
+  if (sim_fd_ >= 0)
+    close(sim_fd_);
+}
+
+/** Raw 8N1 at baud, reads return whatever has arrived */
+int GpsReader::open_serial(const char *path, int baud) {
+  struct termios tio;
+  speed_t speed;
+
+  switch (baud) {
+  case 4800: speed = B4800; break;
+  case 9600: speed = B9600; break;
+  case 19200: speed = B19200; break;
+  case 38400: speed = B38400; break;
+  case 57600: speed = B57600; break;
+  case 115200: speed = B115200; break;
+  default:
+    fprintf(stderr, "GPS: unsupported baud rate %d\n", baud);
+    return -1;
+  }
+
+  fd_ = ::open(path, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+  if (fd_ < 0) {
+    fprintf(stderr, "Cannot open GPS %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  if (tcgetattr(fd_, &tio) == 0) {
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 1;
+    tio.c_cc[VTIME] = 0;
+    if (tcsetattr(fd_, TCSANOW, &tio) != 0) {
+      fprintf(stderr, "Cannot set up GPS %s: %s\n", path, strerror(errno));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int GpsReader::open_sim() {
+  const char *slave;
+
+  sim_fd_ = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if (sim_fd_ < 0 || grantpt(sim_fd_) != 0 || unlockpt(sim_fd_) != 0 ||
+      !(slave = ptsname(sim_fd_))) {
+    fprintf(stderr, "Cannot create a pseudo terminal: %s\n", strerror(errno));
+    return -1;
+  }
+  description_ = std::string("simulated GPS on ") + slave;
+  return open_serial(slave, 9600);
+}
+
+int GpsReader::open() {
+  if (spec_ == "sim") {
+    if (open_sim() != 0)
+      return -1;
+  } else {
+    std::string path(spec_);
+    size_t colon = path.rfind(':');
+    int baud = 9600;
+    char text[256];
+
+    if (colon != std::string::npos) {
+      baud = atoi(path.c_str() + colon + 1);
+      path.erase(colon);
+    }
+    if (open_serial(path.c_str(), baud) != 0)
+      return -1;
+    snprintf(text, sizeof(text), "GPS on %s at %d baud", path.c_str(), baud);
+    description_ = text;
+  }
+
+  running_ = true;
+  thread_ = std::thread(&GpsReader::run, this);
+  if (sim_fd_ >= 0)
+    sim_thread_ = std::thread(&GpsReader::run_sim, this);
+  return 0;
+}
+
+void GpsReader::run() {
+  char line[NMEA_MAX_LINE];
+  size_t length = 0;
+  GPS_FIX fix;
+  struct pollfd pfd;
+
+  memset(&fix, 0, sizeof(fix));
+  pfd.fd = fd_;
+  pfd.events = POLLIN;
+  while (running_) {
+    char buf[256];
+    ssize_t n;
+
+    if (poll(&pfd, 1, GPS_POLL_MS) <= 0)
+      continue;
+    n = read(fd_, buf, sizeof(buf));
+    if (n <= 0) {
+      if (n < 0 && (errno == EINTR || errno == EAGAIN))
+        continue;
+      // Unplugged, or the simulator has gone
+      usleep(GPS_POLL_MS * 1000);
+      continue;
+    }
+
+    for (ssize_t i = 0; i < n; i++) {
+      if (buf[i] == '\r')
+        continue;
+      if (buf[i] != '\n') {
+        // An overlong line is dropped whole at its end
+        if (length < sizeof(line) - 1)
+          line[length] = buf[i];
+        length++;
+        continue;
+      }
+      if (length == 0)
+        continue;
+      if (length >= sizeof(line)) {
+        errors_++;
+        length = 0;
+        continue;
+      }
+      line[length] = 0;
+      length = 0;
+
+      int rc = nmea_parse(line, &fix);
+      if (rc < 0) {
+        errors_++;
+        continue;
+      }
+      sentences_++;
+      if (rc == 1) {
+        fix.received_us = monotonic_us();
+        slot_.store(fix);
+      }
+    }
+  }
+}
+
+/** Append the checksum and line ending to a sentence body, "$...". */
+static void nmea_finish(char *sentence, size_t size) {
+  uint8_t checksum = 0;
+  size_t length = strlen(sentence);
+
+  for (size_t i = 1; i < length; i++)
+    checksum ^= (uint8_t)sentence[i];
+  snprintf(sentence + length, size - length, "*%02X\r\n", checksum);
+}
+
+/** Degrees to ddmm.mmmm, hemisphere separately */
+static void nmea_coordinate(double value, int degree_digits, char positive,
+                            char negative, char *text, size_t size) {
+  double magnitude = fabs(value);
+  int degrees = (int)magnitude;
+
+  snprintf(text, size, "%0*d%07.4f,%c", degree_digits, degrees,
+           (magnitude - degrees) * 60, value < 0 ? negative : positive);
+}
+
+/**
+ * The receiver, once a second: a GGA and an RMC sentence of a vehicle
+ * driving east at a steady speed
+ */
+void GpsReader::run_sim() {
+  double longitude = SIM_LONGITUDE;
+  int64_t next_us = monotonic_us();
+
+  while (running_) {
+    char sentence[NMEA_MAX_LINE], lat[32], lon[32], hms[16], dmy[16];
+    time_t now = time(NULL);
+    struct tm tm;
+
+    gmtime_r(&now, &tm);
+    strftime(hms, sizeof(hms), "%H%M%S.00", &tm);
+    strftime(dmy, sizeof(dmy), "%d%m%y", &tm);
+    nmea_coordinate(SIM_LATITUDE, 2, 'N', 'S', lat, sizeof(lat));
+    nmea_coordinate(longitude, 3, 'E', 'W', lon, sizeof(lon));
+
+    snprintf(sentence, sizeof(sentence), "$GPGGA,%s,%s,%s,1,08,0.9,12.0,M,,M,,",
+             hms, lat, lon);
+    nmea_finish(sentence, sizeof(sentence));
+    if (write(sim_fd_, sentence, strlen(sentence)) < 0)
+      break;
+    snprintf(sentence, sizeof(sentence), "$GPRMC,%s,A,%s,%s,%.1f,90.0,%s,,,A",
+             hms, lat, lon, SIM_SPEED_MPS / KNOTS_TO_MPS, dmy);
+    nmea_finish(sentence, sizeof(sentence));
+    if (write(sim_fd_, sentence, strlen(sentence)) < 0)
+      break;
+
+    // Metres east to degrees of longitude at this latitude
+    longitude += SIM_SPEED_MPS / (111320.0 * cos(SIM_LATITUDE * M_PI / 180));
+    next_us += 1000000;
+    while (running_ && monotonic_us() < next_us)
+      usleep(GPS_POLL_MS * 1000);
+  }
+}
+
+bool GpsReader::latest(GPS_FIX *fix) const {
+  if (!slot_.load(fix))
+    return false;
+  return fix->valid && monotonic_us() - fix->received_us < GPS_STALE_US;
+}
+
+void GpsReader::report(FILE *out) const {
+  GPS_FIX fix;
+
+  fprintf(out, "%s: %" PRIu64 " sentences, %" PRIu64 " bad", describe(),
+          sentences_.load(), errors_.load());
+  if (latest(&fix))
+    fprintf(out, ", fix %.6f %.6f, %d satellites, %.1f m/s\n", fix.latitude,
+            fix.longitude, fix.satellites, fix.speed_mps);
+  else
+    fprintf(out, ", no fix\n");
+}
@@ -0,0 +1,96 @@
+/**
+ * \file Gps.h
+ * Position from a GPS receiver speaking NMEA 0183 on a serial line.
+ *
+ * A reader thread parses the RMC and GGA sentences and publishes each
+ * complete fix to a SeqLock slot, so the capture path takes the latest one
+ * with a few loads and never waits on the serial line. A simulated receiver
+ * writes sentences into a pseudo terminal, which exercises the same serial
+ * and parsing code without hardware.
+ */
+
+#ifndef GPS_H_
+#define GPS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "SeqLock.h"
+
+/// Fixes older than this are not used to tag frames
+#define GPS_STALE_US (5 * 1000000)
+
+typedef struct {
+  int valid;           /// RMC status A, the position fields are set
+  int quality;         /// GGA fix quality, 0 if no GGA seen
+  int satellites;      /// Satellites used, from GGA
+  double latitude;     /// Degrees, north positive
+  double longitude;    /// Degrees, east positive
+  double altitude_m;   /// Above mean sea level, from GGA
+  double speed_mps;    /// Speed over ground
+  double course_deg;   /// True course over ground
+  int64_t utc_us;      /// Receiver's UTC time of the fix, Unix epoch
+  int64_t received_us; /// monotonic_us() the sentence completing it arrived
+} GPS_FIX;
+
+/**
+ * Parse one NMEA sentence into fix, checksum included. RMC completes a fix,
+ * GGA only adds to the one being built.
+ *
+ * @param line Sentence without the line ending
+ * @return 1 if an RMC sentence completed the fix, 0 if the sentence was used
+ * or ignored, -1 if it was malformed
+ */
+int nmea_parse(const char *line, GPS_FIX *fix);
+
+class GpsReader {
+public:
+  /**
+   * @param spec "<device>[:<baud>]", 9600 baud by default, or "sim" for a
+   * receiver simulated on a pseudo terminal
+   */
+  explicit GpsReader(const char *spec);
+  ~GpsReader();
+
+  /** Open the device and start the reader thread. @return 0 on success */
+  int open();
+
+  /**
+   * Copy the latest fix, from any thread without blocking
+   *
+   * @return true if there is a valid fix newer than GPS_STALE_US
+   */
+  bool latest(GPS_FIX *fix) const;
+
+  /** Changes with every published fix, 0 before the first */
+  uint32_t sequence() const {
+    GPS_FIX fix;
+    return slot_.load(&fix);
+  }
+
+  void report(FILE *out) const;
+  const char *describe() const { return description_.c_str(); }
+
+private:
+  int open_serial(const char *path, int baud);
+  int open_sim();
+  void run();
+  void run_sim();
+
+  std::string spec_;
+  std::string description_;
+  int fd_;
+  int sim_fd_;          /// Simulator's end of the pseudo terminal
+  SeqLock<GPS_FIX> slot_;
+  std::atomic<bool> running_;
+  std::atomic<uint64_t> sentences_;
+  std::atomic<uint64_t> errors_;
+  std::thread thread_;
+  std::thread sim_thread_;
+};
+
+#endif /* GPS_H_ */
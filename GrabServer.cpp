@@ -0,0 +1,226 @@
+#include "GrabServer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "Trace.h"
+
+/// Reads per connection per wakeup, so one busy camera can't starve the rest
+#define READS_PER_WAKEUP 16
+#define MAX_EVENTS 16
+
+GrabServer::GrabServer(int port, FrameHandler handler)
+    : port_(port), listen_fd_(-1), epoll_fd_(-1), handler_(handler),
+      transfer_("grab receive"), frames_(0), bytes_(0), errors_(0) {}
+
+GrabServer::~GrabServer() {
+  while (!connections_.empty())
+    drop(connections_.begin()->second);
+  if (epoll_fd_ >= 0)
+    close(epoll_fd_);
+  if (listen_fd_ >= 0)
+    close(listen_fd_);
+}
+
+int GrabServer::open() {
+  struct sockaddr_in serv_addr;
+  struct epoll_event ev;
+  int one = 1;
+
+  listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    perror("ERROR opening socket");
+    return -1;
+  }
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  memset(&serv_addr, 0, sizeof(serv_addr));
+  serv_addr.sin_family = AF_INET;
+  serv_addr.sin_addr.s_addr = INADDR_ANY;
+  serv_addr.sin_port = htons(port_);
+  if (bind(listen_fd_, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+    perror("ERROR on binding");
+    return -1;
+  }
+  if (listen(listen_fd_, 16) < 0) {
+    perror("ERROR on listen");
+    return -1;
+  }
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    perror("epoll_create1");
+    return -1;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL; // NULL marks the listening socket
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) < 0) {
+    perror("epoll_ctl listen");
+    return -1;
+  }
+
+  return 0;
+}
+
+void GrabServer::accept_clients() {
+  while (1) {
+    struct sockaddr_in cli_addr;
+    socklen_t clilen = sizeof(cli_addr);
+    struct epoll_event ev;
+
+    int fd = accept4(listen_fd_, (struct sockaddr *)&cli_addr, &clilen,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        perror("ERROR on accept");
+      return;
+    }
+
+    Connection *conn = new Connection;
+    conn->fd = fd;
+    conn->address = cli_addr.sin_addr.s_addr;
+    conn->state = READ_HEADER;
+    conn->got = 0;
+    conn->crc = 0;
+    conn->start_us = 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = conn;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      perror("epoll_ctl client");
+      close(fd);
+      delete conn;
+      continue;
+    }
+    connections_[fd] = conn;
+
+    printf("opened new communication with client %s\n\r",
+           inet_ntoa(cli_addr.sin_addr));
+  }
+}
+
+void GrabServer::drop(Connection *conn) {
+  struct in_addr addr;
+
+  addr.s_addr = conn->address;
+  printf("closed communication with client %s\n\r", inet_ntoa(addr));
+
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, conn->fd, NULL);
+  close(conn->fd);
+  connections_.erase(conn->fd);
+  delete conn;
+}
+
+/**
+ * Advance one connection's state machine with whatever data is available
+ *
+ * @return 1 to keep the connection, 0 if the peer closed it, -1 on error
+ */
+int GrabServer::service(Connection *conn) {
+  int reads;
+
+  for (reads = 0; reads < READS_PER_WAKEUP; reads++) {
+    ssize_t n;
+
+    if (conn->state == READ_HEADER) {
+      n = read(conn->fd, conn->header + conn->got,
+               FRAME_LINK_HEADER_SIZE - conn->got);
+    } else {
+      n = read(conn->fd, conn->frame->data.data() + conn->got,
+               conn->info.size - conn->got);
+    }
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+    }
+    if (n == 0)
+      return (conn->state == READ_HEADER && conn->got == 0) ? 0 : -1;
+
+    if (conn->state == READ_HEADER) {
+      conn->got += n;
+      if (conn->got < FRAME_LINK_HEADER_SIZE)
+        continue;
+
+      if (frame_link_unpack(conn->header, &conn->info) != 0) {
+        fprintf(stderr, "Bad frame header\n");
+        return -1;
+      }
+      conn->frame = std::make_shared<Frame>();
+      conn->frame->camera = conn->info.camera;
+      conn->frame->number = conn->info.frame;
+      conn->frame->timestamp_us = conn->info.timestamp_us;
+      conn->frame->data.resize(conn->info.size);
+      conn->state = READ_PAYLOAD;
+      conn->got = 0;
+      conn->crc = 0;
+      conn->start_us = monotonic_us();
+    } else {
+      // Checksum each chunk while it is still in cache
+      conn->crc = crc32_update(
+          conn->crc, conn->frame->data.data() + conn->got, n);
+      conn->got += n;
+    }
+
+    if (conn->state == READ_PAYLOAD && conn->got == conn->info.size) {
+      if (conn->crc != conn->info.crc) {
+        fprintf(stderr, "CRC mismatch on frame %u\n", conn->info.frame);
+        return -1;
+      }
+
+      transfer_.add(monotonic_us() - conn->start_us);
+      frames_++;
+      bytes_ += conn->info.size;
+
+      FramePtr frame;
+      frame.swap(conn->frame);
+      conn->state = READ_HEADER;
+      conn->got = 0;
+      trace_event(TRACE_INSTANT, "receive complete", frame->number,
+                  frame->camera);
+      handler_(frame, conn->address);
+    }
+  }
+
+  return 1;
+}
+
+void GrabServer::run(const std::atomic<int> &running, int poll_ms) {
+  struct epoll_event events[MAX_EVENTS];
+
+  while (running) {
+    int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, poll_ms);
+    int i;
+
+    if (n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      return;
+    }
+
+    for (i = 0; i < n; i++) {
+      Connection *conn = (Connection *)events[i].data.ptr;
+
+      if (!conn) {
+        accept_clients();
+        continue;
+      }
+
+      int rc = service(conn);
+      if (rc < 0)
+        errors_++;
+      if (rc <= 0)
+        drop(conn);
+    }
+  }
+}
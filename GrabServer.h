@@ -0,0 +1,83 @@
+/**
+ * \file GrabServer.h
+ * epoll based receive engine for dashgrab.
+ *
+ * One thread serves every camera connection. Sockets are non-blocking and
+ * each connection runs a small state machine (header -> payload -> header)
+ * over the FrameLink protocol, so a camera in the middle of a frame never
+ * holds up the others.
+ */
+
+#ifndef GRABSERVER_H_
+#define GRABSERVER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <map>
+
+#include "Frame.h"
+#include "FrameLink.h"
+#include "Stats.h"
+
+class GrabServer {
+public:
+  /**
+   * Called on the server thread for every complete, CRC checked frame
+   *
+   * @param frame The received frame
+   * @param address Peer IPv4 address, network byte order
+   */
+  typedef std::function<void(const FramePtr &frame, uint32_t address)>
+      FrameHandler;
+
+  GrabServer(int port, FrameHandler handler);
+  ~GrabServer();
+
+  /** Bind and listen. @return 0 on success */
+  int open();
+
+  /**
+   * Serve connections until running becomes 0. Checked at least every
+   * poll_ms milliseconds.
+   */
+  void run(const std::atomic<int> &running, int poll_ms = 500);
+
+  /** Time from a frame header arriving to its last payload byte */
+  const LatencyStats &transfer_stats() const { return transfer_; }
+  uint64_t frames() const { return frames_; }
+  uint64_t bytes() const { return bytes_; }
+  uint64_t errors() const { return errors_; }
+
+private:
+  enum State { READ_HEADER, READ_PAYLOAD };
+
+  struct Connection {
+    int fd;
+    uint32_t address;
+    State state;
+    uint8_t header[FRAME_LINK_HEADER_SIZE];
+    size_t got;               /// Bytes of the current header or payload
+    FRAME_LINK_HEADER info;   /// Parsed header of the frame in progress
+    uint32_t crc;             /// Running CRC of the payload so far
+    int64_t start_us;         /// When the header completed
+    FramePtr frame;
+  };
+
+  void accept_clients();
+  int service(Connection *conn);
+  void drop(Connection *conn);
+
+  int port_;
+  int listen_fd_;
+  int epoll_fd_;
+  FrameHandler handler_;
+  std::map<int, Connection *> connections_;
+  LatencyStats transfer_;
+  std::atomic<uint64_t> frames_;
+  std::atomic<uint64_t> bytes_;
+  std::atomic<uint64_t> errors_;
+};
+
+#endif /* GRABSERVER_H_ */
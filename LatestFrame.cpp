@@ -0,0 +1,53 @@
+#include "LatestFrame.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "Stats.h"
+
+LatestFrame::LatestFrame() : generation_(0), published_us_(0) {
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd_ < 0)
+    perror("eventfd");
+}
+
+LatestFrame::~LatestFrame() {
+  if (event_fd_ >= 0)
+    close(event_fd_);
+}
+
+void LatestFrame::publish(const FramePtr &frame) {
+  uint64_t one = 1;
+  FramePtr old;
+
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    // Drop our reference to the previous frame outside the lock
+    old.swap(frame_);
+    frame_ = frame;
+    generation_++;
+    published_us_ = monotonic_us();
+  }
+
+  if (event_fd_ >= 0 && write(event_fd_, &one, sizeof(one)) < 0)
+    perror("LatestFrame notify");
+}
+
+FramePtr LatestFrame::get(uint64_t *generation, int64_t *published_us) const {
+  std::lock_guard<std::mutex> guard(lock_);
+
+  if (generation)
+    *generation = generation_;
+  if (published_us)
+    *published_us = published_us_;
+  return frame_;
+}
+
+void LatestFrame::clear_event() {
+  uint64_t count;
+
+  if (event_fd_ >= 0 && read(event_fd_, &count, sizeof(count)) < 0) {
+    // EAGAIN, nothing was pending
+  }
+}
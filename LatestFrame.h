@@ -0,0 +1,51 @@
+/**
+ * \file LatestFrame.h
+ * Single slot holding the most recent frame of one camera.
+ *
+ * The producer replaces the frame, readers take a reference to it. Frames
+ * are immutable once published, so any number of readers share one copy
+ * and a slow reader simply keeps the old frame alive until it is done.
+ */
+
+#ifndef LATESTFRAME_H_
+#define LATESTFRAME_H_
+
+#include <stdint.h>
+
+#include <mutex>
+
+#include "Frame.h"
+
+class LatestFrame {
+public:
+  LatestFrame();
+  ~LatestFrame();
+
+  /** Replace the current frame and wake anyone polling event_fd() */
+  void publish(const FramePtr &frame);
+
+  /**
+   * Take a reference to the current frame
+   *
+   * @param generation Set to the number of frames published so far
+   * @param published_us Set to the monotonic time the frame was published
+   * @return The frame, empty if nothing has been published yet
+   */
+  FramePtr get(uint64_t *generation = NULL,
+               int64_t *published_us = NULL) const;
+
+  /** eventfd that becomes readable after each publish() */
+  int event_fd() const { return event_fd_; }
+
+  /** Reset event_fd() to not readable */
+  void clear_event();
+
+private:
+  mutable std::mutex lock_;
+  FramePtr frame_;
+  uint64_t generation_;
+  int64_t published_us_;
+  int event_fd_;
+};
+
+#endif /* LATESTFRAME_H_ */
@@ -0,0 +1,399 @@
+#include "MjpegServer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define MAX_EVENTS 16
+#define MAX_REQUEST 4096
+
+static const char stream_header[] =
+    "HTTP/1.0 200 OK\r\n"
+    "Cache-Control: no-cache, no-store\r\n"
+    "Pragma: no-cache\r\n"
+    "Connection: close\r\n"
+    "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n"
+    "\r\n";
+
+static const char not_found[] = "HTTP/1.0 404 Not Found\r\n"
+                                "Connection: close\r\n"
+                                "Content-Type: text/plain\r\n"
+                                "\r\n"
+                                "No such stream\r\n";
+
+static const char part_trailer[] = "\r\n";
+
+MjpegServer::MjpegServer(int port)
+    : port_(port), listen_fd_(-1), epoll_fd_(-1), delivery_("mjpeg delivery"),
+      viewers_(0) {}
+
+MjpegServer::~MjpegServer() {
+  while (!connections_.empty())
+    drop(connections_.begin()->second);
+  for (size_t i = 0; i < streams_.size(); i++)
+    delete streams_[i];
+  if (epoll_fd_ >= 0)
+    close(epoll_fd_);
+  if (listen_fd_ >= 0)
+    close(listen_fd_);
+}
+
+void MjpegServer::add_stream(const char *path, LatestFrame *slot) {
+  Stream *stream = new Stream;
+
+  stream->kind = STREAM;
+  stream->path = path;
+  stream->slot = slot;
+  streams_.push_back(stream);
+}
+
+int MjpegServer::open() {
+  struct sockaddr_in serv_addr;
+  struct epoll_event ev;
+  int one = 1;
+  size_t i;
+
+  listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    perror("ERROR opening socket");
+    return -1;
+  }
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  memset(&serv_addr, 0, sizeof(serv_addr));
+  serv_addr.sin_family = AF_INET;
+  serv_addr.sin_addr.s_addr = INADDR_ANY;
+  serv_addr.sin_port = htons(port_);
+  if (bind(listen_fd_, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+    perror("ERROR on binding");
+    return -1;
+  }
+  if (listen(listen_fd_, 16) < 0) {
+    perror("ERROR on listen");
+    return -1;
+  }
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    perror("epoll_create1");
+    return -1;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL; // NULL marks the listening socket
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev) < 0) {
+    perror("epoll_ctl listen");
+    return -1;
+  }
+
+  for (i = 0; i < streams_.size(); i++) {
+    ev.events = EPOLLIN;
+    ev.data.ptr = streams_[i];
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, streams_[i]->slot->event_fd(),
+                  &ev) < 0) {
+      perror("epoll_ctl stream");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+void MjpegServer::accept_viewers() {
+  while (1) {
+    struct sockaddr_in cli_addr;
+    socklen_t clilen = sizeof(cli_addr);
+    struct epoll_event ev;
+
+    int fd = accept4(listen_fd_, (struct sockaddr *)&cli_addr, &clilen,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        perror("ERROR on accept");
+      return;
+    }
+
+    Viewer *viewer = new Viewer;
+    viewer->kind = VIEWER;
+    viewer->fd = fd;
+    viewer->address = cli_addr.sin_addr.s_addr;
+    viewer->state = READ_REQUEST;
+    viewer->stream = NULL;
+    viewer->sent = 0;
+    viewer->want_out = false;
+    viewer->generation = 0;
+    viewer->published_us = 0;
+    viewer->connected_us = monotonic_us();
+    viewer->frames = 0;
+    viewer->skipped = 0;
+    viewer->bytes = 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = viewer;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      perror("epoll_ctl viewer");
+      close(fd);
+      delete viewer;
+      continue;
+    }
+    connections_[fd] = viewer;
+    viewers_++;
+  }
+}
+
+void MjpegServer::drop(Viewer *viewer) {
+  struct in_addr addr;
+  int64_t elapsed_us = monotonic_us() - viewer->connected_us;
+
+  addr.s_addr = viewer->address;
+  if (viewer->stream)
+    printf("viewer %s left %s: %llu frames, %llu skipped, %.1f KB/s\n\r",
+           inet_ntoa(addr), viewer->stream->path.c_str(),
+           (unsigned long long)viewer->frames,
+           (unsigned long long)viewer->skipped,
+           elapsed_us > 0 ? viewer->bytes * 1000.0 / elapsed_us : 0.0);
+
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, viewer->fd, NULL);
+  close(viewer->fd);
+  connections_.erase(viewer->fd);
+  delete viewer;
+}
+
+void MjpegServer::set_want_out(Viewer *viewer, bool want) {
+  struct epoll_event ev;
+
+  if (viewer->want_out == want)
+    return;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN | EPOLLRDHUP | (want ? (uint32_t)EPOLLOUT : 0);
+  ev.data.ptr = viewer;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, viewer->fd, &ev);
+  viewer->want_out = want;
+}
+
+/**
+ * Read the request line and pick the stream it asks for
+ *
+ * @return 1 to keep the connection, 0 to close it, -1 on error
+ */
+int MjpegServer::read_request(Viewer *viewer) {
+  char buf[512];
+  char path[256];
+  size_t i;
+
+  while (1) {
+    ssize_t n = read(viewer->fd, buf, sizeof(buf));
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      return -1;
+    }
+    if (n == 0)
+      return 0;
+    viewer->request.append(buf, n);
+    if (viewer->request.size() > MAX_REQUEST)
+      return -1;
+  }
+
+  // Wait for the end of the headers, we don't need any of them
+  if (viewer->request.find("\r\n\r\n") == std::string::npos &&
+      viewer->request.find("\n\n") == std::string::npos)
+    return 1;
+
+  if (sscanf(viewer->request.c_str(), "GET %255s", path) != 1)
+    return -1;
+  viewer->request.clear();
+
+  for (i = 0; i < streams_.size(); i++) {
+    if (streams_[i]->path == path)
+      viewer->stream = streams_[i];
+  }
+
+  if (!viewer->stream) {
+    // Small enough to go out in one go, don't care if it doesn't
+    send(viewer->fd, not_found, sizeof(not_found) - 1, MSG_NOSIGNAL);
+    return 0;
+  }
+
+  struct in_addr addr;
+  addr.s_addr = viewer->address;
+  printf("viewer %s joined %s\n\r", inet_ntoa(addr), path);
+
+  viewer->state = STREAMING;
+  viewer->head = stream_header;
+  return flush(viewer);
+}
+
+/**
+ * Start sending the slot's frame if it is newer than the last one sent
+ *
+ * @return 1 if a frame was started, 0 if there is nothing new
+ */
+int MjpegServer::next_frame(Viewer *viewer) {
+  uint64_t generation;
+  int64_t published_us;
+  char part[128];
+
+  FramePtr frame = viewer->stream->slot->get(&generation, &published_us);
+  if (!frame || generation == viewer->generation)
+    return 0;
+
+  if (viewer->generation)
+    viewer->skipped += generation - viewer->generation - 1;
+  viewer->generation = generation;
+  viewer->published_us = published_us;
+  viewer->frame = frame;
+
+  snprintf(part, sizeof(part),
+           "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: %zu\r\n\r\n",
+           frame->data.size());
+  viewer->head += part;
+  return 1;
+}
+
+/**
+ * Send as much of the pending data as the socket takes, moving on to newer
+ * frames as each one completes
+ *
+ * @return 1 to keep the connection, -1 on error
+ */
+int MjpegServer::flush(Viewer *viewer) {
+  while (1) {
+    if (viewer->head.empty() && !viewer->frame) {
+      if (next_frame(viewer))
+        continue;
+      set_want_out(viewer, false);
+      return 1;
+    }
+
+    size_t head_size = viewer->head.size();
+    size_t frame_size = viewer->frame ? viewer->frame->data.size() : 0;
+    size_t trailer_size = viewer->frame ? sizeof(part_trailer) - 1 : 0;
+    size_t total = head_size + frame_size + trailer_size;
+    size_t offset = viewer->sent;
+    struct iovec iov[3];
+    struct msghdr msg;
+    int iovcnt = 0;
+
+    // Point straight into the shared frame, no copy per viewer
+    if (offset < head_size) {
+      iov[iovcnt].iov_base = (void *)(viewer->head.data() + offset);
+      iov[iovcnt++].iov_len = head_size - offset;
+      offset = 0;
+    } else {
+      offset -= head_size;
+    }
+    if (offset < frame_size) {
+      iov[iovcnt].iov_base = viewer->frame->data.data() + offset;
+      iov[iovcnt++].iov_len = frame_size - offset;
+      offset = 0;
+    } else {
+      offset -= frame_size;
+    }
+    if (offset < trailer_size) {
+      iov[iovcnt].iov_base = (void *)(part_trailer + offset);
+      iov[iovcnt++].iov_len = trailer_size - offset;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    ssize_t n = sendmsg(viewer->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        set_want_out(viewer, true);
+        return 1;
+      }
+      return -1;
+    }
+
+    viewer->sent += n;
+    viewer->bytes += n;
+    if (viewer->sent < total)
+      continue;
+
+    if (viewer->frame) {
+      delivery_.add(monotonic_us() - viewer->published_us);
+      viewer->frames++;
+    }
+    viewer->head.clear();
+    viewer->frame.reset();
+    viewer->sent = 0;
+  }
+}
+
+void MjpegServer::run(const std::atomic<int> &running, int poll_ms) {
+  struct epoll_event events[MAX_EVENTS];
+
+  while (running) {
+    int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, poll_ms);
+    int i;
+
+    if (n < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      return;
+    }
+
+    for (i = 0; i < n; i++) {
+      Pollable *p = (Pollable *)events[i].data.ptr;
+
+      if (!p) {
+        accept_viewers();
+        continue;
+      }
+
+      if (p->kind == STREAM) {
+        Stream *stream = (Stream *)p;
+        std::map<int, Viewer *>::iterator it;
+
+        stream->slot->clear_event();
+        // Viewers still busy with an older frame pick this one up when done
+        for (it = connections_.begin(); it != connections_.end(); ++it) {
+          Viewer *viewer = it->second;
+          if (viewer->stream != stream || viewer->state != STREAMING ||
+              !viewer->head.empty() || viewer->frame)
+            continue;
+          // Don't delete while iterating, the hang-up comes back via epoll
+          if (flush(viewer) < 0)
+            shutdown(viewer->fd, SHUT_RDWR);
+        }
+        continue;
+      }
+
+      Viewer *viewer = (Viewer *)p;
+      int rc = 1;
+
+      if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+        rc = 0;
+      } else if (events[i].events & EPOLLIN) {
+        if (viewer->state == READ_REQUEST) {
+          rc = read_request(viewer);
+        } else {
+          // Nothing more is expected from a viewer, drain and ignore
+          char buf[256];
+          ssize_t got = read(viewer->fd, buf, sizeof(buf));
+          if (got == 0)
+            rc = 0;
+        }
+      }
+      if (rc > 0 && (events[i].events & EPOLLOUT))
+        rc = flush(viewer);
+
+      if (rc <= 0)
+        drop(viewer);
+    }
+  }
+}
@@ -0,0 +1,99 @@
+/**
+ * \file MjpegServer.h
+ * Embedded HTTP live view.
+ *
+ * Streams the contents of LatestFrame slots as multipart/x-mixed-replace,
+ * which browsers show as a continuously updating image. Like GrabServer it
+ * is a single epoll thread with non-blocking sockets. Every viewer sends
+ * straight from the shared frame, nothing is copied per viewer, and a viewer
+ * that falls behind skips to the newest frame instead of queueing.
+ */
+
+#ifndef MJPEGSERVER_H_
+#define MJPEGSERVER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Frame.h"
+#include "LatestFrame.h"
+#include "Stats.h"
+
+class MjpegServer {
+public:
+  MjpegServer(int port);
+  ~MjpegServer();
+
+  /**
+   * Serve a slot as a stream. Call before open().
+   *
+   * @param path Request path, e.g. "/left.mjpg"
+   * @param slot Source of the frames, must outlive the server
+   */
+  void add_stream(const char *path, LatestFrame *slot);
+
+  /** Bind and listen. @return 0 on success */
+  int open();
+
+  /**
+   * Serve viewers until running becomes 0. Checked at least every poll_ms
+   * milliseconds.
+   */
+  void run(const std::atomic<int> &running, int poll_ms = 500);
+
+  /** Time from a frame being published to its last byte reaching a viewer */
+  const LatencyStats &delivery_stats() const { return delivery_; }
+  uint64_t viewers() const { return viewers_; }
+
+private:
+  enum Kind { STREAM, VIEWER };
+  enum State { READ_REQUEST, STREAMING };
+
+  struct Pollable {
+    Kind kind;
+  };
+
+  struct Stream : Pollable {
+    std::string path;
+    LatestFrame *slot;
+  };
+
+  struct Viewer : Pollable {
+    int fd;
+    uint32_t address;
+    State state;
+    std::string request;  /// Request bytes received so far
+    Stream *stream;
+    std::string head;     /// Text to send ahead of the frame
+    FramePtr frame;       /// Frame being sent, shared with the slot
+    size_t sent;          /// Bytes of head, frame and trailer sent
+    bool want_out;        /// EPOLLOUT is armed
+    uint64_t generation;  /// Slot generation of the last frame started
+    int64_t published_us; /// When that frame was published
+    int64_t connected_us;
+    uint64_t frames;
+    uint64_t skipped;
+    uint64_t bytes;
+  };
+
+  void accept_viewers();
+  int read_request(Viewer *viewer);
+  int next_frame(Viewer *viewer);
+  int flush(Viewer *viewer);
+  void set_want_out(Viewer *viewer, bool want);
+  void drop(Viewer *viewer);
+
+  int port_;
+  int listen_fd_;
+  int epoll_fd_;
+  std::vector<Stream *> streams_;
+  std::map<int, Viewer *> connections_;
+  LatencyStats delivery_;
+  uint64_t viewers_;
+};
+
+#endif /* MJPEGSERVER_H_ */
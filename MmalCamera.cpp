@@ -0,0 +1,1116 @@
+/*
+Copyright (c) 2013, Broadcom Europe Ltd
+Copyright (c) 2013, James Hughes
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "MmalCamera.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "bcm_host.h"
+#include "interface/mmal/mmal_logging.h"
+#include "interface/mmal/mmal_buffer.h"
+#include "interface/mmal/util/mmal_util.h"
+#include "interface/mmal/util/mmal_util_params.h"
+#include "interface/mmal/util/mmal_default_components.h"
+
+#include "Stats.h"
+#include "Trace.h"
+
+// Standard port setting for the camera component
+#define MMAL_CAMERA_PREVIEW_PORT 0
+#define MMAL_CAMERA_VIDEO_PORT 1
+#define MMAL_CAMERA_CAPTURE_PORT 2
+
+// Stills format information
+// 0 implies variable
+#define STILLS_FRAME_RATE_NUM 1
+#define STILLS_FRAME_RATE_DEN 1
+
+/// Video render needs at least 2 buffers.
+#define VIDEO_OUTPUT_BUFFERS_NUM 3
+
+/// The rig has the cameras mounted upside down
+#define CAMERA_ROTATION 180
+
+/// Keys of the EXIF_TAGs
+static const char *const exif_keys[EXIF_TAG_COUNT] = {
+    "EXIF.DateTimeDigitized", "EXIF.DateTimeOriginal", "IFD0.DateTime",
+    "EXIF.ImageUniqueID",     "GPS.GPSStatus",         "GPS.GPSLatitude",
+    "GPS.GPSLatitudeRef",     "GPS.GPSLongitude",      "GPS.GPSLongitudeRef",
+    "GPS.GPSAltitude",        "GPS.GPSAltitudeRef",    "GPS.GPSSpeed",
+    "GPS.GPSTrack"};
+
+MmalCamera::MmalCamera(const CAMERA_PARAMS &params, const Handlers &handlers)
+    : CameraBackend(params, handlers), camera_(NULL), encoder_(NULL),
+      encoder_pool_(NULL), preview_connection_(NULL),
+      encoder_connection_(NULL), raw_port_(NULL), raw_pool_(NULL),
+      writer_(NULL), recorder_(NULL), first_buffer_(false),
+      capture_frame_(0), burst_index_(0), capture_timestamp_us_(0),
+      capture_setup_("capture call"), tag_update_("exif update"),
+      exif_sets_(0), exif_session_(0), exif_second_(-1),
+      annotate_update_("annotate update"), exposure_pts_(0),
+      stc_offset_us_(0) {
+  strncpy(camera_name_, "OV5647", sizeof(camera_name_));
+  raspicamcontrol_set_defaults(&camera_parameters_);
+  raspipreview_set_defaults(&preview_parameters_);
+  // The display shows the first camera, the second renders to a null sink
+  if (params_.camera_num > 0)
+    preview_parameters_.wantPreview = 0;
+  memset(&annotate_, 0, sizeof(annotate_));
+  memset(&exif_, 0, sizeof(exif_));
+  exif_.param.hdr.id = MMAL_PARAMETER_EXIF;
+  memset(exif_sent_, 0, sizeof(exif_sent_));
+  vcos_semaphore_create(&complete_, "MmalCamera-sem", 0);
+}
+
+MmalCamera::~MmalCamera() {
+  close();
+  vcos_semaphore_delete(&complete_);
+}
+
+/**
+ * Read the sensor name, keep the OV5647 default if the firmware can't say
+ */
+void MmalCamera::read_sensor_info() {
+  MMAL_COMPONENT_T *camera_info;
+  MMAL_STATUS_T status;
+
+  status =
+      mmal_component_create(MMAL_COMPONENT_DEFAULT_CAMERA_INFO, &camera_info);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Failed to create camera_info component");
+    return;
+  }
+
+  MMAL_PARAMETER_CAMERA_INFO_T param;
+  param.hdr.id = MMAL_PARAMETER_CAMERA_INFO;
+  param.hdr.size =
+      sizeof(param) - 4; // Deliberately undersize to check firmware veresion
+  status = mmal_port_parameter_get(camera_info->control, &param.hdr);
+
+  if (status != MMAL_SUCCESS) {
+    // Running on newer firmware
+    param.hdr.size = sizeof(param);
+    status = mmal_port_parameter_get(camera_info->control, &param.hdr);
+    if (status == MMAL_SUCCESS &&
+        param.num_cameras > (uint32_t)params_.camera_num) {
+      strncpy(camera_name_, param.cameras[params_.camera_num].camera_name,
+              MMAL_PARAMETER_CAMERA_INFO_MAX_STR_LEN);
+      camera_name_[MMAL_PARAMETER_CAMERA_INFO_MAX_STR_LEN - 1] = 0;
+    } else
+      vcos_log_error(
+          "Cannot read cameara info, keeping the defaults for OV5647");
+  }
+  // Older firmware: nothing to do here, keep the defaults for OV5647
+
+  mmal_component_destroy(camera_info);
+}
+
+/**
+ *  buffer header callback function for camera control
+ *
+ *  Turns settings changes and sensor errors into CAMERA_EVENTs
+ *
+ * @param port Pointer to port from which callback originated
+ * @param buffer mmal buffer header pointer
+ */
+void MmalCamera::control_callback(MMAL_PORT_T *port,
+                                  MMAL_BUFFER_HEADER_T *buffer) {
+  MmalCamera *camera = (MmalCamera *)port->userdata;
+  CAMERA_EVENT event;
+
+  memset(&event, 0, sizeof(event));
+  if (buffer->cmd == MMAL_EVENT_PARAMETER_CHANGED) {
+    MMAL_EVENT_PARAMETER_CHANGED_T *param =
+        (MMAL_EVENT_PARAMETER_CHANGED_T *)buffer->data;
+    if (param->hdr.id == MMAL_PARAMETER_CAMERA_SETTINGS) {
+      MMAL_PARAMETER_CAMERA_SETTINGS_T *settings =
+          (MMAL_PARAMETER_CAMERA_SETTINGS_T *)param;
+
+      event.type = CAMERA_EVENT_SETTINGS;
+      event.exposure_us = settings->exposure;
+      event.analog_gain = (double)settings->analog_gain.num /
+                          settings->analog_gain.den;
+      event.digital_gain = (double)settings->digital_gain.num /
+                           settings->digital_gain.den;
+      event.awb_red_gain = (double)settings->awb_red_gain.num /
+                           settings->awb_red_gain.den;
+      event.awb_blue_gain = (double)settings->awb_blue_gain.num /
+                            settings->awb_blue_gain.den;
+      if (camera->handlers_.event)
+        camera->handlers_.event(event);
+    }
+  } else if (buffer->cmd == MMAL_EVENT_ERROR) {
+    event.type = CAMERA_EVENT_ERROR;
+    event.message = "No data received from sensor. Check all connections, "
+                    "including the Sunny one on the camera board";
+    if (camera->handlers_.event)
+      camera->handlers_.event(event);
+    else
+      vcos_log_error("%s", event.message);
+  } else
+    vcos_log_error("Received unexpected camera control callback event, 0x%08x",
+                   buffer->cmd);
+
+  mmal_buffer_header_release(buffer);
+}
+
+/**
+ *  buffer header callback function for the raw video frames
+ *
+ *  Passes the Y plane to the frame handler and recycles the buffer.
+ */
+void MmalCamera::raw_callback(MMAL_PORT_T *port,
+                              MMAL_BUFFER_HEADER_T *buffer) {
+  MmalCamera *camera = (MmalCamera *)port->userdata;
+
+  if ((camera->handlers_.frame || camera->handlers_.yuv) && buffer->length) {
+    MMAL_VIDEO_FORMAT_T *video = &port->format->es->video;
+    int64_t arrival_us = monotonic_us();
+
+    mmal_buffer_header_mem_lock(buffer);
+    if (camera->handlers_.frame)
+      camera->handlers_.frame(buffer->data + buffer->offset,
+                              video->crop.width, video->crop.height,
+                              video->width, arrival_us);
+    if (camera->handlers_.yuv) {
+      // I420 with the planes at the aligned size, chroma at half stride
+      CAMERA_YUV yuv;
+      yuv.y = buffer->data + buffer->offset;
+      yuv.u = yuv.y + video->width * video->height;
+      yuv.v = yuv.u + (video->width / 2) * (video->height / 2);
+      yuv.width = video->crop.width & ~1;
+      yuv.height = video->crop.height & ~1;
+      yuv.y_stride = video->width;
+      yuv.uv_stride = video->width / 2;
+      yuv.arrival_us = arrival_us;
+      camera->handlers_.yuv(yuv);
+    }
+    mmal_buffer_header_mem_unlock(buffer);
+  }
+
+  // release buffer back to the pool
+  mmal_buffer_header_release(buffer);
+
+  // and send one back to the port (if still open)
+  if (port->is_enabled) {
+    MMAL_STATUS_T status = MMAL_SUCCESS;
+    MMAL_BUFFER_HEADER_T *new_buffer;
+
+    new_buffer = mmal_queue_get(camera->raw_pool_->queue);
+
+    if (new_buffer) {
+      status = mmal_port_send_buffer(port, new_buffer);
+    }
+    if (!new_buffer || status != MMAL_SUCCESS)
+      vcos_log_error("Unable to return a buffer to the raw video port");
+  }
+}
+
+/**
+ * Deliver raw video frames from port to raw_callback
+ *
+ * @param port Camera video port, or the raw output of the video splitter
+ * @return MMAL_SUCCESS if the port is running
+ */
+MMAL_STATUS_T MmalCamera::enable_raw_port(MMAL_PORT_T *port) {
+  MMAL_STATUS_T status;
+  int num, q;
+
+  if (params_.verbose)
+    fprintf(stderr, "Raw frame pool with %d buffers of size %d\n",
+            port->buffer_num, port->buffer_size);
+  raw_pool_ = mmal_port_pool_create(port, port->buffer_num, port->buffer_size);
+  if (!raw_pool_) {
+    vcos_log_error("Failed to create buffer header pool for port %s",
+                   port->name);
+    return MMAL_ENOMEM;
+  }
+
+  // The callback recycles buffers through the pool, set it before any arrive
+  raw_port_ = port;
+  port->userdata = (MMAL_PORT_USERDATA_T *)this;
+  status = mmal_port_enable(port, raw_callback);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Couldn't enable the raw video port");
+    return status;
+  }
+
+  // Send all the buffers to the port
+  num = mmal_queue_length(raw_pool_->queue);
+  for (q = 0; q < num; q++) {
+    MMAL_BUFFER_HEADER_T *buffer = mmal_queue_get(raw_pool_->queue);
+
+    if (!buffer)
+      vcos_log_error("Unable to get a required buffer %d from pool queue", q);
+
+    if (mmal_port_send_buffer(port, buffer) != MMAL_SUCCESS)
+      vcos_log_error("Unable to send a buffer to camera output port (%d)", q);
+  }
+
+  return MMAL_SUCCESS;
+}
+
+/**
+ *  Write handler for encoder output, run on the EncoderWriter I/O thread
+ *
+ * @param output Encoder buffer and the capture it belongs to
+ * @param context The MmalCamera
+ */
+void MmalCamera::write_output(const ENCODER_OUTPUT *output, void *context) {
+  MmalCamera *camera = (MmalCamera *)context;
+  MMAL_BUFFER_HEADER_T *buffer = output->buffer;
+  CAMERA_OUTPUT chunk;
+
+  chunk.data = buffer->data;
+  chunk.length = buffer->length;
+  chunk.flags = 0;
+  if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END)
+    chunk.flags |= CAMERA_OUTPUT_FRAME_END;
+  if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED)
+    chunk.flags |= CAMERA_OUTPUT_FAILED;
+  chunk.frame = output->frame;
+  chunk.burst_index = output->burst_index;
+  chunk.timestamp_us = output->timestamp_us;
+  chunk.pts_us = buffer->pts == MMAL_TIME_UNKNOWN ? 0 : buffer->pts;
+  camera->handlers_.output(chunk);
+}
+
+/**
+ *  buffer header callback function for encoder
+ *
+ *  Hands the buffer to the EncoderWriter, which writes it out on its own
+ *  thread, so the encoder is never held up by the output.
+ *
+ * @param port Pointer to port from which callback originated
+ * @param buffer mmal buffer header pointer
+ */
+void MmalCamera::encoder_callback(MMAL_PORT_T *port,
+                                  MMAL_BUFFER_HEADER_T *buffer) {
+  MmalCamera *camera = (MmalCamera *)port->userdata;
+  // Read the flags now, the buffer belongs to the writer once submitted
+  int complete = buffer->flags & (MMAL_BUFFER_HEADER_FLAG_FRAME_END |
+                                  MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED);
+  ENCODER_OUTPUT output = {buffer, camera->capture_frame_,
+                           camera->burst_index_,
+                           camera->capture_timestamp_us_};
+
+  if (camera->first_buffer_) {
+    camera->first_buffer_ = false;
+    // The encoder passes on the sensor timestamp of the frame
+    if (camera->burst_index_ == 0)
+      camera->exposure_pts_ =
+          buffer->pts != MMAL_TIME_UNKNOWN ? buffer->pts : 0;
+    trace_event(TRACE_INSTANT, "first encoder buffer", output.frame);
+  }
+  if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END)
+    trace_event(TRACE_INSTANT, "frame end buffer", output.frame);
+
+  camera->writer_->submit(output);
+
+  if (complete)
+    vcos_semaphore_post(&camera->complete_);
+}
+
+/**
+ * Create the camera component, set up its ports
+ *
+ * @return MMAL_SUCCESS if all OK, something else otherwise
+ */
+MMAL_STATUS_T MmalCamera::create_camera() {
+  MMAL_COMPONENT_T *camera = 0;
+  MMAL_ES_FORMAT_T *format;
+  MMAL_PORT_T *preview_port = NULL, *video_port = NULL, *still_port = NULL;
+  MMAL_STATUS_T status;
+  MMAL_PARAMETER_INT32_T camera_num = {
+      {MMAL_PARAMETER_CAMERA_NUM, sizeof(camera_num)}, params_.camera_num};
+
+  /* Create the component */
+  status = mmal_component_create(MMAL_COMPONENT_DEFAULT_CAMERA, &camera);
+
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Failed to create camera component");
+    goto error;
+  }
+
+  status = mmal_port_parameter_set(camera->control, &camera_num.hdr);
+
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Could not select camera : error %d", status);
+    goto error;
+  }
+
+  if (!camera->output_num) {
+    status = MMAL_ENOSYS;
+    vcos_log_error("Camera doesn't have output ports");
+    goto error;
+  }
+
+  // Sensor mode 0 lets the firmware pick
+  status = mmal_port_parameter_set_uint32(
+      camera->control, MMAL_PARAMETER_CAMERA_CUSTOM_SENSOR_CONFIG, 0);
+
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Could not set sensor mode : error %d", status);
+    goto error;
+  }
+
+  preview_port = camera->output[MMAL_CAMERA_PREVIEW_PORT];
+  video_port = camera->output[MMAL_CAMERA_VIDEO_PORT];
+  still_port = camera->output[MMAL_CAMERA_CAPTURE_PORT];
+
+  if (params_.settings_events) {
+    MMAL_PARAMETER_CHANGE_EVENT_REQUEST_T change_event_request = {
+        {MMAL_PARAMETER_CHANGE_EVENT_REQUEST,
+         sizeof(MMAL_PARAMETER_CHANGE_EVENT_REQUEST_T)},
+        MMAL_PARAMETER_CAMERA_SETTINGS,
+        1};
+
+    status =
+        mmal_port_parameter_set(camera->control, &change_event_request.hdr);
+    if (status != MMAL_SUCCESS) {
+      vcos_log_error("No camera settings events");
+    }
+  }
+
+  // Enable the camera, and tell it its control callback function
+  camera->control->userdata = (MMAL_PORT_USERDATA_T *)this;
+  status = mmal_port_enable(camera->control, control_callback);
+
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Unable to enable control port : error %d", status);
+    goto error;
+  }
+
+  // Zero shutter lag: the sensor stays in the stills mode and the last
+  // frames are kept in a circular buffer, so a capture takes the frame
+  // nearest the request instead of switching mode and exposing afresh
+  if (params_.zsl) {
+    MMAL_PARAMETER_ZEROSHUTTERLAG_T zsl = {
+        {MMAL_PARAMETER_ZERO_SHUTTER_LAG, sizeof(zsl)}, 1, 0};
+
+    status = mmal_port_parameter_set(camera->control, &zsl.hdr);
+    if (status != MMAL_SUCCESS) {
+      vcos_log_error("Unable to set zero shutter lag : error %d", status);
+      goto error;
+    }
+  }
+
+  //  set up the camera configuration
+  {
+    MMAL_PARAMETER_CAMERA_CONFIG_T cam_config = {
+        {MMAL_PARAMETER_CAMERA_CONFIG, sizeof(cam_config)},
+        .max_stills_w = (uint32_t)params_.width,
+        .max_stills_h = (uint32_t)params_.height,
+        .stills_yuv422 = 0,
+        .one_shot_stills = 1,
+        .max_preview_video_w = preview_parameters_.previewWindow.width,
+        .max_preview_video_h = preview_parameters_.previewWindow.height,
+        .num_preview_video_frames = 3,
+        .stills_capture_circular_buffer_height = 0,
+        .fast_preview_resume = 0,
+        .use_stc_timestamp = MMAL_PARAM_TIMESTAMP_MODE_RESET_STC};
+
+    if (params_.zsl) {
+      cam_config.one_shot_stills = 0;
+      cam_config.stills_capture_circular_buffer_height =
+          (uint32_t)params_.height;
+      cam_config.fast_preview_resume = 1;
+    }
+
+    // Preview and video port share this limit
+    if (params_.record_dir) {
+      cam_config.max_preview_video_w = VCOS_MAX(
+          cam_config.max_preview_video_w, (uint32_t)params_.video_width);
+      cam_config.max_preview_video_h = VCOS_MAX(
+          cam_config.max_preview_video_h, (uint32_t)params_.video_height);
+    }
+
+    mmal_port_parameter_set(camera->control, &cam_config.hdr);
+  }
+
+  // Now set up the port formats
+
+  format = preview_port->format;
+  format->encoding = MMAL_ENCODING_OPAQUE;
+  format->encoding_variant = MMAL_ENCODING_I420;
+
+  // Use a full FOV 4:3 mode
+  format->es->video.width =
+      VCOS_ALIGN_UP(preview_parameters_.previewWindow.width, 32);
+  format->es->video.height =
+      VCOS_ALIGN_UP(preview_parameters_.previewWindow.height, 16);
+  format->es->video.crop.x = 0;
+  format->es->video.crop.y = 0;
+  format->es->video.crop.width = preview_parameters_.previewWindow.width;
+  format->es->video.crop.height = preview_parameters_.previewWindow.height;
+  format->es->video.frame_rate.num = PREVIEW_FRAME_RATE_NUM;
+  format->es->video.frame_rate.den = PREVIEW_FRAME_RATE_DEN;
+
+  status = mmal_port_format_commit(preview_port);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("camera viewfinder format couldn't be set");
+    goto error;
+  }
+
+  // Raw frames run at the preview size unless recording
+  mmal_format_full_copy(video_port->format, format);
+  format = video_port->format;
+  format->encoding = MMAL_ENCODING_I420;
+  format->encoding_variant = MMAL_ENCODING_I420;
+  format->es->video.frame_rate.num = 30;
+  format->es->video.frame_rate.den = 1;
+  if (params_.record_dir) {
+    // Recording runs at its own size, tunnelled to the H.264 encoder
+    format->es->video.width = VCOS_ALIGN_UP(params_.video_width, 32);
+    format->es->video.height = VCOS_ALIGN_UP(params_.video_height, 16);
+    format->es->video.crop.x = 0;
+    format->es->video.crop.y = 0;
+    format->es->video.crop.width = params_.video_width;
+    format->es->video.crop.height = params_.video_height;
+    format->es->video.frame_rate.num = params_.video_framerate;
+  }
+  video_port->buffer_num = 4;
+  video_port->buffer_size =
+      format->es->video.width * format->es->video.height * 3 / 2;
+
+  status = mmal_port_format_commit(video_port);
+
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("camera video format couldn't be set");
+    goto error;
+  }
+
+  // Ensure there are enough buffers to avoid dropping frames
+  if (video_port->buffer_num < VIDEO_OUTPUT_BUFFERS_NUM)
+    video_port->buffer_num = VIDEO_OUTPUT_BUFFERS_NUM;
+
+  format = still_port->format;
+
+  // Set our stills format on the stills (for encoder) port
+  format->encoding = MMAL_ENCODING_OPAQUE;
+  format->es->video.width = VCOS_ALIGN_UP(params_.width, 32);
+  format->es->video.height = VCOS_ALIGN_UP(params_.height, 16);
+  format->es->video.crop.x = 0;
+  format->es->video.crop.y = 0;
+  format->es->video.crop.width = params_.width;
+  format->es->video.crop.height = params_.height;
+  format->es->video.frame_rate.num = STILLS_FRAME_RATE_NUM;
+  format->es->video.frame_rate.den = STILLS_FRAME_RATE_DEN;
+
+  status = mmal_port_format_commit(still_port);
+
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("camera still format couldn't be set");
+    goto error;
+  }
+
+  /* Ensure there are enough buffers to avoid dropping frames */
+  if (still_port->buffer_num < VIDEO_OUTPUT_BUFFERS_NUM)
+    still_port->buffer_num = VIDEO_OUTPUT_BUFFERS_NUM;
+
+  camera_ = camera;
+
+  /* Enable component */
+  status = mmal_component_enable(camera);
+
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("camera component couldn't be enabled");
+    return status;
+  }
+
+  raspicamcontrol_set_all_parameters(camera, &camera_parameters_);
+  mmal_port_parameter_set_int32(preview_port, MMAL_PARAMETER_ROTATION,
+                                CAMERA_ROTATION);
+  mmal_port_parameter_set_int32(video_port, MMAL_PARAMETER_ROTATION,
+                                CAMERA_ROTATION);
+  mmal_port_parameter_set_int32(still_port, MMAL_PARAMETER_ROTATION,
+                                CAMERA_ROTATION);
+
+  if (params_.verbose)
+    fprintf(stderr, "Camera component done\n");
+
+  return status;
+
+error:
+
+  if (camera)
+    mmal_component_destroy(camera);
+
+  return status;
+}
+
+/**
+ * Create the JPEG encoder component, set up its ports
+ *
+ * @return MMAL_SUCCESS if all OK, something else otherwise
+ */
+MMAL_STATUS_T MmalCamera::create_encoder() {
+  MMAL_COMPONENT_T *encoder = 0;
+  MMAL_PORT_T *encoder_input = NULL, *encoder_output = NULL;
+  MMAL_STATUS_T status;
+
+  status =
+      mmal_component_create(MMAL_COMPONENT_DEFAULT_IMAGE_ENCODER, &encoder);
+
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Unable to create JPEG encoder component");
+    goto error;
+  }
+
+  if (!encoder->input_num || !encoder->output_num) {
+    status = MMAL_ENOSYS;
+    vcos_log_error("JPEG encoder doesn't have input/output ports");
+    goto error;
+  }
+
+  encoder_input = encoder->input[0];
+  encoder_output = encoder->output[0];
+
+  // We want same format on input and output
+  mmal_format_copy(encoder_output->format, encoder_input->format);
+
+  // Specify out output format
+  encoder_output->format->encoding = MMAL_ENCODING_JPEG;
+
+  encoder_output->buffer_size = encoder_output->buffer_size_recommended;
+
+  if (encoder_output->buffer_size < encoder_output->buffer_size_min)
+    encoder_output->buffer_size = encoder_output->buffer_size_min;
+
+  encoder_output->buffer_num = encoder_output->buffer_num_recommended;
+
+  if (encoder_output->buffer_num < encoder_output->buffer_num_min)
+    encoder_output->buffer_num = encoder_output->buffer_num_min;
+
+  // Commit the port changes to the output port
+  status = mmal_port_format_commit(encoder_output);
+
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Unable to set format on video encoder output port");
+    goto error;
+  }
+
+  // Set the JPEG quality level
+  status = mmal_port_parameter_set_uint32(
+      encoder_output, MMAL_PARAMETER_JPEG_Q_FACTOR, params_.quality);
+
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Unable to set JPEG quality");
+    goto error;
+  }
+
+  //  Enable component
+  status = mmal_component_enable(encoder);
+
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Unable to enable video encoder component");
+    goto error;
+  }
+
+  /* Create pool of buffer headers for the output port to consume */
+  encoder_pool_ = mmal_port_pool_create(
+      encoder_output, encoder_output->buffer_num, encoder_output->buffer_size);
+
+  if (!encoder_pool_) {
+    vcos_log_error(
+        "Failed to create buffer header pool for encoder output port %s",
+        encoder_output->name);
+    status = MMAL_ENOMEM;
+    goto error;
+  }
+
+  encoder_ = encoder;
+
+  if (params_.verbose)
+    fprintf(stderr, "Encoder component done\n");
+
+  return status;
+
+error:
+
+  if (encoder)
+    mmal_component_destroy(encoder);
+
+  return status;
+}
+
+/**
+ * Connect two specific ports together
+ *
+ * @param output_port Pointer the output port
+ * @param input_port Pointer the input port
+ * @param Pointer to a mmal connection pointer, reassigned if function
+ *successful
+ * @return Returns a MMAL_STATUS_T giving result of operation
+ */
+static MMAL_STATUS_T connect_ports(MMAL_PORT_T *output_port,
+                                   MMAL_PORT_T *input_port,
+                                   MMAL_CONNECTION_T **connection) {
+  MMAL_STATUS_T status;
+
+  status = mmal_connection_create(connection, output_port, input_port,
+                                  MMAL_CONNECTION_FLAG_TUNNELLING |
+                                      MMAL_CONNECTION_FLAG_ALLOCATION_ON_INPUT);
+
+  if (status == MMAL_SUCCESS) {
+    status = mmal_connection_enable(*connection);
+    if (status != MMAL_SUCCESS) {
+      mmal_connection_destroy(*connection);
+      *connection = NULL;
+    }
+  }
+
+  return status;
+}
+
+/**
+ * Checks if specified port is valid and enabled, then disables it
+ *
+ * @param port  Pointer the port
+ */
+static void check_disable_port(MMAL_PORT_T *port) {
+  if (port && port->is_enabled)
+    mmal_port_disable(port);
+}
+
+int MmalCamera::open() {
+  MMAL_STATUS_T status;
+  char model[MMAL_PARAMETER_CAMERA_INFO_MAX_STR_LEN + 4];
+
+  bcm_host_init();
+  // Register our application with the logging system
+  vcos_log_register("RaspiStill", VCOS_LOG_CATEGORY);
+  read_sensor_info();
+
+  // We have three components. Camera, Preview and encoder.
+  if ((status = create_camera()) != MMAL_SUCCESS) {
+    vcos_log_error("%s: Failed to create camera component", __func__);
+    return -1;
+  }
+  if ((status = raspipreview_create(&preview_parameters_)) != MMAL_SUCCESS) {
+    vcos_log_error("%s: Failed to create preview component", __func__);
+    return -1;
+  }
+  if ((status = create_encoder()) != MMAL_SUCCESS) {
+    vcos_log_error("%s: Failed to create encode component", __func__);
+    return -1;
+  }
+
+  // The preview and null sink components use the same input port, so
+  // whichever was created connects the same way
+  status = connect_ports(camera_->output[MMAL_CAMERA_PREVIEW_PORT],
+                         preview_parameters_.preview_component->input[0],
+                         &preview_connection_);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("%s: Failed to connect camera to preview", __func__);
+    return -1;
+  }
+
+  status = connect_ports(camera_->output[MMAL_CAMERA_CAPTURE_PORT],
+                         encoder_->input[0], &encoder_connection_);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("%s: Failed to connect camera still port to encoder input",
+                   __func__);
+    return -1;
+  }
+
+  writer_ = new EncoderWriter(encoder_->output[0], encoder_pool_,
+                              write_output, this);
+  if ((status = enable_encoder_output()) != MMAL_SUCCESS)
+    return -1;
+
+  // Constant for the session, so not set again on every capture
+  if (mmal_port_parameter_set_uint32(camera_->control,
+                                     MMAL_PARAMETER_SHUTTER_SPEED,
+                                     0) != MMAL_SUCCESS)
+    vcos_log_error("Unable to set shutter speed");
+  // Keeps the sensor in still mode between captures
+  mmal_port_parameter_set_boolean(camera_->control,
+                                  MMAL_PARAMETER_CAMERA_BURST_CAPTURE, 1);
+  // The encoder keeps its tags from still to still, so these go in once and
+  // update_tags() only sends the ones that changed
+  snprintf(model, sizeof(model), "RP_%s", camera_name_);
+  add_exif_tag("IFD0.Model", model);
+  add_exif_tag("IFD0.Make", "RaspberryPi");
+  add_exif_tag("GPS.GPSSpeedRef", "K");
+  add_exif_tag("GPS.GPSTrackRef", "T");
+  exif_session_ = wallclock_us();
+
+  // Built once, set_annotation() only swaps the text
+  if (params_.annotate)
+    raspicamcontrol_init_annotate(
+        &annotate_, ANNOTATE_USER_TEXT | ANNOTATE_BLACK_BACKGROUND,
+        camera_parameters_.annotate_text_size,
+        camera_parameters_.annotate_text_colour,
+        camera_parameters_.annotate_bg_colour);
+
+  // When recording, the raw frames come from the video splitter instead
+  if (params_.record_dir) {
+    VIDEO_RECORDER_PARAMS video;
+
+    video.width = params_.video_width;
+    video.height = params_.video_height;
+    video.framerate = params_.video_framerate;
+    video.bitrate = params_.bitrate;
+    video.intraperiod = params_.video_framerate; // Cut points every second
+    video.directory = params_.record_dir;
+    video.segment_seconds = params_.segment_seconds;
+    video.segment_count = params_.segment_count;
+    video.pre_event_seconds = params_.pre_event_seconds;
+    video.post_event_seconds =
+        params_.pre_event_seconds ? params_.post_event_seconds : 0;
+    video.event_buffer_bytes = params_.event_buffer_bytes;
+
+    recorder_ = new VideoRecorder(video);
+    status = recorder_->open(camera_->output[MMAL_CAMERA_VIDEO_PORT]);
+    if (status == MMAL_SUCCESS)
+      status = enable_raw_port(recorder_->raw_port());
+  } else {
+    status = enable_raw_port(camera_->output[MMAL_CAMERA_VIDEO_PORT]);
+  }
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("%s: Failed to start the video port", __func__);
+    return -1;
+  }
+
+  if (mmal_port_parameter_set_boolean(camera_->output[MMAL_CAMERA_VIDEO_PORT],
+                                      MMAL_PARAMETER_CAPTURE,
+                                      1) != MMAL_SUCCESS) {
+    vcos_log_error("%s: Failed to start capture of the video port", __func__);
+    return -1;
+  }
+  update_stc_offset();
+  return 0;
+}
+
+/**
+ * Enable the encoder output for the whole session and give it every buffer
+ * of the pool. From then on the writer sends a buffer back each time it
+ * releases one, and the stills are told apart by their FRAME_END flags.
+ *
+ * @return MMAL_SUCCESS if all OK, something else otherwise
+ */
+MMAL_STATUS_T MmalCamera::enable_encoder_output() {
+  MMAL_PORT_T *encoder_output = encoder_->output[0];
+  MMAL_STATUS_T status;
+  int num, q;
+
+  encoder_output->userdata = (MMAL_PORT_USERDATA_T *)this;
+  status = mmal_port_enable(encoder_output, encoder_callback);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("%s: Failed to enable the encoder output", __func__);
+    return status;
+  }
+
+  num = mmal_queue_length(encoder_pool_->queue);
+  for (q = 0; q < num; q++) {
+    MMAL_BUFFER_HEADER_T *buffer = mmal_queue_get(encoder_pool_->queue);
+
+    if (!buffer) {
+      vcos_log_error("Unable to get a required buffer %d from pool queue", q);
+      continue;
+    }
+    if (mmal_port_send_buffer(encoder_output, buffer) != MMAL_SUCCESS)
+      vcos_log_error("Unable to send a buffer to encoder output port (%d)", q);
+  }
+  return MMAL_SUCCESS;
+}
+
+int MmalCamera::capture(uint32_t frame, int64_t timestamp_us) {
+  int64_t start = monotonic_us();
+  int rc;
+
+  capture_frame_ = frame;
+  burst_index_ = 0;
+  capture_timestamp_us_ = timestamp_us;
+  rc = start_still();
+  capture_setup_.add(monotonic_us() - start);
+  return rc;
+}
+
+/**
+ * Ask the capture port for the still set up in capture_frame_. The encoder
+ * output is already enabled with its buffers queued.
+ *
+ * @return 0 if the still was requested
+ */
+int MmalCamera::start_still() {
+  first_buffer_ = true;
+  trace_event(TRACE_INSTANT, "capture issued", capture_frame_);
+  if (mmal_port_parameter_set_boolean(camera_->output[MMAL_CAMERA_CAPTURE_PORT],
+                                      MMAL_PARAMETER_CAPTURE,
+                                      1) != MMAL_SUCCESS) {
+    vcos_log_error("%s: Failed to start capture", __func__);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Add an exif tag to the stills that follow, sent in the one preallocated
+ * parameter
+ *
+ * @return MMAL_SUCCESS if the encoder took it
+ */
+MMAL_STATUS_T MmalCamera::add_exif_tag(const char *key, const char *value) {
+  char *data = (char *)exif_.param.data;
+  int length = snprintf(data, MAX_EXIF_PAYLOAD_LENGTH, "%s=%s", key, value);
+
+  if (length < 0 || length >= MAX_EXIF_PAYLOAD_LENGTH)
+    return MMAL_EINVAL;
+  exif_.param.hdr.size = sizeof(MMAL_PARAMETER_EXIF_T) + length;
+  exif_sets_++;
+  return mmal_port_parameter_set(encoder_->output[0], &exif_.param.hdr);
+}
+
+/** Send tag with value, unless that is what the encoder already has */
+void MmalCamera::update_exif_tag(EXIF_TAG tag, const char *value) {
+  char *sent = exif_sent_[tag];
+
+  if (!strncmp(sent, value, MAX_EXIF_PAYLOAD_LENGTH))
+    return;
+  if (add_exif_tag(exif_keys[tag], value) == MMAL_SUCCESS)
+    strncpy(sent, value, MAX_EXIF_PAYLOAD_LENGTH - 1);
+  else
+    sent[0] = 0;
+}
+
+/** ImageUniqueID of the next still: the session, then its frame number */
+void MmalCamera::tag_frame(uint32_t frame) {
+  char id[40];
+
+  snprintf(id, sizeof(id), "%016" PRIx64 "%016" PRIx64,
+           (uint64_t)exif_session_, (uint64_t)frame);
+  update_exif_tag(EXIF_TAG_UNIQUE_ID, id);
+}
+
+/** Degrees as the EXIF degrees, minutes, seconds rationals */
+static void exif_dms(double value, char *text, size_t size) {
+  double magnitude = value < 0 ? -value : value;
+  int degrees = (int)magnitude;
+  int minutes = (int)((magnitude - degrees) * 60);
+  double seconds = (magnitude - degrees - minutes / 60.0) * 3600;
+
+  snprintf(text, size, "%d/1,%d/1,%d/1000", degrees, minutes,
+           (int)(seconds * 1000 + 0.5));
+}
+
+void MmalCamera::update_tags(const GPS_FIX *fix, uint32_t frame) {
+  int64_t start = monotonic_us();
+  time_t now = time(NULL);
+  char value[MAX_EXIF_PAYLOAD_LENGTH];
+
+  // The date tags only change once a second
+  if (now != exif_second_) {
+    struct tm tm;
+
+    localtime_r(&now, &tm);
+    snprintf(value, sizeof(value), "%04d:%02d:%02d %02d:%02d:%02d",
+             tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+             tm.tm_min, tm.tm_sec);
+    update_exif_tag(EXIF_TAG_DATETIME_DIGITIZED, value);
+    update_exif_tag(EXIF_TAG_DATETIME_ORIGINAL, value);
+    update_exif_tag(EXIF_TAG_DATETIME, value);
+    exif_second_ = now;
+  }
+  tag_frame(frame);
+
+  // Without a fix the last position stays in, marked void
+  update_exif_tag(EXIF_TAG_GPS_STATUS, fix ? "A" : "V");
+  if (fix) {
+    exif_dms(fix->latitude, value, sizeof(value));
+    update_exif_tag(EXIF_TAG_GPS_LATITUDE, value);
+    update_exif_tag(EXIF_TAG_GPS_LATITUDE_REF, fix->latitude < 0 ? "S" : "N");
+    exif_dms(fix->longitude, value, sizeof(value));
+    update_exif_tag(EXIF_TAG_GPS_LONGITUDE, value);
+    update_exif_tag(EXIF_TAG_GPS_LONGITUDE_REF,
+                    fix->longitude < 0 ? "W" : "E");
+    snprintf(value, sizeof(value), "%d/10",
+             (int)(fabs(fix->altitude_m) * 10 + 0.5));
+    update_exif_tag(EXIF_TAG_GPS_ALTITUDE, value);
+    update_exif_tag(EXIF_TAG_GPS_ALTITUDE_REF,
+                    fix->altitude_m < 0 ? "1" : "0");
+    // km/h, the unit a dashcam is read in
+    snprintf(value, sizeof(value), "%d/10", (int)(fix->speed_mps * 36 + 0.5));
+    update_exif_tag(EXIF_TAG_GPS_SPEED, value);
+    snprintf(value, sizeof(value), "%d/100",
+             (int)(fix->course_deg * 100 + 0.5));
+    update_exif_tag(EXIF_TAG_GPS_TRACK, value);
+  }
+  tag_update_.add(monotonic_us() - start);
+}
+
+void MmalCamera::set_annotation(const char *text) {
+  int64_t start;
+
+  if (!annotate_.enable ||
+      !strncmp(annotate_.text, text, sizeof(annotate_.text)))
+    return;
+  start = monotonic_us();
+  strncpy(annotate_.text, text, sizeof(annotate_.text) - 1);
+  annotate_.text[sizeof(annotate_.text) - 1] = 0;
+  if (mmal_port_parameter_set(camera_->control, &annotate_.hdr) !=
+      MMAL_SUCCESS)
+    vcos_log_error("Unable to set the annotation");
+  annotate_update_.add(monotonic_us() - start);
+}
+
+void MmalCamera::wait_capture() {
+  int i;
+
+  // Burst capture mode keeps the sensor in still mode, so the next still of
+  // the burst is requested as soon as the encoder has the last one
+  for (i = 0; i < params_.burst; i++) {
+    vcos_semaphore_wait(&complete_);
+    if (i + 1 == params_.burst)
+      break;
+    capture_frame_++;
+    burst_index_++;
+    capture_timestamp_us_ = wallclock_us();
+    // The one tag that differs between the stills of a burst
+    tag_frame(capture_frame_);
+    if (start_still() != 0)
+      break;
+  }
+  // Off the trigger path, so it can cost a round trip to the firmware
+  update_stc_offset();
+}
+
+/**
+ * Re-measure how the camera's STC relates to monotonic_us(), halfway
+ * through the call that reads it. The clocks drift apart slowly.
+ */
+void MmalCamera::update_stc_offset() {
+  uint64_t stc;
+  int64_t before = monotonic_us();
+
+  if (mmal_port_parameter_get_uint64(camera_->control,
+                                     MMAL_PARAMETER_SYSTEM_TIME,
+                                     &stc) != MMAL_SUCCESS)
+    return;
+  stc_offset_us_ = before + (monotonic_us() - before) / 2 - (int64_t)stc;
+}
+
+int64_t MmalCamera::last_exposure_us() const {
+  return exposure_pts_ ? exposure_pts_ + stc_offset_us_ : 0;
+}
+
+void MmalCamera::trigger_event() {
+  if (recorder_)
+    recorder_->trigger_event();
+}
+
+void MmalCamera::stop_frames() { check_disable_port(raw_port_); }
+
+void MmalCamera::report(FILE *out) const {
+  capture_setup_.report(out);
+  if (tag_update_.count()) {
+    tag_update_.report(out);
+    fprintf(out, "EXIF tags sent %" PRIu64 "\n", exif_sets_);
+  }
+  if (annotate_update_.count())
+    annotate_update_.report(out);
+  if (writer_)
+    fprintf(out, "Writer queue depth max %zu, stalls %" PRIu64 "\n",
+            writer_->max_depth(), writer_->stalls());
+  if (recorder_)
+    fprintf(out,
+            "Recorded %" PRIu64 " frames, %" PRIu64 " dropped, "
+            "writer depth max %zu, stalls %" PRIu64 "\n",
+            recorder_->frames(), recorder_->dropped(),
+            recorder_->writer()->max_depth(), recorder_->writer()->stalls());
+  if (recorder_ && recorder_->events()) {
+    recorder_->events()->flush_latency().report(out);
+    if (recorder_->events()->dropped())
+      fprintf(out, "Event frames dropped %" PRIu64 "\n",
+              recorder_->events()->dropped());
+  }
+}
+
+void MmalCamera::close() {
+  if (params_.verbose)
+    fprintf(stderr, "Closing down\n");
+
+  // The raw port may belong to the recorder's splitter, free its pool first
+  stop_frames();
+  if (raw_pool_) {
+    mmal_port_pool_destroy(raw_port_, raw_pool_);
+    raw_pool_ = NULL;
+  }
+  raw_port_ = NULL;
+
+  // Stop recording while the camera is still up
+  if (recorder_) {
+    delete recorder_;
+    recorder_ = NULL;
+  }
+
+  // Disable all our ports that are not handled by connections
+  if (camera_)
+    check_disable_port(camera_->output[MMAL_CAMERA_VIDEO_PORT]);
+  if (encoder_)
+    check_disable_port(encoder_->output[0]);
+  // The writer hands buffers back to the port, so only after it is disabled
+  if (writer_) {
+    delete writer_;
+    writer_ = NULL;
+  }
+
+  if (preview_connection_)
+    mmal_connection_destroy(preview_connection_);
+  preview_connection_ = NULL;
+  if (encoder_connection_)
+    mmal_connection_destroy(encoder_connection_);
+  encoder_connection_ = NULL;
+
+  /* Disable components */
+  if (encoder_)
+    mmal_component_disable(encoder_);
+  if (preview_parameters_.preview_component)
+    mmal_component_disable(preview_parameters_.preview_component);
+  if (camera_)
+    mmal_component_disable(camera_);
+
+  // Get rid of any port buffers first
+  if (encoder_pool_)
+    mmal_port_pool_destroy(encoder_->output[0], encoder_pool_);
+  encoder_pool_ = NULL;
+  if (encoder_)
+    mmal_component_destroy(encoder_);
+  encoder_ = NULL;
+  raspipreview_destroy(&preview_parameters_);
+  if (camera_)
+    mmal_component_destroy(camera_);
+  camera_ = NULL;
+}
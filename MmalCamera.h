@@ -0,0 +1,124 @@
+/**
+ * \file MmalCamera.h
+ * The Pi camera through MMAL.
+ *
+ *   camera preview port -> preview or null sink
+ *   camera video port   -> raw frames, or VideoRecorder when recording
+ *   camera still port   -> JPEG encoder -> EncoderWriter -> output handler
+ *
+ * Encoder buffers are handed to an EncoderWriter, so the output handler runs
+ * on its I/O thread and never holds up the encoder callback.
+ */
+
+#ifndef MMALCAMERA_H_
+#define MMALCAMERA_H_
+
+#include <time.h>
+
+#include "interface/vcos/vcos.h"
+#include "interface/mmal/mmal.h"
+#include "interface/mmal/util/mmal_connection.h"
+#include "interface/mmal/mmal_parameters_camera.h"
+
+#include "CameraBackend.h"
+#include "EncoderWriter.h"
+#include "RaspiCamControl.h"
+#include "RaspiPreview.h"
+#include "Stats.h"
+#include "VideoRecorder.h"
+
+/// Longest "key=value" EXIF tag passed to the encoder
+#define MAX_EXIF_PAYLOAD_LENGTH 128
+
+/// EXIF tags that change during a session, see update_tags()
+typedef enum {
+  EXIF_TAG_DATETIME_DIGITIZED,
+  EXIF_TAG_DATETIME_ORIGINAL,
+  EXIF_TAG_DATETIME,
+  EXIF_TAG_UNIQUE_ID,  /// Session and frame number
+  EXIF_TAG_GPS_STATUS,
+  EXIF_TAG_GPS_LATITUDE,
+  EXIF_TAG_GPS_LATITUDE_REF,
+  EXIF_TAG_GPS_LONGITUDE,
+  EXIF_TAG_GPS_LONGITUDE_REF,
+  EXIF_TAG_GPS_ALTITUDE,
+  EXIF_TAG_GPS_ALTITUDE_REF,
+  EXIF_TAG_GPS_SPEED,
+  EXIF_TAG_GPS_TRACK,
+  EXIF_TAG_COUNT
+} EXIF_TAG;
+
+class MmalCamera : public CameraBackend {
+public:
+  MmalCamera(const CAMERA_PARAMS &params, const Handlers &handlers);
+  ~MmalCamera();
+
+  int open();
+  int capture(uint32_t frame, int64_t timestamp_us);
+  void wait_capture();
+  int64_t last_exposure_us() const;
+  void trigger_event();
+  void update_tags(const GPS_FIX *fix, uint32_t frame);
+  void set_annotation(const char *text);
+  void stop_frames();
+  void report(FILE *out) const;
+  const char *describe() const { return camera_name_; }
+
+private:
+  static void control_callback(MMAL_PORT_T *port,
+                               MMAL_BUFFER_HEADER_T *buffer);
+  static void raw_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer);
+  static void encoder_callback(MMAL_PORT_T *port,
+                               MMAL_BUFFER_HEADER_T *buffer);
+  static void write_output(const ENCODER_OUTPUT *output, void *context);
+
+  void read_sensor_info();
+  MMAL_STATUS_T create_camera();
+  MMAL_STATUS_T create_encoder();
+  MMAL_STATUS_T enable_raw_port(MMAL_PORT_T *port);
+  MMAL_STATUS_T enable_encoder_output();
+  int start_still();
+  MMAL_STATUS_T add_exif_tag(const char *key, const char *value);
+  void update_exif_tag(EXIF_TAG tag, const char *value);
+  void tag_frame(uint32_t frame);
+  void update_stc_offset();
+  void close();
+
+  char camera_name_[MMAL_PARAMETER_CAMERA_INFO_MAX_STR_LEN];
+  RASPICAM_CAMERA_PARAMETERS camera_parameters_;
+  RASPIPREVIEW_PARAMETERS preview_parameters_;
+
+  MMAL_COMPONENT_T *camera_;
+  MMAL_COMPONENT_T *encoder_;
+  MMAL_POOL_T *encoder_pool_;
+  MMAL_CONNECTION_T *preview_connection_;
+  MMAL_CONNECTION_T *encoder_connection_;
+  MMAL_PORT_T *raw_port_;  /// Port the raw frames come from
+  MMAL_POOL_T *raw_pool_;
+  EncoderWriter *writer_;
+  VideoRecorder *recorder_;
+  VCOS_SEMAPHORE_T complete_; /// Posted when the still is complete or failed
+  bool first_buffer_;            /// No encoder buffer yet for this capture
+  uint32_t capture_frame_;       /// Frame number of the still in progress
+  uint32_t burst_index_;         /// Its position in the burst
+  int64_t capture_timestamp_us_; /// Wall clock time that still was requested
+  LatencyStats capture_setup_;   /// Time spent in capture()
+  LatencyStats tag_update_;      /// Time spent in update_tags()
+  uint64_t exif_sets_;           /// Tags sent to the encoder
+  int64_t exif_session_;         /// Wall clock time of open(), in unique IDs
+  time_t exif_second_;           /// Second the date tags were formatted for
+  /// Parameter every tag is sent in, with room for the longest
+  struct {
+    MMAL_PARAMETER_EXIF_T param;
+    char payload[MAX_EXIF_PAYLOAD_LENGTH];
+  } exif_;
+  /// Value each changing tag was last sent with, "" if never
+  char exif_sent_[EXIF_TAG_COUNT][MAX_EXIF_PAYLOAD_LENGTH];
+  LatencyStats annotate_update_; /// Time spent sending annotation text
+  /// Annotation sent last, only its text changes after open()
+  MMAL_PARAMETER_CAMERA_ANNOTATE_V3_T annotate_;
+  int64_t exposure_pts_;  /// Sensor time of the first still, STC microseconds
+  int64_t stc_offset_us_; /// monotonic_us() minus the camera's STC
+};
+
+#endif /* MMALCAMERA_H_ */
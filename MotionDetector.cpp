@@ -0,0 +1,135 @@
+#include "MotionDetector.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+void motion_default_params(MOTION_PARAMS *params) {
+  params->scale = 8;
+  params->pixel_threshold = 25;
+  params->area_percent = 2.0;
+  params->frames = 2;
+  params->cooldown_ms = 3000;
+}
+
+MotionDetector::MotionDetector(const MOTION_PARAMS &params, Handler handler)
+    : params_(params), handler_(handler), running_(true),
+      kernels_(ykernels()), small_width_(0), small_height_(0),
+      motion_frames_(0), last_event_us_(0), processed_(0), skipped_(0),
+      events_(0), copy_("motion copy"), cpu_("motion cpu"),
+      latency_("motion latency") {
+  if (params_.scale < 1)
+    params_.scale = 1;
+  sem_init(&ready_, 0, 0);
+  thread_ = std::thread(&MotionDetector::run, this);
+}
+
+MotionDetector::~MotionDetector() {
+  running_ = false;
+  sem_post(&ready_);
+  thread_.join();
+  sem_destroy(&ready_);
+}
+
+void MotionDetector::submit(const uint8_t *y, int width, int height,
+                            int stride, int64_t arrival_us) {
+  Plane &plane = planes_.back();
+  int row;
+
+  // Sized on the first frame, after that this is just the copy
+  plane.data.resize((size_t)width * height);
+  plane.width = width;
+  plane.height = height;
+  plane.arrival_us = arrival_us;
+  for (row = 0; row < height; row++)
+    memcpy(&plane.data[(size_t)row * width], y + (size_t)row * stride, width);
+
+  if (!planes_.publish())
+    skipped_++;
+  sem_post(&ready_);
+  copy_.add(monotonic_us() - arrival_us);
+}
+
+/**
+ * Downscale the plane and compare it with the previous one
+ *
+ * @return Percentage of cells that changed
+ */
+double MotionDetector::analyse(const Plane &plane) {
+  int scale = params_.scale;
+  int width = plane.width / scale;
+  int height = plane.height / scale;
+  int changed = 0;
+  int i;
+
+  if (width <= 0 || height <= 0)
+    return 0.0;
+
+  if (width != small_width_ || height != small_height_) {
+    small_width_ = width;
+    small_height_ = height;
+    small_.assign((size_t)width * height, 0);
+    diff_.assign((size_t)width * height, 0);
+    previous_.clear();
+  }
+
+  kernels_->downscale(&plane.data[0], plane.width, plane.height, plane.width,
+                      scale, &small_[0]);
+
+  if (previous_.empty()) {
+    previous_ = small_;
+    return 0.0;
+  }
+
+  kernels_->absdiff(&small_[0], &previous_[0], &diff_[0], diff_.size());
+  for (i = 0; i < width * height; i++) {
+    if (diff_[i] > params_.pixel_threshold)
+      changed++;
+  }
+  previous_.swap(small_);
+
+  return changed * 100.0 / (width * height);
+}
+
+void MotionDetector::run() {
+  while (1) {
+    sem_wait(&ready_);
+    if (!running_)
+      break;
+    // Several posts can be pending for one update, the extra wakeups see
+    // nothing new
+    if (!planes_.update())
+      continue;
+
+    const Plane &plane = planes_.front();
+    int64_t cpu_start = thread_cpu_us();
+    double percent = analyse(plane);
+    int64_t done_us = monotonic_us();
+
+    cpu_.add(thread_cpu_us() - cpu_start);
+    latency_.add(done_us - plane.arrival_us);
+    processed_++;
+
+    if (percent >= params_.area_percent)
+      motion_frames_++;
+    else
+      motion_frames_ = 0;
+
+    if (motion_frames_ >= params_.frames &&
+        done_us - last_event_us_ >= (int64_t)params_.cooldown_ms * 1000) {
+      last_event_us_ = done_us;
+      events_++;
+      handler_(percent, plane.arrival_us);
+    }
+  }
+}
+
+void MotionDetector::report(FILE *out) const {
+  fprintf(out,
+          "motion: %llu frames analysed, %llu skipped, %llu events (%s)\n",
+          (unsigned long long)processed_, (unsigned long long)skipped_,
+          (unsigned long long)events_, kernels_->name);
+  copy_.report(out);
+  cpu_.report(out);
+  latency_.report(out);
+}
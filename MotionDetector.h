@@ -0,0 +1,110 @@
+/**
+ * \file MotionDetector.h
+ * Motion detection on the luma plane of the raw video frames.
+ *
+ * The camera callback copies the Y plane into a TripleBuffer and returns.
+ * A worker thread picks up the newest frame, box-downscales it, and compares
+ * it with the previous downscaled frame. If enough cells change for a few
+ * frames in a row, the handler is called. Frames arriving while the worker
+ * is busy are skipped, so detection never falls behind the camera.
+ */
+
+#ifndef MOTIONDETECTOR_H_
+#define MOTIONDETECTOR_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <semaphore.h>
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "Stats.h"
+#include "TripleBuffer.h"
+#include "YKernels.h"
+
+typedef struct {
+  int scale;           /// Downscale factor in each direction
+  int pixel_threshold; /// Luma difference that marks a cell as changed
+  double area_percent; /// Changed cells, in percent, that count as motion
+  int frames;          /// Consecutive frames with motion before reporting
+  int cooldown_ms;     /// Minimum time between two reports
+} MOTION_PARAMS;
+
+/** Default parameters, motion on 2% of the image */
+void motion_default_params(MOTION_PARAMS *params);
+
+class MotionDetector {
+public:
+  /**
+   * Called on the worker thread when motion is detected
+   *
+   * @param changed_percent Share of the image that changed
+   * @param arrival_us Monotonic time the frame that tipped it arrived
+   */
+  typedef std::function<void(double changed_percent, int64_t arrival_us)>
+      Handler;
+
+  MotionDetector(const MOTION_PARAMS &params, Handler handler);
+  ~MotionDetector();
+
+  /**
+   * Copy a Y plane for analysis. Never blocks, call from the camera
+   * callback.
+   *
+   * @param y First luma row
+   * @param width Visible width
+   * @param height Visible height
+   * @param stride Bytes between rows
+   * @param arrival_us Monotonic time the frame arrived
+   */
+  void submit(const uint8_t *y, int width, int height, int stride,
+              int64_t arrival_us);
+
+  /** Print frame counts and the latency and CPU statistics */
+  void report(FILE *out) const;
+
+  uint64_t processed() const { return processed_; }
+  uint64_t skipped() const { return skipped_; }
+  uint64_t events() const { return events_; }
+
+private:
+  struct Plane {
+    std::vector<uint8_t> data;
+    int width;
+    int height;
+    int64_t arrival_us;
+  };
+
+  void run();
+  double analyse(const Plane &plane);
+
+  MOTION_PARAMS params_;
+  Handler handler_;
+  TripleBuffer<Plane> planes_;
+  sem_t ready_;
+  std::atomic<bool> running_;
+
+  const YKERNELS_T *kernels_;
+
+  // Worker thread only
+  std::vector<uint8_t> small_;
+  std::vector<uint8_t> previous_;
+  std::vector<uint8_t> diff_;
+  int small_width_;
+  int small_height_;
+  int motion_frames_;
+  int64_t last_event_us_;
+
+  std::atomic<uint64_t> processed_;
+  std::atomic<uint64_t> skipped_;
+  std::atomic<uint64_t> events_;
+  LatencyStats copy_;    /// Time spent in submit()
+  LatencyStats cpu_;     /// Worker CPU time per analysed frame
+  LatencyStats latency_; /// Frame arrival to analysis done
+  std::thread thread_;
+};
+
+#endif /* MOTIONDETECTOR_H_ */
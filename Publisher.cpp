@@ -0,0 +1,131 @@
+#include "Publisher.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+int publish_sync_from_string(const char *str, PUBLISH_SYNC_T *sync) {
+  if (!strcmp(str, "none"))
+    *sync = PUBLISH_SYNC_NONE;
+  else if (!strcmp(str, "data"))
+    *sync = PUBLISH_SYNC_DATA;
+  else if (!strcmp(str, "full"))
+    *sync = PUBLISH_SYNC_FULL;
+  else
+    return -1;
+  return 0;
+}
+
+FilePublisher::FilePublisher(const char *path, PUBLISH_SYNC_T sync)
+    : path_(path), sync_(sync), fd_(-1), busy_us_(0), latency_("publish") {
+  size_t slash = path_.rfind('/');
+
+  // Same directory as the target, rename() can't cross file systems
+  tmp_path_ = path_ + ".tmp";
+  dir_ = slash == std::string::npos ? "." : path_.substr(0, slash + 1);
+}
+
+FilePublisher::~FilePublisher() { abort(); }
+
+int FilePublisher::begin() {
+  int64_t start = monotonic_us();
+
+  abort();
+  fd_ = open(tmp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    fprintf(stderr, "Cannot open %s: %s\n", tmp_path_.c_str(),
+            strerror(errno));
+    return -1;
+  }
+  // World readable regardless of umask, the web server runs as another user
+  fchmod(fd_, 0644);
+
+  busy_us_ = monotonic_us() - start;
+  return 0;
+}
+
+int FilePublisher::append(const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t *)data;
+  int64_t start = monotonic_us();
+
+  if (fd_ < 0)
+    return -1;
+
+  while (len) {
+    ssize_t n = write(fd_, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      fprintf(stderr, "Write to %s failed: %s\n", tmp_path_.c_str(),
+              strerror(errno));
+      abort();
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+
+  busy_us_ += monotonic_us() - start;
+  return 0;
+}
+
+int FilePublisher::commit() {
+  int64_t start = monotonic_us();
+  int rc = 0;
+
+  if (fd_ < 0)
+    return -1;
+
+  if (sync_ == PUBLISH_SYNC_DATA && fdatasync(fd_) != 0)
+    rc = -1;
+  if (sync_ == PUBLISH_SYNC_FULL && fsync(fd_) != 0)
+    rc = -1;
+  if (close(fd_) != 0)
+    rc = -1;
+  fd_ = -1;
+
+  if (rc != 0) {
+    fprintf(stderr, "Sync of %s failed: %s\n", tmp_path_.c_str(),
+            strerror(errno));
+    unlink(tmp_path_.c_str());
+    return -1;
+  }
+
+  if (rename(tmp_path_.c_str(), path_.c_str()) != 0) {
+    fprintf(stderr, "Could not rename temp file to: %s; %s\n", path_.c_str(),
+            strerror(errno));
+    unlink(tmp_path_.c_str());
+    return -1;
+  }
+
+  // Make the rename itself durable
+  if (sync_ == PUBLISH_SYNC_FULL) {
+    int dir = open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir >= 0) {
+      fsync(dir);
+      close(dir);
+    }
+  }
+
+  busy_us_ += monotonic_us() - start;
+  latency_.add(busy_us_);
+  return 0;
+}
+
+void FilePublisher::abort() {
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+    unlink(tmp_path_.c_str());
+  }
+}
+
+int FilePublisher::publish(const void *data, size_t len) {
+  if (begin() != 0 || append(data, len) != 0)
+    return -1;
+  return commit();
+}
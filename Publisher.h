@@ -0,0 +1,69 @@
+/**
+ * \file Publisher.h
+ * Torn-read-free publication of the latest image.
+ *
+ * Each new version is written to a temporary file next to the target and
+ * renamed over it once complete. rename() is atomic, so a reader (the web
+ * server) either sees the previous image or the new one, never a mix.
+ */
+
+#ifndef PUBLISHER_H_
+#define PUBLISHER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "Stats.h"
+
+/// How hard to push a new version to storage before it becomes visible
+typedef enum {
+  PUBLISH_SYNC_NONE, /// Leave it to the page cache (tmpfs, web root)
+  PUBLISH_SYNC_DATA, /// fdatasync() the file before the rename
+  PUBLISH_SYNC_FULL  /// fsync() the file, and the directory after the rename
+} PUBLISH_SYNC_T;
+
+/**
+ * Parse "none", "data" or "full"
+ *
+ * @return 0 on success, -1 if the string is not recognised
+ */
+int publish_sync_from_string(const char *str, PUBLISH_SYNC_T *sync);
+
+class FilePublisher {
+public:
+  FilePublisher(const char *path, PUBLISH_SYNC_T sync = PUBLISH_SYNC_NONE);
+  ~FilePublisher();
+
+  /** Start writing a new version. @return 0 on success */
+  int begin();
+
+  /** Add data to the version in progress. @return 0 on success */
+  int append(const void *data, size_t len);
+
+  /** Make the version in progress visible. @return 0 on success */
+  int commit();
+
+  /** Throw away the version in progress, the old one stays visible */
+  void abort();
+
+  /** begin(), append() and commit() in one go */
+  int publish(const void *data, size_t len);
+
+  bool active() const { return fd_ >= 0; }
+
+  /** Time spent writing, syncing and renaming for each published version */
+  const LatencyStats &latency() const { return latency_; }
+
+private:
+  std::string path_;
+  std::string tmp_path_;
+  std::string dir_;
+  PUBLISH_SYNC_T sync_;
+  int fd_;
+  int64_t busy_us_;
+  LatencyStats latency_;
+};
+
+#endif /* PUBLISHER_H_ */
@@ -773,6 +773,73 @@ int raspicamcontrol_set_stats_pass(MMAL_COMPONENT_T *camera, int stats_pass)
 }
 
 
+/**
+ * Fill in everything of an annotate parameter but the text: what the
+ * firmware adds itself, the background and the colours. The result can be
+ * kept and sent again with only the text changed.
+ *
+ * @param annotate Parameter to fill in, the text is left empty
+ * @param settings Bitmask of required annotation data, 0 for off
+ */
+void raspicamcontrol_init_annotate(MMAL_PARAMETER_CAMERA_ANNOTATE_V3_T *annotate, const int settings,
+                const int text_size, const int text_colour, const int bg_colour)
+{
+   memset(annotate, 0, sizeof(*annotate));
+   annotate->hdr.id = MMAL_PARAMETER_ANNOTATE;
+   annotate->hdr.size = sizeof(*annotate);
+
+   if (!settings)
+   {
+      annotate->enable = 0;
+      return;
+   }
+
+   annotate->enable = 1;
+
+   if (settings & ANNOTATE_SHUTTER_SETTINGS)
+      annotate->show_shutter = MMAL_TRUE;
+
+   if (settings & ANNOTATE_GAIN_SETTINGS)
+      annotate->show_analog_gain = MMAL_TRUE;
+
+   if (settings & ANNOTATE_LENS_SETTINGS)
+      annotate->show_lens = MMAL_TRUE;
+
+   if (settings & ANNOTATE_CAF_SETTINGS)
+      annotate->show_caf = MMAL_TRUE;
+
+   if (settings & ANNOTATE_MOTION_SETTINGS)
+      annotate->show_motion = MMAL_TRUE;
+
+   if (settings & ANNOTATE_FRAME_NUMBER)
+      annotate->show_frame_num = MMAL_TRUE;
+
+   if (settings & ANNOTATE_BLACK_BACKGROUND)
+      annotate->enable_text_background = MMAL_TRUE;
+
+   annotate->text_size = text_size;
+
+   if (text_colour != -1)
+   {
+      annotate->custom_text_colour = MMAL_TRUE;
+      annotate->custom_text_Y = text_colour&0xff;
+      annotate->custom_text_U = (text_colour>>8)&0xff;
+      annotate->custom_text_V = (text_colour>>16)&0xff;
+   }
+   else
+      annotate->custom_text_colour = MMAL_FALSE;
+
+   if (bg_colour != -1)
+   {
+      annotate->custom_background_colour = MMAL_TRUE;
+      annotate->custom_background_Y = bg_colour&0xff;
+      annotate->custom_background_U = (bg_colour>>8)&0xff;
+      annotate->custom_background_V = (bg_colour>>16)&0xff;
+   }
+   else
+      annotate->custom_background_colour = MMAL_FALSE;
+}
+
 /**
  * Set the annotate data
  * @param camera Pointer to camera component
@@ -784,8 +851,9 @@ int raspicamcontrol_set_stats_pass(MMAL_COMPONENT_T *camera, int stats_pass)
 int raspicamcontrol_set_annotate(MMAL_COMPONENT_T *camera, const int settings, const char *string,
                 const int text_size, const int text_colour, const int bg_colour)
 {
-   MMAL_PARAMETER_CAMERA_ANNOTATE_V3_T annotate =
-      {{MMAL_PARAMETER_ANNOTATE, sizeof(MMAL_PARAMETER_CAMERA_ANNOTATE_V3_T)}};
+   MMAL_PARAMETER_CAMERA_ANNOTATE_V3_T annotate;
+
+   raspicamcontrol_init_annotate(&annotate, settings, text_size, text_colour, bg_colour);
 
    if (settings)
    {
@@ -794,8 +862,6 @@ int raspicamcontrol_set_annotate(MMAL_COMPONENT_T *camera, const int settings, c
       char tmp[MMAL_CAMERA_ANNOTATE_MAX_TEXT_LEN_V3];
       int process_datetime = 1;
 
-       annotate.enable = 1;
-
       if (settings & (ANNOTATE_APP_TEXT | ANNOTATE_USER_TEXT))
       {
          if ((settings & (ANNOTATE_TIME_TEXT | ANNOTATE_DATE_TEXT)) && strchr(string,'%') != NULL)
@@ -827,52 +893,7 @@ int raspicamcontrol_set_annotate(MMAL_COMPONENT_T *camera, const int settings, c
          }
          strncat(annotate.text, tmp, MMAL_CAMERA_ANNOTATE_MAX_TEXT_LEN_V3 - strlen(annotate.text) - 1);
       }
-
-      if (settings & ANNOTATE_SHUTTER_SETTINGS)
-         annotate.show_shutter = MMAL_TRUE;
-
-      if (settings & ANNOTATE_GAIN_SETTINGS)
-         annotate.show_analog_gain = MMAL_TRUE;
-
-      if (settings & ANNOTATE_LENS_SETTINGS)
-         annotate.show_lens = MMAL_TRUE;
-
-      if (settings & ANNOTATE_CAF_SETTINGS)
-         annotate.show_caf = MMAL_TRUE;
-
-      if (settings & ANNOTATE_MOTION_SETTINGS)
-         annotate.show_motion = MMAL_TRUE;
-
-      if (settings & ANNOTATE_FRAME_NUMBER)
-         annotate.show_frame_num = MMAL_TRUE;
-
-      if (settings & ANNOTATE_BLACK_BACKGROUND)
-         annotate.enable_text_background = MMAL_TRUE;
-
-      annotate.text_size = text_size;
-
-      if (text_colour != -1)
-      {
-         annotate.custom_text_colour = MMAL_TRUE;
-         annotate.custom_text_Y = text_colour&0xff;
-         annotate.custom_text_U = (text_colour>>8)&0xff;
-         annotate.custom_text_V = (text_colour>>16)&0xff;
-      }
-      else
-         annotate.custom_text_colour = MMAL_FALSE;
- 
-      if (bg_colour != -1)
-      {
-         annotate.custom_background_colour = MMAL_TRUE;
-         annotate.custom_background_Y = bg_colour&0xff;
-         annotate.custom_background_U = (bg_colour>>8)&0xff;
-         annotate.custom_background_V = (bg_colour>>16)&0xff;
-      }
-      else
-         annotate.custom_background_colour = MMAL_FALSE;
    }
-   else
-      annotate.enable = 0;
 
    return mmal_status_to_int(mmal_port_parameter_set(camera->control, &annotate.hdr));
 }
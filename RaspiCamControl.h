@@ -201,6 +201,8 @@ int raspicamcontrol_set_DRC(MMAL_COMPONENT_T *camera, MMAL_PARAMETER_DRC_STRENGT
 int raspicamcontrol_set_stats_pass(MMAL_COMPONENT_T *camera, int stats_pass);
 int raspicamcontrol_set_annotate(MMAL_COMPONENT_T *camera, const int bitmask, const char *string,
                                  const int text_size, const int text_colour, const int bg_colour);
+void raspicamcontrol_init_annotate(MMAL_PARAMETER_CAMERA_ANNOTATE_V3_T *annotate, const int bitmask,
+                                   const int text_size, const int text_colour, const int bg_colour);
 int raspicamcontrol_set_stereo_mode(MMAL_PORT_T *port, MMAL_PARAMETER_STEREOSCOPIC_MODE_T *stereo_mode);
 
 //Individual getting functions
@@ -0,0 +1,158 @@
+#include "SegmentRecorder.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+SegmentRecorder::SegmentRecorder(const char *dir, int segment_seconds,
+                                 int segment_count, int framerate)
+    : dir_(dir), segment_us_((int64_t)segment_seconds * 1000000),
+      segment_count_(segment_count > 0 ? segment_count : 1),
+      frame_us_(framerate > 0 ? 1000000 / framerate : 0), fd_(-1), slot_(-1),
+      frame_start_(true), segment_start_pts_(SEGMENT_NO_PTS),
+      last_pts_(SEGMENT_NO_PTS), segment_frames_(0), segment_bytes_(0),
+      segment_dropped_(0), frames_(0), dropped_(0), segments_(0) {
+  struct timespec oldest = {0, 0};
+  int i;
+
+  // Carry on from the last run: start with an unused slot, or else the one
+  // written longest ago
+  for (i = 0; i < segment_count_; i++) {
+    char name[32];
+    struct stat st;
+
+    snprintf(name, sizeof(name), "/seg%03d.h264", i);
+    if (stat((dir_ + name).c_str(), &st) != 0) {
+      slot_ = i - 1;
+      break;
+    }
+    if (i == 0 || st.st_mtim.tv_sec < oldest.tv_sec ||
+        (st.st_mtim.tv_sec == oldest.tv_sec &&
+         st.st_mtim.tv_nsec < oldest.tv_nsec)) {
+      oldest = st.st_mtim;
+      slot_ = i - 1;
+    }
+  }
+}
+
+SegmentRecorder::~SegmentRecorder() { close_segment(); }
+
+int SegmentRecorder::write_all(const uint8_t *data, size_t len) {
+  while (len) {
+    ssize_t n = ::write(fd_, data, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+void SegmentRecorder::close_segment() {
+  if (fd_ < 0)
+    return;
+
+  close(fd_);
+  fd_ = -1;
+
+  double seconds = last_pts_ != SEGMENT_NO_PTS &&
+                           segment_start_pts_ != SEGMENT_NO_PTS
+                       ? (last_pts_ - segment_start_pts_ + frame_us_) / 1e6
+                       : 0.0;
+  fprintf(stderr,
+          "Segment %03d: %llu frames, %.1f s, %.2f Mbit/s, %llu dropped "
+          "(%llu total)\n",
+          slot_, (unsigned long long)segment_frames_, seconds,
+          seconds > 0 ? segment_bytes_ * 8 / seconds / 1e6 : 0.0,
+          (unsigned long long)segment_dropped_, (unsigned long long)dropped_);
+}
+
+int SegmentRecorder::open_next(int64_t pts_us) {
+  char name[32];
+
+  close_segment();
+
+  slot_ = (slot_ + 1) % segment_count_;
+  snprintf(name, sizeof(name), "/seg%03d.h264", slot_);
+  fd_ = open((dir_ + name).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+             0644);
+  if (fd_ < 0) {
+    fprintf(stderr, "Cannot open segment %s%s: %s\n", dir_.c_str(), name,
+            strerror(errno));
+    return -1;
+  }
+
+  segment_start_pts_ = pts_us;
+  segment_frames_ = 0;
+  segment_bytes_ = 0;
+  segment_dropped_ = 0;
+  segments_++;
+  return 0;
+}
+
+int SegmentRecorder::write(const uint8_t *data, size_t len, int64_t pts_us,
+                           unsigned flags) {
+  bool starts_frame = frame_start_;
+
+  if (flags & SEGMENT_FRAME_END)
+    frame_start_ = true;
+  else if (len)
+    frame_start_ = false;
+
+  // Hold SPS/PPS back until we know which segment the next frame goes to
+  if (flags & SEGMENT_CONFIG) {
+    if (starts_frame)
+      config_.clear();
+    config_.insert(config_.end(), data, data + len);
+    frame_start_ = true;
+    return 0;
+  }
+
+  if (starts_frame && (flags & SEGMENT_KEYFRAME)) {
+    bool due = fd_ < 0 || pts_us == SEGMENT_NO_PTS ||
+               segment_start_pts_ == SEGMENT_NO_PTS ||
+               // Half a frame of slack for rounding in the timestamps
+               pts_us - segment_start_pts_ + frame_us_ / 2 >= segment_us_;
+    if (due && open_next(pts_us) != 0)
+      return -1;
+  }
+
+  // Nothing before the first keyframe is decodable
+  if (fd_ < 0)
+    return 0;
+
+  if (!config_.empty()) {
+    if (write_all(config_.data(), config_.size()) != 0)
+      return -1;
+    segment_bytes_ += config_.size();
+    config_.clear();
+  }
+
+  if (len && write_all(data, len) != 0) {
+    fprintf(stderr, "Segment write failed: %s\n", strerror(errno));
+    return -1;
+  }
+  segment_bytes_ += len;
+
+  if ((flags & SEGMENT_FRAME_END) && pts_us != SEGMENT_NO_PTS) {
+    if (last_pts_ != SEGMENT_NO_PTS && frame_us_ > 0) {
+      int64_t gap = pts_us - last_pts_;
+      // Anything over one and a half frame intervals means frames are missing
+      if (gap > frame_us_ + frame_us_ / 2) {
+        uint64_t missing = (gap + frame_us_ / 2) / frame_us_ - 1;
+        segment_dropped_ += missing;
+        dropped_ += missing;
+      }
+    }
+    last_pts_ = pts_us;
+    segment_frames_++;
+    frames_++;
+  }
+
+  return 0;
+}
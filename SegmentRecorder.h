@@ -0,0 +1,86 @@
+/**
+ * \file SegmentRecorder.h
+ * Loop recording of an H.264 elementary stream into fixed-duration segments.
+ *
+ * The stream is cut only in front of a keyframe, so every segment starts
+ * with SPS/PPS and an IDR frame and plays on its own. Segments are written
+ * to a fixed set of slots, <dir>/seg000.h264 upwards, and once all slots are
+ * used the oldest one is overwritten.
+ *
+ * Dropped frames are counted from gaps in the presentation timestamps.
+ */
+
+#ifndef SEGMENTRECORDER_H_
+#define SEGMENTRECORDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+/// Flags for SegmentRecorder::write()
+#define SEGMENT_CONFIG 1    /// Buffer holds codec config (SPS/PPS)
+#define SEGMENT_KEYFRAME 2  /// Buffer is part of a keyframe
+#define SEGMENT_FRAME_END 4 /// Buffer completes a frame
+
+/// Timestamp of a buffer without one
+#define SEGMENT_NO_PTS INT64_MIN
+
+class SegmentRecorder {
+public:
+  /**
+   * @param dir Directory the segments go to, must exist
+   * @param segment_seconds Minimum length of each segment
+   * @param segment_count Number of segment slots to cycle through
+   * @param framerate Nominal frame rate, used to detect dropped frames
+   */
+  SegmentRecorder(const char *dir, int segment_seconds, int segment_count,
+                  int framerate);
+  ~SegmentRecorder();
+
+  /**
+   * Append one encoder buffer, starting a new segment if one is due
+   *
+   * @param data Buffer payload
+   * @param len Payload length
+   * @param pts_us Presentation time, SEGMENT_NO_PTS if unknown
+   * @param flags SEGMENT_* flags
+   * @return 0 on success, -1 if the data could not be written
+   */
+  int write(const uint8_t *data, size_t len, int64_t pts_us, unsigned flags);
+
+  uint64_t frames() const { return frames_; }
+  uint64_t dropped() const { return dropped_; }
+  uint64_t segments() const { return segments_; }
+
+private:
+  int open_next(int64_t pts_us);
+  void close_segment();
+  int write_all(const uint8_t *data, size_t len);
+
+  std::string dir_;
+  int64_t segment_us_;
+  int segment_count_;
+  int64_t frame_us_;
+
+  int fd_;
+  int slot_;                    /// Slot of the segment being written
+  std::vector<uint8_t> config_; /// Pending SPS/PPS for the next frame
+  bool frame_start_;            /// Next buffer starts a new frame
+  int64_t segment_start_pts_;
+  int64_t last_pts_;
+
+  // Current segment
+  uint64_t segment_frames_;
+  uint64_t segment_bytes_;
+  uint64_t segment_dropped_;
+
+  // Whole session, read by the report on other threads
+  std::atomic<uint64_t> frames_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<uint64_t> segments_;
+};
+
+#endif /* SEGMENTRECORDER_H_ */
@@ -0,0 +1,68 @@
+/**
+ * \file SeqLock.h
+ * Lock-free latest-value slot for one writer and any number of readers.
+ *
+ * The writer never waits: it bumps the sequence to odd, stores the value and
+ * bumps it back to even. A reader copies the value and retries if the
+ * sequence was odd or moved meanwhile, so it only spins while a store is in
+ * progress. The value is kept in atomic words, which makes the torn copies a
+ * reader throws away well defined.
+ */
+
+#ifndef SEQLOCK_H_
+#define SEQLOCK_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+template <typename T> class SeqLock {
+public:
+  SeqLock() : sequence_(0) {
+    for (size_t i = 0; i < WORDS; i++)
+      words_[i].store(0, std::memory_order_relaxed);
+  }
+
+  /** Writer side: replace the value */
+  void store(const T &value) {
+    uint64_t words[WORDS] = {0};
+    uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+
+    memcpy(words, &value, sizeof(T));
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < WORDS; i++)
+      words_[i].store(words[i], std::memory_order_relaxed);
+    sequence_.store(sequence + 2, std::memory_order_release);
+  }
+
+  /**
+   * Reader side: copy the latest value
+   *
+   * @return The sequence it was stored with, 0 if nothing was stored yet
+   */
+  uint32_t load(T *value) const {
+    uint64_t words[WORDS];
+    uint32_t before, after;
+
+    do {
+      before = sequence_.load(std::memory_order_acquire);
+      for (size_t i = 0; i < WORDS; i++)
+        words[i] = words_[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = sequence_.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+
+    memcpy(value, words, sizeof(T));
+    return before / 2;
+  }
+
+private:
+  enum { WORDS = (sizeof(T) + 7) / 8 };
+
+  std::atomic<uint32_t> sequence_;
+  std::atomic<uint64_t> words_[WORDS];
+};
+
+#endif /* SEQLOCK_H_ */
@@ -0,0 +1,290 @@
+#include "SoftJpegCamera.h"
+
+#include <string.h>
+#include <inttypes.h>
+
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#else
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#endif
+
+#include "Trace.h"
+
+/// Frames copied or being encoded beyond one per worker, so the camera
+/// thread finds a free job while every worker is busy
+#define SOFT_JPEG_SPARE_JOBS 2
+
+SoftJpegCamera::SoftJpegCamera(const CAMERA_PARAMS &params,
+                               const Handlers &handlers)
+    : CameraBackend(params, handlers), source_(NULL), remaining_(0),
+      next_frame_(0), next_index_(0), capture_timestamp_us_(0),
+      next_sequence_(0), delivered_(0), target_(0), running_(false),
+      next_delivery_(0), exposure_us_(0), skipped_(0),
+      copy_("soft jpeg copy"), encode_("soft jpeg encode"),
+      cpu_("soft jpeg cpu") {}
+
+SoftJpegCamera::~SoftJpegCamera() {
+  // No raw frames once the source is gone
+  delete source_;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    running_ = false;
+  }
+  work_.notify_all();
+  for (size_t i = 0; i < workers_.size(); i++)
+    workers_[i].join();
+  for (size_t i = 0; i < jobs_.size(); i++)
+    delete jobs_[i];
+}
+
+int SoftJpegCamera::open() {
+  char text[256];
+  int i;
+
+  if (!source_ || source_->open() != 0)
+    return -1;
+
+  running_ = true;
+  for (i = 0; i < params_.soft_jpeg_threads + SOFT_JPEG_SPARE_JOBS; i++) {
+    jobs_.push_back(new Job());
+    free_.push_back(jobs_.back());
+  }
+  for (i = 0; i < params_.soft_jpeg_threads; i++)
+    workers_.push_back(std::thread(&SoftJpegCamera::run_worker, this));
+
+  snprintf(text, sizeof(text), "%s, stills encoded on %d threads (%s)",
+           source_->describe(), params_.soft_jpeg_threads,
+#ifdef HAVE_TURBOJPEG
+           "libjpeg-turbo"
+#else
+           "OpenCV"
+#endif
+           );
+  description_ = text;
+  return 0;
+}
+
+/**
+ * Take the frame for the pending capture, if any. Runs on the camera thread:
+ * only the plane copy happens here, the encode is left to the workers.
+ */
+void SoftJpegCamera::submit(const CAMERA_YUV &frame) {
+  Job *job;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (remaining_ <= 0)
+      return;
+    if (free_.empty()) {
+      // Every worker is behind, the next frame takes this still
+      skipped_++;
+      return;
+    }
+    job = free_.back();
+    free_.pop_back();
+    job->sequence = next_sequence_++;
+    job->frame = next_frame_++;
+    job->burst_index = next_index_++;
+    job->timestamp_us = capture_timestamp_us_;
+    remaining_--;
+  }
+
+  int64_t start = monotonic_us();
+  job->pts_us = frame.arrival_us;
+  if (job->burst_index == 0)
+    exposure_us_ = frame.arrival_us;
+  else
+    job->timestamp_us = wallclock_us();
+  trace_event(TRACE_INSTANT, "first encoder buffer", job->frame);
+
+  // Packed I420, as both encoders take it
+  int chroma_width = frame.width / 2, chroma_height = frame.height / 2;
+  size_t luma = (size_t)frame.width * frame.height;
+  size_t chroma = (size_t)chroma_width * chroma_height;
+  uint8_t *out;
+  int row;
+
+  job->width = frame.width;
+  job->height = frame.height;
+  job->yuv.resize(luma + 2 * chroma);
+  out = &job->yuv[0];
+  for (row = 0; row < frame.height; row++, out += frame.width)
+    memcpy(out, frame.y + (size_t)row * frame.y_stride, frame.width);
+  for (row = 0; row < chroma_height; row++, out += chroma_width)
+    memcpy(out, frame.u + (size_t)row * frame.uv_stride, chroma_width);
+  for (row = 0; row < chroma_height; row++, out += chroma_width)
+    memcpy(out, frame.v + (size_t)row * frame.uv_stride, chroma_width);
+  copy_.add(monotonic_us() - start);
+
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    todo_.push_back(job);
+  }
+  work_.notify_one();
+}
+
+/**
+ * Compress the job's planes into job->jpeg
+ *
+ * @param compressor The worker's TurboJPEG handle, unused without it
+ * @return 0 on success
+ */
+int SoftJpegCamera::encode(Job *job, void *compressor) {
+#ifdef HAVE_TURBOJPEG
+  const unsigned char *planes[3];
+  unsigned char *jpeg;
+  unsigned long size = tjBufSize(job->width, job->height, TJSAMP_420);
+
+  planes[0] = &job->yuv[0];
+  planes[1] = planes[0] + (size_t)job->width * job->height;
+  planes[2] = planes[1] + (size_t)(job->width / 2) * (job->height / 2);
+  // Sized for the worst case, so the encoder never reallocates it
+  job->jpeg.resize(size);
+  jpeg = &job->jpeg[0];
+  if (tjCompressFromYUVPlanes((tjhandle)compressor, planes, job->width, NULL,
+                              job->height, TJSAMP_420, &jpeg, &size,
+                              params_.quality,
+                              TJFLAG_NOREALLOC | TJFLAG_FASTDCT) != 0) {
+    fprintf(stderr, "Soft JPEG encode failed: %s\n", tjGetErrorStr());
+    return -1;
+  }
+  job->jpeg.resize(size);
+  return 0;
+#else
+  (void)compressor;
+  cv::Mat yuv(job->height * 3 / 2, job->width, CV_8UC1, &job->yuv[0]);
+  cv::Mat bgr;
+  std::vector<int> options;
+
+  cv::cvtColor(yuv, bgr, cv::COLOR_YUV2BGR_I420);
+  options.push_back(cv::IMWRITE_JPEG_QUALITY);
+  options.push_back(params_.quality);
+  return cv::imencode(".jpg", bgr, job->jpeg, options) ? 0 : -1;
+#endif
+}
+
+void SoftJpegCamera::run_worker() {
+  void *compressor = NULL;
+
+#ifdef HAVE_TURBOJPEG
+  compressor = tjInitCompress();
+  if (!compressor)
+    fprintf(stderr, "Soft JPEG: %s\n", tjGetErrorStr());
+#endif
+
+  while (1) {
+    Job *job;
+    {
+      std::unique_lock<std::mutex> guard(lock_);
+      work_.wait(guard, [this] { return !todo_.empty() || !running_; });
+      if (!running_)
+        break;
+      job = todo_.front();
+      todo_.pop_front();
+    }
+
+    int64_t start = monotonic_us(), start_cpu = thread_cpu_us();
+#ifdef HAVE_TURBOJPEG
+    if (!compressor || encode(job, compressor) != 0)
+#else
+    if (encode(job, compressor) != 0)
+#endif
+      job->jpeg.clear();
+    cpu_.add(thread_cpu_us() - start_cpu);
+    encode_.add(monotonic_us() - start);
+
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      ready_[job->sequence] = job;
+    }
+    deliver();
+  }
+
+#ifdef HAVE_TURBOJPEG
+  if (compressor)
+    tjDestroy((tjhandle)compressor);
+#endif
+}
+
+/**
+ * Pass the encoded stills on in the order their frames arrived. Whichever
+ * worker holds deliver_lock_ sends every still that is next in line, so the
+ * output handler sees one still at a time.
+ */
+void SoftJpegCamera::deliver() {
+  std::lock_guard<std::mutex> deliver_guard(deliver_lock_);
+
+  while (1) {
+    Job *job;
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      std::map<uint64_t, Job *>::iterator next = ready_.find(next_delivery_);
+      if (next == ready_.end())
+        return;
+      job = next->second;
+      ready_.erase(next);
+    }
+
+    CAMERA_OUTPUT chunk;
+    chunk.frame = job->frame;
+    chunk.burst_index = job->burst_index;
+    chunk.timestamp_us = job->timestamp_us;
+    chunk.pts_us = job->pts_us;
+    chunk.data = job->jpeg.data();
+    chunk.length = job->jpeg.size();
+    chunk.flags = job->jpeg.empty() ? CAMERA_OUTPUT_FAILED
+                                    : CAMERA_OUTPUT_FRAME_END;
+    trace_event(TRACE_INSTANT, "frame end buffer", chunk.frame);
+    handlers_.output(chunk);
+    next_delivery_++;
+
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      free_.push_back(job);
+      delivered_++;
+    }
+    complete_.notify_all();
+  }
+}
+
+int SoftJpegCamera::capture(uint32_t frame, int64_t timestamp_us) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    remaining_ = params_.burst;
+    next_frame_ = frame;
+    next_index_ = 0;
+    capture_timestamp_us_ = timestamp_us;
+    target_ = next_sequence_ + params_.burst;
+  }
+  trace_event(TRACE_INSTANT, "capture issued", frame);
+  return 0;
+}
+
+void SoftJpegCamera::wait_capture() {
+  std::unique_lock<std::mutex> guard(lock_);
+
+  complete_.wait(guard, [this] { return delivered_ >= target_; });
+}
+
+void SoftJpegCamera::stop_frames() {
+  source_->stop_frames();
+
+  // Stills that never got a frame are given up, so wait_capture() returns
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    target_ -= remaining_;
+    remaining_ = 0;
+  }
+  complete_.notify_all();
+}
+
+void SoftJpegCamera::report(FILE *out) const {
+  source_->report(out);
+  fprintf(out, "Soft JPEG: %" PRIu64 " frames skipped with every worker busy\n",
+          skipped_.load());
+  copy_.report(out);
+  encode_.report(out);
+  cpu_.report(out);
+}
@@ -0,0 +1,107 @@
+/**
+ * \file SoftJpegCamera.h
+ * Stills encoded in software from the raw video frames.
+ *
+ * Wraps another backend and ignores its still port. While a capture is
+ * pending, each raw I420 frame is copied off the camera thread and JPEG
+ * encoded on a pool of worker threads, so a burst runs at the video frame
+ * rate instead of the still port's mode switch rate. The stills come out at
+ * the raw frame size, in frame order, each as one chunk.
+ *
+ * Built with libjpeg-turbo (HAVE_TURBOJPEG) the planes are compressed as
+ * they are; otherwise OpenCV converts them to BGR first.
+ */
+
+#ifndef SOFTJPEGCAMERA_H_
+#define SOFTJPEGCAMERA_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CameraBackend.h"
+#include "Stats.h"
+
+class SoftJpegCamera : public CameraBackend {
+public:
+  /** @param params Uses soft_jpeg_threads, quality and burst */
+  SoftJpegCamera(const CAMERA_PARAMS &params, const Handlers &handlers);
+  ~SoftJpegCamera();
+
+  /** The backend the raw frames come from. Takes ownership. */
+  void set_source(CameraBackend *source) { source_ = source; }
+
+  /** Raw frame handler to give the source */
+  YuvHandler yuv_handler() {
+    return [this](const CAMERA_YUV &frame) { submit(frame); };
+  }
+
+  int open();
+  int capture(uint32_t frame, int64_t timestamp_us);
+  void wait_capture();
+  int64_t last_exposure_us() const { return exposure_us_; }
+  void trigger_event() { source_->trigger_event(); }
+  /** The source draws it, onto the raw frames the stills are made of */
+  void set_annotation(const char *text) { source_->set_annotation(text); }
+  void stop_frames();
+  void report(FILE *out) const;
+  const char *describe() const { return description_.c_str(); }
+
+private:
+  /** One frame on its way to a still */
+  struct Job {
+    std::vector<uint8_t> yuv;  /// Packed I420 planes
+    std::vector<uint8_t> jpeg;
+    int width;
+    int height;
+    uint64_t sequence;         /// Order the stills are delivered in
+    uint32_t frame;
+    uint32_t burst_index;
+    int64_t timestamp_us;
+    int64_t pts_us;            /// Arrival of the frame
+  };
+
+  void submit(const CAMERA_YUV &frame);
+  void run_worker();
+  int encode(Job *job, void *compressor);
+  void deliver();
+
+  CameraBackend *source_;
+  std::string description_;
+
+  std::mutex lock_;
+  std::condition_variable work_;     /// A job is waiting, or stopping
+  std::condition_variable complete_; /// A still was delivered
+  std::vector<Job *> free_;          /// Under lock_
+  std::deque<Job *> todo_;           /// Under lock_
+  std::map<uint64_t, Job *> ready_;  /// Encoded, by sequence, under lock_
+  int remaining_;                    /// Stills still to take, under lock_
+  uint32_t next_frame_;              /// Frame number of the next still
+  uint32_t next_index_;              /// Its position in the burst
+  int64_t capture_timestamp_us_;
+  uint64_t next_sequence_;
+  uint64_t delivered_;               /// Under lock_
+  uint64_t target_;                  /// delivered_ when the capture is done
+  bool running_;
+
+  std::mutex deliver_lock_;          /// One thread delivers at a time
+  uint64_t next_delivery_;           /// Under deliver_lock_
+
+  std::vector<std::thread> workers_;
+  std::vector<Job *> jobs_;
+  std::atomic<int64_t> exposure_us_;
+  std::atomic<uint64_t> skipped_;    /// Frames with no free job
+  LatencyStats copy_;    /// Plane copy on the camera thread
+  LatencyStats encode_;  /// Wall time per still
+  LatencyStats cpu_;     /// CPU time per still
+};
+
+#endif /* SOFTJPEGCAMERA_H_ */
@@ -0,0 +1,72 @@
+/**
+ * \file SpscQueue.h
+ * Bounded lock-free single producer / single consumer ring.
+ *
+ * push() must only ever be called from one thread and pop() from one
+ * (other) thread. Neither blocks; callers that need to sleep pair the queue
+ * with a semaphore.
+ */
+
+#ifndef SPSCQUEUE_H_
+#define SPSCQUEUE_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <vector>
+
+template <typename T> class SpscQueue {
+public:
+  /**
+   * @param capacity Minimum number of entries, rounded up to a power of two
+   */
+  explicit SpscQueue(size_t capacity) : head_(0), tail_(0) {
+    size_t size = 1;
+    while (size < capacity)
+      size <<= 1;
+    slots_.resize(size);
+    mask_ = size - 1;
+  }
+
+  /** Producer side. @return false if the queue is full */
+  bool push(const T &value) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_.load(std::memory_order_acquire) > mask_)
+      return false;
+    slots_[tail & mask_] = value;
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /** Consumer side. @return false if the queue is empty */
+  bool pop(T *value) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire))
+      return false;
+    *value = slots_[head & mask_];
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /** Approximate number of queued entries, safe from either side */
+  size_t size() const {
+    return tail_.load(std::memory_order_acquire) -
+           head_.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+private:
+  std::vector<T> slots_;
+  size_t mask_;
+  // Keep the indices on separate cache lines so producer and consumer don't
+  // bounce the same line between cores. Padding rather than alignas, which
+  // operator new does not honour before C++17.
+  char pad0_[64];
+  std::atomic<size_t> head_;
+  char pad1_[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> tail_;
+  char pad2_[64 - sizeof(std::atomic<size_t>)];
+};
+
+#endif /* SPSCQUEUE_H_ */
@@ -0,0 +1,128 @@
+#include "Stats.h"
+
+#include <time.h>
+#include <inttypes.h>
+
+#include <algorithm>
+
+int64_t monotonic_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t wallclock_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t thread_cpu_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t process_cpu_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+LatencyStats::LatencyStats(const char *name, size_t window)
+    : name_(name), window_(window ? window : 1), next_(0), count_(0),
+      last_(0), min_(0), max_(0), sum_(0) {}
+
+void LatencyStats::add(int64_t us) {
+  std::lock_guard<std::mutex> guard(lock_);
+
+  window_[next_] = us;
+  next_ = (next_ + 1) % window_.size();
+
+  if (count_ == 0 || us < min_)
+    min_ = us;
+  if (count_ == 0 || us > max_)
+    max_ = us;
+  sum_ += us;
+  last_ = us;
+  count_++;
+}
+
+void LatencyStats::reset() {
+  std::lock_guard<std::mutex> guard(lock_);
+  next_ = 0;
+  count_ = 0;
+  last_ = min_ = max_ = sum_ = 0;
+}
+
+uint64_t LatencyStats::count() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return count_;
+}
+
+int64_t LatencyStats::last() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return last_;
+}
+
+int64_t LatencyStats::mean() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return count_ ? sum_ / (int64_t)count_ : 0;
+}
+
+int64_t LatencyStats::percentile(double p) const {
+  std::vector<int64_t> samples;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    size_t n = count_ < window_.size() ? (size_t)count_ : window_.size();
+    samples.assign(window_.begin(), window_.begin() + n);
+  }
+
+  if (samples.empty())
+    return 0;
+
+  size_t rank = (size_t)(p / 100.0 * (samples.size() - 1) + 0.5);
+  if (rank >= samples.size())
+    rank = samples.size() - 1;
+  std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+  return samples[rank];
+}
+
+void LatencyStats::report(FILE *out) const {
+  uint64_t n;
+  int64_t last, lo, hi, sum;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    n = count_;
+    last = last_;
+    lo = min_;
+    hi = max_;
+    sum = sum_;
+  }
+
+  fprintf(out,
+          "%s: n=%" PRIu64 " last=%" PRId64 "us min=%" PRId64
+          "us mean=%" PRId64 "us p50=%" PRId64 "us p99=%" PRId64
+          "us max=%" PRId64 "us\n",
+          name_, n, last, lo, n ? sum / (int64_t)n : 0, percentile(50),
+          percentile(99), hi);
+}
+
+void LatencyStats::report_json(FILE *out) const {
+  uint64_t n;
+  int64_t lo, hi, sum;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    n = count_;
+    lo = min_;
+    hi = max_;
+    sum = sum_;
+  }
+
+  fprintf(out,
+          "{\"name\":\"%s\",\"count\":%" PRIu64 ",\"min_us\":%" PRId64
+          ",\"mean_us\":%" PRId64 ",\"p50_us\":%" PRId64 ",\"p99_us\":%" PRId64
+          ",\"p999_us\":%" PRId64 ",\"max_us\":%" PRId64 "}",
+          name_, n, lo, n ? sum / (int64_t)n : 0, percentile(50),
+          percentile(99), percentile(99.9), hi);
+}
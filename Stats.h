@@ -0,0 +1,83 @@
+/**
+ * \file Stats.h
+ * Monotonic timestamps and latency accumulators used to report per-frame
+ * timings without printf on the hot path.
+ */
+
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <mutex>
+#include <vector>
+
+/**
+ * Current CLOCK_MONOTONIC time in microseconds.
+ */
+int64_t monotonic_us();
+
+/**
+ * Current CLOCK_REALTIME time in microseconds, for timestamps that are
+ * compared across machines.
+ */
+int64_t wallclock_us();
+
+/** CPU time used by the calling thread, in microseconds */
+int64_t thread_cpu_us();
+
+/** CPU time used by every thread of the process, in microseconds */
+int64_t process_cpu_us();
+
+/**
+ * Accumulates latency samples (in microseconds) and reports min/mean/max and
+ * percentiles. The most recent samples are kept in a bounded window so the
+ * memory use stays fixed however long the process runs.
+ *
+ * add() may be called from any thread.
+ */
+class LatencyStats {
+public:
+  /**
+   * @param name Label used when reporting
+   * @param window Number of most recent samples kept for percentiles
+   */
+  explicit LatencyStats(const char *name, size_t window = 4096);
+
+  void add(int64_t us);
+  void reset();
+
+  uint64_t count() const;
+  int64_t last() const;
+  int64_t mean() const;
+
+  /**
+   * Percentile over the sample window.
+   *
+   * @param p Percentile in the range 0..100
+   * @return The sample at that percentile, 0 if no samples
+   */
+  int64_t percentile(double p) const;
+
+  /** Single human readable line: count, last, min, mean, p50, p99, max */
+  void report(FILE *out) const;
+
+  /** One JSON object with the same fields plus p999, no trailing newline */
+  void report_json(FILE *out) const;
+
+  const char *name() const { return name_; }
+
+private:
+  const char *name_;
+  mutable std::mutex lock_;
+  std::vector<int64_t> window_;
+  size_t next_;
+  uint64_t count_;
+  int64_t last_;
+  int64_t min_;
+  int64_t max_;
+  int64_t sum_;
+};
+
+#endif /* STATS_H_ */
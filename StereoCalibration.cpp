@@ -0,0 +1,102 @@
+#include "StereoCalibration.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <opencv2/calib3d.hpp>
+
+#include "FrameLink.h"
+
+int StereoCalibration::load(const char *path) {
+  cv::FileStorage fs;
+
+  if (!fs.open(path, cv::FileStorage::READ)) {
+    fprintf(stderr, "Cannot read stereo calibration %s\n", path);
+    return -1;
+  }
+
+  fs["M1"] >> m1;
+  fs["D1"] >> d1;
+  fs["M2"] >> m2;
+  fs["D2"] >> d2;
+  fs["R"] >> r;
+  fs["T"] >> t;
+  fs["width"] >> width;
+  fs["height"] >> height;
+  if (m1.empty() || m2.empty() || r.empty() || t.empty() || width <= 0 ||
+      height <= 0) {
+    fprintf(stderr, "Stereo calibration %s is incomplete\n", path);
+    return -1;
+  }
+
+  // Everything below works on doubles
+  m1.convertTo(m1, CV_64F);
+  m2.convertTo(m2, CV_64F);
+  r.convertTo(r, CV_64F);
+  t.convertTo(t, CV_64F);
+  if (!d1.empty())
+    d1.convertTo(d1, CV_64F);
+  if (!d2.empty())
+    d2.convertTo(d2, CV_64F);
+  return 0;
+}
+
+int StereoCalibration::save(const char *path) const {
+  cv::FileStorage fs;
+
+  if (!fs.open(path, cv::FileStorage::WRITE)) {
+    fprintf(stderr, "Cannot write stereo calibration %s\n", path);
+    return -1;
+  }
+
+  fs << "width" << width << "height" << height;
+  fs << "M1" << m1 << "D1" << d1;
+  fs << "M2" << m2 << "D2" << d2;
+  fs << "R" << r << "T" << t;
+  return 0;
+}
+
+static uint32_t crc_mat(uint32_t crc, const cv::Mat &m) {
+  cv::Mat c = m.isContinuous() ? m : m.clone();
+  return c.empty() ? crc : crc32_update(crc, c.data, c.total() * c.elemSize());
+}
+
+uint32_t StereoCalibration::fingerprint() const {
+  int32_t size[2] = {width, height};
+  uint32_t crc = crc32_update(0, size, sizeof(size));
+
+  crc = crc_mat(crc, m1);
+  crc = crc_mat(crc, d1);
+  crc = crc_mat(crc, m2);
+  crc = crc_mat(crc, d2);
+  crc = crc_mat(crc, r);
+  return crc_mat(crc, t);
+}
+
+void StereoCalibration::build_maps(int w, int h, StereoMaps *maps) const {
+  double sx = (double)w / width;
+  double sy = (double)h / height;
+  cv::Size size(w, h);
+  cv::Mat s1 = m1.clone(), s2 = m2.clone();
+  cv::Mat r1, r2, p1, p2, q;
+
+  s1.at<double>(0, 0) *= sx;
+  s1.at<double>(0, 2) *= sx;
+  s1.at<double>(1, 1) *= sy;
+  s1.at<double>(1, 2) *= sy;
+  s2.at<double>(0, 0) *= sx;
+  s2.at<double>(0, 2) *= sx;
+  s2.at<double>(1, 1) *= sy;
+  s2.at<double>(1, 2) *= sy;
+
+  cv::stereoRectify(s1, d1, s2, d2, size, r, t, r1, r2, p1, p2, q,
+                    cv::CALIB_ZERO_DISPARITY, 0, size);
+  cv::initUndistortRectifyMap(s1, d1, r1, p1, size, CV_16SC2, maps->left1,
+                              maps->left2);
+  cv::initUndistortRectifyMap(s2, d2, r2, p2, size, CV_16SC2, maps->right1,
+                              maps->right2);
+  maps->width = w;
+  maps->height = h;
+  maps->focal_px = p1.at<double>(0, 0);
+  maps->baseline_mm = fabs(p2.at<double>(0, 3) / p2.at<double>(0, 0));
+}
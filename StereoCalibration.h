@@ -0,0 +1,59 @@
+/**
+ * \file StereoCalibration.h
+ * Intrinsics and extrinsics of the camera pair, and the rectification
+ * tables derived from them.
+ */
+
+#ifndef STEREOCALIBRATION_H_
+#define STEREOCALIBRATION_H_
+
+#include <stdint.h>
+
+#include <opencv2/core.hpp>
+
+/// Rectification for one image size
+struct StereoMaps {
+  StereoMaps() : width(0), height(0), focal_px(0.0), baseline_mm(0.0) {}
+
+  int width;
+  int height;
+  cv::Mat left1, left2;  /// Fixed point remap tables, CV_16SC2 + CV_16UC1
+  cv::Mat right1, right2;
+  double focal_px;       /// Focal length after rectification
+  double baseline_mm;
+};
+
+struct StereoCalibration {
+  StereoCalibration() : width(0), height(0) {}
+
+  cv::Mat m1, d1;   /// Left camera matrix and distortion
+  cv::Mat m2, d2;   /// Right camera matrix and distortion
+  cv::Mat r, t;     /// Left to right rotation and translation, t in mm
+  int width;        /// Image size the calibration was measured at
+  int height;
+
+  /**
+   * Read an OpenCV FileStorage file (YAML or XML) with M1, D1, M2, D2, R,
+   * T, width and height
+   *
+   * @return 0 on success
+   */
+  int load(const char *path);
+
+  /** Write the same format. @return 0 on success */
+  int save(const char *path) const;
+
+  /**
+   * CRC-32 over the parameters, so a map cache can tell which calibration
+   * it was built from
+   */
+  uint32_t fingerprint() const;
+
+  /**
+   * Compute the rectification tables for an image size. Other sizes than
+   * the calibrated one are taken to be the same sensor area scaled.
+   */
+  void build_maps(int width, int height, StereoMaps *maps) const;
+};
+
+#endif /* STEREOCALIBRATION_H_ */
@@ -0,0 +1,279 @@
+#include "StereoDepth.h"
+
+#include <stdlib.h>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+void stereo_default_params(STEREO_PARAMS *params) {
+  params->calibration = NULL;
+  params->map_cache = NULL;
+  params->threads = 2;
+  params->max_skew_ms = 1000;
+  params->num_disparities = 64;
+  params->block_size = 15;
+  params->sgbm = false;
+}
+
+StereoDepth::StereoDepth(const STEREO_PARAMS &params, Handler handler)
+    : params_(params), handler_(handler), calibrated_(false),
+      running_(false), first_us_(0), last_us_(0), paired_(0), processed_(0),
+      dropped_(0), failed_(0), decode_("stereo decode"),
+      rectify_("stereo rectify"), match_("stereo match"),
+      depth_("stereo depth"), output_("stereo output"), busy_("stereo busy"),
+      latency_("stereo latency") {
+  pending_us_[0] = pending_us_[1] = 0;
+  if (params_.threads < 1)
+    params_.threads = 1;
+  // The matchers insist on these
+  params_.num_disparities = (params_.num_disparities + 15) / 16 * 16;
+  if (params_.num_disparities < 16)
+    params_.num_disparities = 16;
+  params_.block_size |= 1;
+  if (params_.block_size < 5)
+    params_.block_size = 5;
+}
+
+StereoDepth::~StereoDepth() {
+  {
+    std::lock_guard<std::mutex> guard(queue_lock_);
+    running_ = false;
+  }
+  queue_ready_.notify_all();
+  for (auto &worker : workers_)
+    worker.join();
+}
+
+int StereoDepth::open() {
+  int64_t start = monotonic_us();
+  bool cached = false;
+  int i;
+
+  if (params_.calibration) {
+    if (calibration_.load(params_.calibration) != 0)
+      return -1;
+    calibrated_ = true;
+  }
+  if (params_.map_cache && cache_.open(params_.map_cache) == 0) {
+    if (calibrated_ && cache_.calibration() != calibration_.fingerprint())
+      fprintf(stderr, "Stereo maps %s are from another calibration, "
+              "ignoring them\n", params_.map_cache);
+    else
+      cached = true;
+  }
+  if (cached)
+    fprintf(stderr, "Stereo maps for %dx%d mapped in %lld ms\n",
+            cache_.width(), cache_.height(),
+            (long long)(monotonic_us() - start) / 1000);
+  if (!calibrated_ && !cached) {
+    fprintf(stderr, "No stereo calibration or maps\n");
+    return -1;
+  }
+  if (!cached)
+    cache_.close();
+
+  // Parallelism comes from the pool, OpenCV's own threads would only
+  // compete with it and blur the per-stage timings
+  cv::setNumThreads(1);
+
+  running_ = true;
+  for (i = 0; i < params_.threads; i++)
+    workers_.push_back(std::thread(&StereoDepth::run, this));
+  return 0;
+}
+
+void StereoDepth::submit(uint32_t camera, const FramePtr &frame,
+                         int64_t arrival_us) {
+  uint32_t other = camera == CAMERA_LEFT ? CAMERA_RIGHT : CAMERA_LEFT;
+  Pair pair;
+
+  if (camera != CAMERA_LEFT && camera != CAMERA_RIGHT)
+    return;
+
+  {
+    std::lock_guard<std::mutex> guard(pair_lock_);
+
+    // Newest frame per side wins, an unmatched older one is just replaced
+    pending_[camera] = frame;
+    pending_us_[camera] = arrival_us;
+    if (!pending_[other] ||
+        llabs(arrival_us - pending_us_[other]) >
+            (int64_t)params_.max_skew_ms * 1000)
+      return;
+
+    pair.left = pending_[CAMERA_LEFT];
+    pair.right = pending_[CAMERA_RIGHT];
+    pair.paired_us = monotonic_us();
+    pending_[CAMERA_LEFT].reset();
+    pending_[CAMERA_RIGHT].reset();
+    if (!first_us_)
+      first_us_ = pair.paired_us;
+  }
+
+  paired_++;
+
+  {
+    std::lock_guard<std::mutex> guard(queue_lock_);
+    // One waiting pair per worker at most, older ones are stale anyway
+    while (queue_.size() >= (size_t)params_.threads) {
+      queue_.pop_front();
+      dropped_++;
+    }
+    queue_.push_back(pair);
+  }
+  queue_ready_.notify_one();
+}
+
+/**
+ * Rectification tables for one image size. Built by the first worker that
+ * needs them, every later pair of that size shares them.
+ */
+StereoDepth::MapsPtr StereoDepth::maps_for(int width, int height) {
+  std::lock_guard<std::mutex> guard(maps_lock_);
+  MapsPtr &slot = maps_[std::make_pair(width, height)];
+
+  if (slot)
+    return slot;
+
+  int64_t start = monotonic_us();
+  std::shared_ptr<StereoMaps> maps = std::make_shared<StereoMaps>();
+
+  if (!cache_.get(width, height, maps.get())) {
+    if (!calibrated_) {
+      fprintf(stderr, "No stereo maps for %dx%d\n", width, height);
+      return MapsPtr();
+    }
+    calibration_.build_maps(width, height, maps.get());
+    fprintf(stderr, "Stereo maps for %dx%d built in %lld ms\n", width,
+            height, (long long)(monotonic_us() - start) / 1000);
+  }
+
+  slot = maps;
+  return slot;
+}
+
+/**
+ * Decode, rectify, match and convert one pair
+ *
+ * @return 0 on success, -1 if the pair was unusable
+ */
+int StereoDepth::process(const Pair &pair,
+                         cv::Ptr<cv::StereoMatcher> &matcher) {
+  int64_t start = monotonic_us();
+  int64_t t0 = start, t1;
+  cv::Mat left, right, left_rect, right_rect;
+  Result result;
+  int x, y;
+
+  left = cv::imdecode(cv::Mat(1, pair.left->data.size(), CV_8U,
+                              pair.left->data.data()),
+                      cv::IMREAD_GRAYSCALE);
+  right = cv::imdecode(cv::Mat(1, pair.right->data.size(), CV_8U,
+                               pair.right->data.data()),
+                       cv::IMREAD_GRAYSCALE);
+  if (left.empty() || right.empty() || left.size() != right.size()) {
+    fprintf(stderr, "Stereo pair %u/%u unusable\n", pair.left->number,
+            pair.right->number);
+    return -1;
+  }
+  t1 = monotonic_us();
+  decode_.add(t1 - t0);
+
+  MapsPtr maps = maps_for(left.cols, left.rows);
+  if (!maps)
+    return -1;
+  t0 = monotonic_us();
+  cv::remap(left, left_rect, maps->left1, maps->left2, cv::INTER_LINEAR);
+  cv::remap(right, right_rect, maps->right1, maps->right2, cv::INTER_LINEAR);
+  t1 = monotonic_us();
+  rectify_.add(t1 - t0);
+
+  t0 = t1;
+  matcher->compute(left_rect, right_rect, result.disparity);
+  t1 = monotonic_us();
+  match_.add(t1 - t0);
+
+  // depth = f * B / d, d has 4 fractional bits
+  t0 = t1;
+  double scale = maps->focal_px * maps->baseline_mm * 16.0;
+  result.depth_mm.create(result.disparity.size(), CV_16U);
+  for (y = 0; y < result.disparity.rows; y++) {
+    const int16_t *d = result.disparity.ptr<int16_t>(y);
+    uint16_t *z = result.depth_mm.ptr<uint16_t>(y);
+
+    for (x = 0; x < result.disparity.cols; x++) {
+      double mm = d[x] > 0 ? scale / d[x] : 0.0;
+      z[x] = mm < 65535.0 ? (uint16_t)mm : 65535;
+    }
+  }
+  t1 = monotonic_us();
+  depth_.add(t1 - t0);
+
+  result.left_number = pair.left->number;
+  result.right_number = pair.right->number;
+  result.paired_us = pair.paired_us;
+  t0 = t1;
+  handler_(result);
+  t1 = monotonic_us();
+  output_.add(t1 - t0);
+
+  busy_.add(t1 - start);
+  latency_.add(t1 - pair.paired_us);
+  last_us_ = t1;
+  return 0;
+}
+
+void StereoDepth::run() {
+  cv::Ptr<cv::StereoMatcher> matcher;
+
+  // Matchers keep scratch buffers, so one per worker
+  if (params_.sgbm)
+    matcher = cv::StereoSGBM::create(
+        0, params_.num_disparities, params_.block_size,
+        8 * params_.block_size * params_.block_size,
+        32 * params_.block_size * params_.block_size);
+  else
+    matcher = cv::StereoBM::create(params_.num_disparities,
+                                   params_.block_size);
+
+  while (1) {
+    Pair pair;
+
+    {
+      std::unique_lock<std::mutex> guard(queue_lock_);
+      queue_ready_.wait(guard, [this] { return !running_ || !queue_.empty(); });
+      if (!running_)
+        break;
+      pair = queue_.front();
+      queue_.pop_front();
+    }
+
+    if (process(pair, matcher) == 0)
+      processed_++;
+    else
+      failed_++;
+  }
+}
+
+void StereoDepth::report(FILE *out) const {
+  int64_t elapsed = last_us_ - first_us_;
+  int64_t busy = busy_.percentile(50);
+
+  fprintf(out,
+          "stereo: %llu pairs, %llu processed, %llu dropped, %llu failed\n",
+          (unsigned long long)paired_, (unsigned long long)processed_,
+          (unsigned long long)dropped_, (unsigned long long)failed_);
+  decode_.report(out);
+  rectify_.report(out);
+  match_.report(out);
+  depth_.report(out);
+  output_.report(out);
+  busy_.report(out);
+  latency_.report(out);
+  if (processed_ > 1 && elapsed > 0)
+    fprintf(out, "stereo: %.2f pairs/s achieved\n",
+            (processed_ - 1) * 1e6 / elapsed);
+  if (busy > 0)
+    fprintf(out, "stereo: ceiling %.2f pairs/s with %d threads\n",
+            params_.threads * 1e6 / busy, params_.threads);
+}
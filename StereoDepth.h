@@ -0,0 +1,147 @@
+/**
+ * \file StereoDepth.h
+ * Depth maps from the left/right camera pair.
+ *
+ * submit() takes encoded frames from either camera and pairs the newest
+ * left with the newest right frame if they arrived close enough together.
+ * Pairs go to a small pool of worker threads, each of which decodes both
+ * images, rectifies them with remap tables that are computed once per image
+ * size and shared, runs block matching and converts the disparity to depth.
+ * If the workers fall behind, the oldest waiting pair is dropped, so the
+ * output never lags the cameras by more than one pair per worker.
+ */
+
+#ifndef STEREODEPTH_H_
+#define STEREODEPTH_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <opencv2/calib3d.hpp>
+
+#include "Frame.h"
+#include "Stats.h"
+#include "StereoCalibration.h"
+#include "StereoMapCache.h"
+
+typedef struct {
+  const char *calibration; /// Stereo calibration, see StereoDepth::open()
+  const char *map_cache;   /// Prebuilt tables from stereocalib, or NULL
+  int threads;             /// Worker threads
+  int max_skew_ms;         /// Largest arrival gap between paired frames
+  int num_disparities;     /// Disparity search range, multiple of 16
+  int block_size;          /// Matching window, odd
+  bool sgbm;               /// Semi-global matching instead of block matching
+} STEREO_PARAMS;
+
+/** Default parameters, block matching on two threads */
+void stereo_default_params(STEREO_PARAMS *params);
+
+class StereoDepth {
+public:
+  struct Result {
+    uint32_t left_number;  /// Frame numbers of the pair
+    uint32_t right_number;
+    int64_t paired_us;     /// Monotonic time the pair was formed
+    cv::Mat disparity;     /// CV_16S, 4 fractional bits, rectified left view
+    cv::Mat depth_mm;      /// CV_16U, 0 where there is no match
+  };
+
+  /** Called on a worker thread for every finished pair */
+  typedef std::function<void(const Result &result)> Handler;
+
+  StereoDepth(const STEREO_PARAMS &params, Handler handler);
+  ~StereoDepth();
+
+  /**
+   * Load the calibration and the map cache, and start the workers.
+   *
+   * The calibration is a file as written by StereoCalibration::save(). The
+   * map cache provides ready tables for its image size; a cache built from
+   * another calibration than the one given is ignored. Either one alone is
+   * enough, but without a calibration only the cached size can be used.
+   *
+   * @return 0 on success
+   */
+  int open();
+
+  /**
+   * Offer a frame for pairing. Never blocks on the workers.
+   *
+   * @param camera CAMERA_LEFT or CAMERA_RIGHT
+   * @param frame Encoded image
+   * @param arrival_us Monotonic time the frame arrived
+   */
+  void submit(uint32_t camera, const FramePtr &frame, int64_t arrival_us);
+
+  /** Print pair counts, per-stage timings and the throughput ceiling */
+  void report(FILE *out) const;
+
+  uint64_t paired() const { return paired_; }
+  uint64_t processed() const { return processed_; }
+  uint64_t dropped() const { return dropped_; }
+  uint64_t failed() const { return failed_; }
+
+private:
+  struct Pair {
+    FramePtr left;
+    FramePtr right;
+    int64_t paired_us;
+  };
+
+  /// Immutable once built
+  typedef std::shared_ptr<const StereoMaps> MapsPtr;
+
+  MapsPtr maps_for(int width, int height);
+  void run();
+  int process(const Pair &pair, cv::Ptr<cv::StereoMatcher> &matcher);
+
+  STEREO_PARAMS params_;
+  Handler handler_;
+
+  // Read only after open()
+  bool calibrated_;
+  StereoCalibration calibration_;
+  StereoMapCache cache_;
+
+  std::mutex maps_lock_;
+  std::map<std::pair<int, int>, MapsPtr> maps_;
+
+  // Pairing state, under pair_lock_
+  std::mutex pair_lock_;
+  FramePtr pending_[2];
+  int64_t pending_us_[2];
+
+  std::mutex queue_lock_;
+  std::condition_variable queue_ready_;
+  std::deque<Pair> queue_;
+  bool running_;
+  std::vector<std::thread> workers_;
+
+  std::atomic<int64_t> first_us_; /// First pair formed
+  std::atomic<int64_t> last_us_;  /// Last pair finished
+  std::atomic<uint64_t> paired_;
+  std::atomic<uint64_t> processed_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<uint64_t> failed_;
+  LatencyStats decode_;    /// Both JPEG decodes
+  LatencyStats rectify_;   /// Both remaps, excluding building the tables
+  LatencyStats match_;     /// Disparity search
+  LatencyStats depth_;     /// Disparity to depth conversion
+  LatencyStats output_;    /// Handler
+  LatencyStats busy_;      /// Worker time per pair, all stages
+  LatencyStats latency_;   /// Pair formed to handler done
+};
+
+#endif /* STEREODEPTH_H_ */
@@ -0,0 +1,158 @@
+#include "StereoMapCache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "FrameLink.h"
+#include "Publisher.h"
+
+/** Element type of each table, in file order */
+static const int table_types[STEREO_MAP_TABLES] = {CV_16SC2, CV_16UC1,
+                                                   CV_16SC2, CV_16UC1};
+
+static uint32_t header_crc(const STEREO_MAP_HEADER *header) {
+  return crc32_update(0, header, offsetof(STEREO_MAP_HEADER, crc));
+}
+
+int stereo_map_write(const char *path, const StereoMaps &maps,
+                     uint32_t calibration) {
+  const cv::Mat *tables[STEREO_MAP_TABLES] = {&maps.left1, &maps.left2,
+                                              &maps.right1, &maps.right2};
+  static const uint8_t padding[STEREO_MAP_ALIGN] = {0};
+  STEREO_MAP_HEADER header;
+  // Full sync, this file is meant to survive power loss
+  FilePublisher out(path, PUBLISH_SYNC_FULL);
+  uint64_t offset;
+  int i;
+
+  memset(&header, 0, sizeof(header));
+  header.magic = STEREO_MAP_MAGIC;
+  header.version = STEREO_MAP_VERSION;
+  header.header_size = sizeof(header);
+  header.calibration = calibration;
+  header.width = maps.width;
+  header.height = maps.height;
+  header.focal_px = maps.focal_px;
+  header.baseline_mm = maps.baseline_mm;
+
+  offset = sizeof(header);
+  for (i = 0; i < STEREO_MAP_TABLES; i++) {
+    const cv::Mat &m = *tables[i];
+
+    if (m.type() != table_types[i] || m.cols != maps.width ||
+        m.rows != maps.height || !m.isContinuous()) {
+      fprintf(stderr, "Stereo map table %d has the wrong shape\n", i);
+      return -1;
+    }
+    offset = (offset + STEREO_MAP_ALIGN - 1) & ~(uint64_t)(STEREO_MAP_ALIGN - 1);
+    header.offset[i] = offset;
+    header.size[i] = m.total() * m.elemSize();
+    offset += header.size[i];
+  }
+  header.crc = header_crc(&header);
+
+  if (out.begin() != 0 || out.append(&header, sizeof(header)) != 0)
+    return -1;
+  offset = sizeof(header);
+  for (i = 0; i < STEREO_MAP_TABLES; i++) {
+    if (out.append(padding, header.offset[i] - offset) != 0 ||
+        out.append(tables[i]->data, header.size[i]) != 0)
+      return -1;
+    offset = header.offset[i] + header.size[i];
+  }
+  return out.commit();
+}
+
+StereoMapCache::StereoMapCache() : base_(MAP_FAILED), length_(0) {
+  memset(&header_, 0, sizeof(header_));
+}
+
+StereoMapCache::~StereoMapCache() { close(); }
+
+void StereoMapCache::close() {
+  if (base_ != MAP_FAILED)
+    munmap(base_, length_);
+  base_ = MAP_FAILED;
+  length_ = 0;
+}
+
+int StereoMapCache::open(const char *path) {
+  struct stat st;
+  int i;
+
+  close();
+
+  int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot open stereo maps %s: %s\n", path,
+            strerror(errno));
+    return -1;
+  }
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(header_)) {
+    fprintf(stderr, "Stereo maps %s are truncated\n", path);
+    ::close(fd);
+    return -1;
+  }
+
+  length_ = st.st_size;
+  base_ = mmap(NULL, length_, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (base_ == MAP_FAILED) {
+    fprintf(stderr, "Cannot map stereo maps %s: %s\n", path, strerror(errno));
+    length_ = 0;
+    return -1;
+  }
+
+  memcpy(&header_, base_, sizeof(header_));
+  if (header_.magic != STEREO_MAP_MAGIC ||
+      header_.version != STEREO_MAP_VERSION ||
+      header_.header_size != sizeof(header_) ||
+      header_.crc != header_crc(&header_)) {
+    fprintf(stderr, "Stereo maps %s are from another version or corrupt\n",
+            path);
+    close();
+    return -1;
+  }
+
+  for (i = 0; i < STEREO_MAP_TABLES; i++) {
+    uint64_t expected = (uint64_t)header_.width * header_.height *
+                        CV_ELEM_SIZE(table_types[i]);
+
+    if (header_.size[i] != expected ||
+        header_.offset[i] % STEREO_MAP_ALIGN != 0 ||
+        header_.offset[i] + header_.size[i] > length_) {
+      fprintf(stderr, "Stereo maps %s are truncated\n", path);
+      close();
+      return -1;
+    }
+  }
+
+  // remap() walks the tables front to back, start reading them in now
+  madvise(base_, length_, MADV_WILLNEED);
+  return 0;
+}
+
+bool StereoMapCache::get(int width, int height, StereoMaps *maps) const {
+  cv::Mat *tables[STEREO_MAP_TABLES] = {&maps->left1, &maps->left2,
+                                        &maps->right1, &maps->right2};
+  int i;
+
+  if (base_ == MAP_FAILED || (uint32_t)width != header_.width ||
+      (uint32_t)height != header_.height)
+    return false;
+
+  // The mapping is read only, remap() never writes to its tables
+  for (i = 0; i < STEREO_MAP_TABLES; i++)
+    *tables[i] = cv::Mat(height, width, table_types[i],
+                         (uint8_t *)base_ + header_.offset[i]);
+  maps->width = width;
+  maps->height = height;
+  maps->focal_px = header_.focal_px;
+  maps->baseline_mm = header_.baseline_mm;
+  return true;
+}
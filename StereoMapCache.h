@@ -0,0 +1,88 @@
+/**
+ * \file StereoMapCache.h
+ * Rectification tables stored ready to use.
+ *
+ * Building the remap tables takes seconds on a Pi. stereocalib writes them
+ * once into a binary file; dashgrab maps that file and points cv::Mat
+ * headers straight at it, so nothing is computed or copied at startup and
+ * the pages are only read in as remap() touches them.
+ *
+ * Layout: a STEREO_MAP_HEADER, then the four tables (left1, left2, right1,
+ * right2) at the offsets it gives, each aligned to STEREO_MAP_ALIGN. All
+ * values are little endian, as on both x86 and the Pi.
+ */
+
+#ifndef STEREOMAPCACHE_H_
+#define STEREOMAPCACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "StereoCalibration.h"
+
+#define STEREO_MAP_MAGIC 0x4d534344 /* "DCSM" */
+#define STEREO_MAP_VERSION 1
+#define STEREO_MAP_ALIGN 64
+#define STEREO_MAP_TABLES 4
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t calibration;  /// StereoCalibration::fingerprint() of the source
+  uint32_t width;
+  uint32_t height;
+  double focal_px;
+  double baseline_mm;
+  uint64_t offset[STEREO_MAP_TABLES];
+  uint64_t size[STEREO_MAP_TABLES];
+  uint32_t reserved;
+  uint32_t crc;          /// CRC-32 of the header up to here
+} STEREO_MAP_HEADER;
+
+/**
+ * Write tables to path, atomically replacing any existing file
+ *
+ * @param maps Tables as built by StereoCalibration::build_maps()
+ * @param calibration Fingerprint of the calibration they came from
+ * @return 0 on success
+ */
+int stereo_map_write(const char *path, const StereoMaps &maps,
+                     uint32_t calibration);
+
+class StereoMapCache {
+public:
+  StereoMapCache();
+  ~StereoMapCache();
+
+  /**
+   * Map a cache file and check its header. The tables are not read.
+   *
+   * @return 0 on success, -1 if the file is missing, truncated, from
+   * another version or corrupt
+   */
+  int open(const char *path);
+
+  /**
+   * Tables for one size, as Mat headers over the mapping
+   *
+   * @return true if the cache holds this size. The Mats are only valid
+   * while the cache is alive.
+   */
+  bool get(int width, int height, StereoMaps *maps) const;
+
+  /** Unmap the file, get() finds nothing after this */
+  void close();
+
+  /** Fingerprint of the calibration the tables were built from */
+  uint32_t calibration() const { return header_.calibration; }
+  int width() const { return header_.width; }
+  int height() const { return header_.height; }
+
+private:
+  void *base_;
+  size_t length_;
+  STEREO_MAP_HEADER header_;
+};
+
+#endif /* STEREOMAPCACHE_H_ */
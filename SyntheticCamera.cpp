@@ -0,0 +1,319 @@
+#include "SyntheticCamera.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "Trace.h"
+
+/// Output chunk size, the JPEG encoder's buffer size on the Pi
+#define SYNTHETIC_CHUNK_BYTES 81920
+
+SyntheticCamera::SyntheticCamera(const CAMERA_PARAMS &params,
+                                 const Handlers &handlers, int fps,
+                                 const char *replay_dir)
+    : CameraBackend(params, handlers), fps_(fps),
+      replay_dir_(replay_dir ? replay_dir : ""), current_(0), current_us_(0),
+      pending_(0), requested_us_(0), capture_frame_(0),
+      capture_timestamp_us_(0), exposure_us_(0), running_(false),
+      frames_running_(false), frames_(0), late_(0),
+      encode_("synthetic encode"), output_("synthetic output") {
+  sem_init(&complete_, 0, 0);
+}
+
+SyntheticCamera::~SyntheticCamera() {
+  stop_frames();
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    running_ = false;
+  }
+  wake_.notify_all();
+  if (output_thread_.joinable())
+    output_thread_.join();
+  sem_destroy(&complete_);
+}
+
+static bool is_jpeg(const char *name) {
+  const char *ext = strrchr(name, '.');
+
+  return ext && (!strcasecmp(ext, ".jpg") || !strcasecmp(ext, ".jpeg"));
+}
+
+/**
+ * Read every JPEG in the replay directory, keeping both the file and its
+ * luma plane so neither is decoded or read again while running
+ *
+ * @return 0 if at least one file was loaded
+ */
+int SyntheticCamera::load_replay() {
+  std::vector<std::string> names;
+  DIR *dir = opendir(replay_dir_.c_str());
+  struct dirent *entry;
+
+  if (!dir) {
+    fprintf(stderr, "Cannot open replay directory %s: %s\n",
+            replay_dir_.c_str(), strerror(errno));
+    return -1;
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    if (is_jpeg(entry->d_name))
+      names.push_back(replay_dir_ + "/" + entry->d_name);
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+
+  for (size_t i = 0; i < names.size(); i++) {
+    FILE *f = fopen(names[i].c_str(), "rb");
+    std::vector<uint8_t> jpeg;
+    uint8_t buf[65536];
+    size_t n;
+
+    if (!f) {
+      fprintf(stderr, "Cannot read %s: %s\n", names[i].c_str(),
+              strerror(errno));
+      continue;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+      jpeg.insert(jpeg.end(), buf, buf + n);
+    fclose(f);
+
+    cv::Mat y = cv::imdecode(cv::Mat(jpeg), cv::IMREAD_GRAYSCALE);
+    if (y.empty()) {
+      fprintf(stderr, "%s is not a JPEG, skipped\n", names[i].c_str());
+      continue;
+    }
+    replay_y_.push_back(y);
+    replay_jpeg_.push_back(jpeg);
+  }
+
+  if (replay_y_.empty()) {
+    fprintf(stderr, "No JPEG files in %s\n", replay_dir_.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+int SyntheticCamera::open() {
+  char text[256];
+
+  if (params_.record_dir) {
+    fprintf(stderr, "Recording needs the mmal camera\n");
+    return -1;
+  }
+
+  if (!replay_dir_.empty()) {
+    if (load_replay() != 0)
+      return -1;
+    snprintf(text, sizeof(text), "replay of %d files from %s, %d fps",
+             (int)replay_y_.size(), replay_dir_.c_str(), fps_);
+  } else {
+    // Fixed noise, so the JPEG costs about as much as a real scene
+    background_.create(params_.video_height, params_.video_width, CV_8UC1);
+    cv::randu(background_, cv::Scalar(0), cv::Scalar(256));
+    snprintf(text, sizeof(text), "synthetic %dx%d, %d fps",
+             params_.video_width, params_.video_height, fps_);
+  }
+  description_ = text;
+
+  running_ = true;
+  output_thread_ = std::thread(&SyntheticCamera::run_output, this);
+  if (fps_ > 0) {
+    frames_running_ = true;
+    frame_thread_ = std::thread(&SyntheticCamera::run_frames, this);
+  }
+  return 0;
+}
+
+/**
+ * Draw frame n of the test pattern: a block crossing the noise, small
+ * enough to stay under the default motion threshold
+ */
+void SyntheticCamera::render(uint64_t n, cv::Mat *y) const {
+  int size = background_.rows / 8;
+  int x = (int)((n * 8) % (uint64_t)(background_.cols - size));
+
+  background_.copyTo(*y);
+  cv::rectangle(*y, cv::Rect(x, (background_.rows - size) / 2, size, size),
+                cv::Scalar(255), cv::FILLED);
+}
+
+void SyntheticCamera::run_frames() {
+  int64_t period_us = 1000000 / fps_;
+  int64_t next_us = monotonic_us();
+  uint64_t n = 0;
+  cv::Mat y, chroma;
+
+  while (frames_running_) {
+    if (!replay_y_.empty())
+      y = replay_y_[n % replay_y_.size()];
+    else
+      render(n, &y);
+
+    int64_t frame_us = monotonic_us();
+    if (handlers_.frame)
+      handlers_.frame(y.data, y.cols, y.rows, (int)y.step, frame_us);
+    if (handlers_.yuv) {
+      // Grey chroma, the pattern and the replays are luma only
+      if (chroma.cols != y.cols / 2 || chroma.rows != y.rows / 2)
+        chroma = cv::Mat(y.rows / 2, y.cols / 2, CV_8UC1, cv::Scalar(128));
+      CAMERA_YUV yuv;
+      yuv.y = y.data;
+      yuv.u = yuv.v = chroma.data;
+      yuv.width = y.cols & ~1;
+      yuv.height = y.rows & ~1;
+      yuv.y_stride = (int)y.step;
+      yuv.uv_stride = (int)chroma.step;
+      yuv.arrival_us = frame_us;
+      handlers_.yuv(yuv);
+    }
+    frames_++;
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      current_ = n;
+      current_us_ = frame_us;
+    }
+    // A still waiting for a fresh exposure may now go
+    wake_.notify_one();
+    n++;
+
+    // A late frame is skipped rather than sent in a burst, like a sensor
+    next_us += period_us;
+    int64_t now = monotonic_us();
+    if (next_us <= now) {
+      late_++;
+      next_us = now;
+      continue;
+    }
+    struct timespec ts;
+    ts.tv_sec = next_us / 1000000;
+    ts.tv_nsec = (next_us % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+      ;
+  }
+}
+
+/**
+ * Encode the test pattern as it looks in the latest frame, at still size
+ */
+void SyntheticCamera::encode(cv::Mat *y, std::vector<uint8_t> *jpeg) {
+  std::vector<int> options;
+
+  if (y->cols != params_.width || y->rows != params_.height)
+    cv::resize(*y, *y, cv::Size(params_.width, params_.height));
+  options.push_back(cv::IMWRITE_JPEG_QUALITY);
+  options.push_back(params_.quality);
+  cv::imencode(".jpg", *y, *jpeg, options);
+}
+
+void SyntheticCamera::run_output() {
+  std::vector<uint8_t> encoded;
+  cv::Mat y;
+
+  while (1) {
+    const std::vector<uint8_t> *jpeg = &encoded;
+    CAMERA_OUTPUT chunk;
+    uint64_t n;
+    {
+      std::unique_lock<std::mutex> guard(lock_);
+      // Without zero shutter lag a still is exposed after it is asked for,
+      // so it takes the first frame made after the request. With it, the
+      // latest frame is used as it is.
+      wake_.wait(guard, [this] {
+        return (pending_ > 0 && (params_.zsl || !frames_running_ ||
+                                 current_us_ >= requested_us_)) ||
+               !running_;
+      });
+      if (!running_)
+        break;
+      // The stills of a burst go out back to back
+      chunk.burst_index = params_.burst - pending_;
+      pending_--;
+      requested_us_ = monotonic_us();
+      n = current_;
+      chunk.pts_us = current_us_;
+      if (chunk.burst_index == 0)
+        exposure_us_ = current_us_;
+      chunk.frame = capture_frame_ + chunk.burst_index;
+      chunk.timestamp_us = capture_timestamp_us_;
+    }
+    if (chunk.burst_index) {
+      chunk.timestamp_us = wallclock_us();
+      trace_event(TRACE_INSTANT, "capture issued", chunk.frame);
+    }
+
+    int64_t start = monotonic_us();
+    if (!replay_jpeg_.empty()) {
+      jpeg = &replay_jpeg_[n % replay_jpeg_.size()];
+    } else {
+      render(n, &y);
+      encode(&y, &encoded);
+    }
+    int64_t encoded_us = monotonic_us();
+    encode_.add(encoded_us - start);
+
+    // Same chunking as the encoder port, so handlers see real call counts
+    size_t offset = 0;
+    do {
+      chunk.data = jpeg->data() + offset;
+      chunk.length = std::min((size_t)SYNTHETIC_CHUNK_BYTES,
+                              jpeg->size() - offset);
+      offset += chunk.length;
+      chunk.flags = offset == jpeg->size() ? CAMERA_OUTPUT_FRAME_END : 0;
+      if (chunk.data == jpeg->data())
+        trace_event(TRACE_INSTANT, "first encoder buffer", chunk.frame);
+      if (chunk.flags & CAMERA_OUTPUT_FRAME_END)
+        trace_event(TRACE_INSTANT, "frame end buffer", chunk.frame);
+      handlers_.output(chunk);
+    } while (offset < jpeg->size());
+    output_.add(monotonic_us() - encoded_us);
+
+    sem_post(&complete_);
+  }
+}
+
+int SyntheticCamera::capture(uint32_t frame, int64_t timestamp_us) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    pending_ = params_.burst;
+    requested_us_ = monotonic_us();
+    capture_frame_ = frame;
+    capture_timestamp_us_ = timestamp_us;
+  }
+  trace_event(TRACE_INSTANT, "capture issued", frame);
+  wake_.notify_one();
+  return 0;
+}
+
+void SyntheticCamera::wait_capture() {
+  for (int i = 0; i < params_.burst; i++) {
+    while (sem_wait(&complete_) != 0 && errno == EINTR)
+      ;
+  }
+}
+
+void SyntheticCamera::stop_frames() {
+  // Under the lock, or a capture waiting for the next frame can miss it
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    frames_running_ = false;
+  }
+  wake_.notify_all();
+  if (frame_thread_.joinable())
+    frame_thread_.join();
+}
+
+void SyntheticCamera::report(FILE *out) const {
+  fprintf(out, "Camera %s: %" PRIu64 " frames, %" PRIu64 " late\n",
+          description_.c_str(), frames_.load(), late_.load());
+  encode_.report(out);
+  output_.report(out);
+}
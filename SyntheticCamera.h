@@ -0,0 +1,84 @@
+/**
+ * \file SyntheticCamera.h
+ * A camera without a camera, for running the capture path on a workstation.
+ *
+ * A frame thread produces luma frames at a fixed rate, either a generated
+ * test pattern or JPEG files replayed from a directory, and passes them to
+ * the frame handler exactly as the video port would. Stills are encoded on
+ * an output thread (replayed files are passed through as they are) and
+ * delivered in encoder-sized chunks, so the trigger, output, network and
+ * storage stages see the same calls and threading as on the Pi.
+ */
+
+#ifndef SYNTHETICCAMERA_H_
+#define SYNTHETICCAMERA_H_
+
+#include <semaphore.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "CameraBackend.h"
+#include "Stats.h"
+
+class SyntheticCamera : public CameraBackend {
+public:
+  /**
+   * @param fps Raw frame rate, 0 for no raw frames
+   * @param replay_dir Directory of JPEG files to replay, NULL to generate
+   */
+  SyntheticCamera(const CAMERA_PARAMS &params, const Handlers &handlers,
+                  int fps, const char *replay_dir);
+  ~SyntheticCamera();
+
+  int open();
+  int capture(uint32_t frame, int64_t timestamp_us);
+  void wait_capture();
+  int64_t last_exposure_us() const { return exposure_us_; }
+  void stop_frames();
+  void report(FILE *out) const;
+  const char *describe() const { return description_.c_str(); }
+
+private:
+  int load_replay();
+  void render(uint64_t n, cv::Mat *y) const;
+  void run_frames();
+  void run_output();
+  void encode(cv::Mat *y, std::vector<uint8_t> *jpeg);
+
+  int fps_;
+  std::string replay_dir_;
+  std::string description_;
+  std::vector<cv::Mat> replay_y_;                  /// Decoded replay frames
+  std::vector<std::vector<uint8_t> > replay_jpeg_; /// and the files as read
+  cv::Mat background_;                             /// Noise under the pattern
+
+  std::mutex lock_;
+  std::condition_variable wake_;
+  uint64_t current_;         /// Number of the latest frame, under lock_
+  int64_t current_us_;       /// When it was made, under lock_
+  int pending_;              /// Stills of the burst still to take, under lock_
+  int64_t requested_us_;     /// When the next of them was asked for
+  uint32_t capture_frame_;
+  int64_t capture_timestamp_us_;
+  std::atomic<int64_t> exposure_us_; /// Frame time of the first still
+  sem_t complete_;
+
+  std::atomic<bool> running_;
+  std::atomic<bool> frames_running_;
+  std::atomic<uint64_t> frames_; /// Frames passed to the frame handler
+  std::atomic<uint64_t> late_;   /// Frames the thread fell behind on
+  std::thread frame_thread_;
+  std::thread output_thread_;
+
+  LatencyStats encode_;  /// Frame grab to encoded still
+  LatencyStats output_;  /// Time in the output handler per still
+};
+
+#endif /* SYNTHETICCAMERA_H_ */
@@ -0,0 +1,197 @@
+#include "Trace.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/syscall.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Publisher.h"
+#include "Stats.h"
+
+/// Threads that can record, later ones are ignored
+#define TRACE_MAX_THREADS 64
+
+typedef struct {
+  int64_t timestamp_us;
+  const char *name;
+  uint32_t frame;
+  int16_t camera;
+  char phase;
+} TRACE_EVENT;
+
+/**
+ * One thread's events. Only the owning thread writes; head is published
+ * with release ordering after each event, so a reader sees complete events
+ * up to head.
+ */
+struct TraceRing {
+  explicit TraceRing(size_t size) : events(size), head(0) {}
+
+  std::vector<TRACE_EVENT> events;
+  std::atomic<uint64_t> head;
+  long tid;
+  char thread_name[16];
+};
+
+std::atomic<bool> trace_on(false);
+
+static size_t ring_size = TRACE_DEFAULT_EVENTS;
+static std::atomic<TraceRing *> rings[TRACE_MAX_THREADS];
+static std::atomic<int> ring_count(0);
+/// The calling thread's ring, NULL until its first event
+static thread_local TraceRing *my_ring = NULL;
+static thread_local bool no_ring = false;
+
+void trace_enable(size_t events) {
+  if (!trace_on) {
+    ring_size = events ? events : 1;
+    trace_on = true;
+  }
+}
+
+/** Set up the calling thread's ring, NULL if there are too many threads */
+static TraceRing *thread_ring() {
+  int index = ring_count.fetch_add(1);
+
+  if (index >= TRACE_MAX_THREADS) {
+    no_ring = true;
+    return NULL;
+  }
+
+  TraceRing *ring = new TraceRing(ring_size);
+  ring->tid = syscall(SYS_gettid);
+  if (pthread_getname_np(pthread_self(), ring->thread_name,
+                         sizeof(ring->thread_name)) != 0)
+    ring->thread_name[0] = 0;
+  // Never freed, the events outlive the thread for the dump
+  rings[index].store(ring, std::memory_order_release);
+  return ring;
+}
+
+void trace_record(char phase, const char *name, uint32_t frame, int camera,
+                  int64_t timestamp_us) {
+  TraceRing *ring = my_ring;
+
+  if (!ring) {
+    if (no_ring)
+      return;
+    ring = my_ring = thread_ring();
+    if (!ring)
+      return;
+  }
+
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  TRACE_EVENT *event = &ring->events[head % ring->events.size()];
+  event->timestamp_us = timestamp_us ? timestamp_us : monotonic_us();
+  event->name = name;
+  event->frame = frame;
+  event->camera = camera;
+  event->phase = phase;
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+static void append_event(std::string *json, const TRACE_EVENT &event,
+                         const TraceRing *ring, int pid) {
+  char text[320];
+  int n;
+
+  n = snprintf(text, sizeof(text),
+               ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRId64
+               ",\"pid\":%d,\"tid\":%ld",
+               event.name, event.phase, event.timestamp_us, pid, ring->tid);
+  if (event.phase == TRACE_INSTANT)
+    n += snprintf(text + n, sizeof(text) - n, ",\"s\":\"t\"");
+  else
+    n += snprintf(text + n, sizeof(text) - n, ",\"cat\":\"frame\",\"id\":%u",
+                  event.frame);
+  if (event.camera != TRACE_NO_CAMERA)
+    snprintf(text + n, sizeof(text) - n,
+             ",\"args\":{\"frame\":%u,\"camera\":%d}}", event.frame,
+             event.camera);
+  else
+    snprintf(text + n, sizeof(text) - n, ",\"args\":{\"frame\":%u}}",
+             event.frame);
+  *json += text;
+}
+
+int trace_dump(const char *path) {
+  std::string json;
+  char text[128];
+  int pid = getpid();
+  int count = ring_count.load();
+  int i;
+
+  if (count > TRACE_MAX_THREADS)
+    count = TRACE_MAX_THREADS;
+
+  json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  snprintf(text, sizeof(text),
+           "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+           "\"args\":{\"name\":\"%s\"}}",
+           pid, program_invocation_short_name);
+  json += text;
+
+  for (i = 0; i < count; i++) {
+    const TraceRing *ring = rings[i].load(std::memory_order_acquire);
+    if (!ring)
+      continue;
+
+    if (ring->thread_name[0]) {
+      snprintf(text, sizeof(text),
+               ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+               "\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+               pid, ring->tid, ring->thread_name);
+      json += text;
+    }
+
+    uint64_t size = ring->events.size();
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t first = head > size ? head - size : 0;
+    uint64_t n;
+
+    for (n = first; n < head; n++) {
+      TRACE_EVENT event = ring->events[n % size];
+      // The owner may have lapped the ring while this one was copied
+      if (ring->head.load(std::memory_order_acquire) - n >= size)
+        continue;
+      append_event(&json, event, ring, pid);
+    }
+  }
+  json += "\n]}\n";
+
+  FilePublisher publisher(path);
+  return publisher.publish(json.data(), json.size());
+}
+
+int trace_dump_on_signal(const char *path, int signo) {
+  sigset_t set;
+
+  // An ignored signal is discarded even while blocked, sigwait needs it kept
+  signal(signo, SIG_DFL);
+  sigemptyset(&set);
+  sigaddset(&set, signo);
+  if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) {
+    perror("pthread_sigmask");
+    return -1;
+  }
+
+  std::string target(path);
+  std::thread([set, target] {
+    int signal_number;
+
+    while (sigwait(&set, &signal_number) == 0) {
+      if (trace_dump(target.c_str()) == 0)
+        fprintf(stderr, "Trace written to %s\n", target.c_str());
+      else
+        fprintf(stderr, "Failed to write trace %s\n", target.c_str());
+    }
+  }).detach();
+  return 0;
+}
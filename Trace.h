@@ -0,0 +1,83 @@
+/**
+ * \file Trace.h
+ * Per-frame lifecycle tracing, dumped in the Chrome trace event format.
+ *
+ * Every thread that records an event gets its own fixed ring of events, so
+ * recording is a clock read and a few stores: no lock, no allocation after
+ * the thread's first event, no printf. Only the newest events of each
+ * thread are kept. The dump can be loaded in chrome://tracing or Perfetto.
+ *
+ * Tracing is off until trace_enable(); trace_event() then costs one atomic
+ * load, so the calls stay in the callbacks of release builds.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+/// Event phases, as in the Chrome format
+#define TRACE_INSTANT 'i' /// A point in time on the recording thread
+#define TRACE_BEGIN 'b'   /// Start of the frame's span, matched by frame
+#define TRACE_END 'e'     /// End of the frame's span
+
+/// Events kept per thread unless trace_enable() says otherwise
+#define TRACE_DEFAULT_EVENTS 16384
+/// Camera argument for events that don't know which camera they belong to
+#define TRACE_NO_CAMERA -1
+
+extern std::atomic<bool> trace_on;
+
+static inline bool trace_enabled() {
+  return trace_on.load(std::memory_order_relaxed);
+}
+
+/**
+ * Start recording
+ *
+ * @param events Events kept per thread, the oldest are overwritten
+ */
+void trace_enable(size_t events = TRACE_DEFAULT_EVENTS);
+
+/**
+ * Record an event on the calling thread's ring, if tracing is enabled
+ *
+ * @param phase TRACE_INSTANT, TRACE_BEGIN or TRACE_END
+ * @param name Event name, must be a string literal (only the pointer is
+ * kept)
+ * @param frame Frame number the event belongs to
+ * @param camera CAMERA_* of the frame, or TRACE_NO_CAMERA
+ * @param timestamp_us monotonic_us() time of the event, 0 for now
+ */
+void trace_record(char phase, const char *name, uint32_t frame, int camera,
+                  int64_t timestamp_us);
+
+static inline void trace_event(char phase, const char *name, uint32_t frame,
+                               int camera = TRACE_NO_CAMERA,
+                               int64_t timestamp_us = 0) {
+  if (trace_enabled())
+    trace_record(phase, name, frame, camera, timestamp_us);
+}
+
+/**
+ * Write every thread's events as a Chrome trace, replacing path atomically.
+ * Safe to call while other threads record; events overwritten during the
+ * dump are left out.
+ *
+ * @return 0 on success, -1 on error
+ */
+int trace_dump(const char *path);
+
+/**
+ * Dump to path whenever signo arrives. The signal is blocked in the calling
+ * thread and waited for on a thread of its own, so call this before
+ * starting any other thread.
+ *
+ * @return 0 on success, -1 on error
+ */
+int trace_dump_on_signal(const char *path, int signo);
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,275 @@
+#include "Trigger.h"
+#include "Stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#ifdef HAVE_WIRINGPI
+#include <wiringPi.h>
+#endif
+
+TriggerSource::TriggerSource() : fired_us_(0) {
+  event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd_ < 0)
+    perror("trigger eventfd");
+}
+
+TriggerSource::~TriggerSource() {
+  if (event_fd_ >= 0)
+    close(event_fd_);
+}
+
+void TriggerSource::fire() {
+  uint64_t one = 1;
+
+  fired_us_.store(monotonic_us(), std::memory_order_release);
+  if (write(event_fd_, &one, sizeof(one)) != sizeof(one))
+    perror("trigger fire");
+}
+
+int TriggerSource::take_fired(int64_t *edge_us) {
+  uint64_t count;
+
+  if (read(event_fd_, &count, sizeof(count)) != sizeof(count))
+    return 0;
+
+  *edge_us = fired_us_.load(std::memory_order_acquire);
+  return 1;
+}
+
+/**
+ * Write a string to a sysfs attribute
+ *
+ * @return 0 on success, errno otherwise
+ */
+static int sysfs_write(const char *path, const char *value) {
+  int fd = open(path, O_WRONLY);
+  int err = 0;
+
+  if (fd < 0)
+    return errno;
+  if (write(fd, value, strlen(value)) < 0)
+    err = errno;
+  close(fd);
+  return err;
+}
+
+GpioTrigger::GpioTrigger(int pin) : pin_(pin), value_fd_(-1), epoll_fd_(-1) {}
+
+GpioTrigger::~GpioTrigger() {
+  if (epoll_fd_ >= 0)
+    close(epoll_fd_);
+  if (value_fd_ >= 0)
+    close(value_fd_);
+}
+
+int GpioTrigger::open() {
+  char path[64];
+  char pin[8];
+  int err;
+  int retry;
+
+  snprintf(pin, sizeof(pin), "%d", pin_);
+  err = sysfs_write("/sys/class/gpio/export", pin);
+  if (err && err != EBUSY) {
+    fprintf(stderr, "Unable to export GPIO %d: %s\n", pin_, strerror(err));
+    return -1;
+  }
+
+  // udev fixes up the attribute permissions asynchronously after export
+  snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/edge", pin_);
+  for (retry = 0; retry < 50; retry++) {
+    err = sysfs_write(path, "rising");
+    if (err != EACCES && err != ENOENT)
+      break;
+    usleep(10000);
+  }
+
+  // Edge detection needs the line to be an input as far as the kernel knows
+  if (err == EIO || err == EINVAL) {
+    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/direction", pin_);
+    sysfs_write(path, "in");
+    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/edge", pin_);
+    err = sysfs_write(path, "rising");
+  }
+
+  if (err) {
+    fprintf(stderr, "Unable to set edge on GPIO %d: %s\n", pin_,
+            strerror(err));
+    return -1;
+  }
+
+  snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/value", pin_);
+  value_fd_ = ::open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (value_fd_ < 0) {
+    perror("GPIO value");
+    return -1;
+  }
+
+  // Clear the initial pending state so we only see new edges
+  char value[4];
+  if (read(value_fd_, value, sizeof(value)) < 0)
+    perror("GPIO value read");
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    perror("epoll_create1");
+    return -1;
+  }
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLPRI | EPOLLERR | EPOLLET;
+  ev.data.fd = value_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, value_fd_, &ev) < 0) {
+    perror("epoll_ctl GPIO");
+    return -1;
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.fd = event_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev) < 0) {
+    perror("epoll_ctl eventfd");
+    return -1;
+  }
+
+  return 0;
+}
+
+int GpioTrigger::wait(int timeout_ms, int64_t *edge_us) {
+  struct epoll_event events[2];
+  int n, i;
+
+  do {
+    n = epoll_wait(epoll_fd_, events, 2, timeout_ms);
+  } while (n < 0 && errno == EINTR);
+
+  if (n <= 0)
+    return n;
+
+  // Take the timestamp before anything else so it is as close to the edge
+  // as userspace can get
+  int64_t now = monotonic_us();
+
+  for (i = 0; i < n; i++) {
+    if (events[i].data.fd == value_fd_) {
+      char value[4];
+
+      lseek(value_fd_, 0, SEEK_SET);
+      if (read(value_fd_, value, sizeof(value)) < 0)
+        perror("GPIO value read");
+      *edge_us = now;
+      // Drop a software trigger that raced with the edge
+      int64_t ignored;
+      take_fired(&ignored);
+      return 1;
+    }
+  }
+
+  return take_fired(edge_us);
+}
+
+SpinTrigger::SpinTrigger(int pin) : pin_(pin) {}
+
+#ifdef HAVE_WIRINGPI
+int SpinTrigger::wait(int timeout_ms, int64_t *edge_us) {
+  int64_t deadline = timeout_ms < 0 ? 0 : monotonic_us() + timeout_ms * 1000LL;
+
+  while (digitalRead(pin_) == 1) {
+    if (take_fired(edge_us))
+      return 1;
+    if (deadline && monotonic_us() > deadline)
+      return 0;
+  }
+
+  while (digitalRead(pin_) == 0) {
+    if (take_fired(edge_us))
+      return 1;
+    if (deadline && monotonic_us() > deadline)
+      return 0;
+  }
+
+  *edge_us = monotonic_us();
+  return 1;
+}
+#else
+int SpinTrigger::wait(int timeout_ms, int64_t *edge_us) {
+  fprintf(stderr, "Built without wiringPi, no spin trigger\n");
+  return -1;
+}
+#endif
+
+SimulatedTrigger::SimulatedTrigger(int period_ms)
+    : period_ms_(period_ms), next_us_(0) {}
+
+int SimulatedTrigger::wait(int timeout_ms, int64_t *edge_us) {
+  int64_t now = monotonic_us();
+  int64_t wait_us = -1;
+  struct pollfd pfd;
+  int n;
+
+  if (period_ms_) {
+    if (!next_us_)
+      next_us_ = now + period_ms_ * 1000LL;
+    wait_us = next_us_ > now ? next_us_ - now : 0;
+  }
+  if (timeout_ms >= 0 && (wait_us < 0 || timeout_ms * 1000LL < wait_us))
+    wait_us = timeout_ms * 1000LL;
+
+  pfd.fd = event_fd_;
+  pfd.events = POLLIN;
+  do {
+    struct timespec ts;
+    ts.tv_sec = wait_us / 1000000;
+    ts.tv_nsec = (wait_us % 1000000) * 1000;
+    n = ppoll(&pfd, 1, wait_us < 0 ? NULL : &ts, NULL);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0)
+    return -1;
+  if (n > 0)
+    return take_fired(edge_us);
+
+  if (period_ms_ && monotonic_us() >= next_us_) {
+    // Report the time the edge should have happened, so wake-up jitter
+    // shows up in the measured latency
+    *edge_us = next_us_;
+    next_us_ += period_ms_ * 1000LL;
+    return 1;
+  }
+
+  return 0;
+}
+
+TriggerSource *trigger_create(const char *spec) {
+  const char *arg = strchr(spec, ':');
+  int value = arg ? atoi(arg + 1) : 0;
+
+  if (!strncmp(spec, "gpio:", 5)) {
+    GpioTrigger *trigger = new GpioTrigger(value);
+    if (trigger->open() != 0) {
+      delete trigger;
+      return NULL;
+    }
+    return trigger;
+  }
+
+  if (!strncmp(spec, "spin:", 5))
+    return new SpinTrigger(value);
+
+  if (!strncmp(spec, "sim:", 4) && value > 0)
+    return new SimulatedTrigger(value);
+
+  if (!strcmp(spec, "manual"))
+    return new SimulatedTrigger(0);
+
+  fprintf(stderr, "Unknown trigger '%s'\n", spec);
+  return NULL;
+}
@@ -0,0 +1,124 @@
+/**
+ * \file Trigger.h
+ * Capture trigger sources.
+ *
+ * The capture loop blocks in TriggerSource::wait() until the next trigger
+ * instead of polling the GPIO line. Every source can also be fired from
+ * software (fire()), which is how the simulated source and any in-process
+ * detector raise a capture.
+ */
+
+#ifndef TRIGGER_H_
+#define TRIGGER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+class TriggerSource {
+public:
+  TriggerSource();
+  virtual ~TriggerSource();
+
+  /**
+   * Block until the next trigger
+   *
+   * @param timeout_ms Maximum time to wait, -1 to wait forever
+   * @param edge_us Set to the monotonic time (us) the trigger was detected
+   * @return 1 if triggered, 0 on timeout, -1 on error
+   */
+  virtual int wait(int timeout_ms, int64_t *edge_us) = 0;
+
+  /**
+   * Raise a software trigger. Safe to call from any thread; wakes a
+   * blocked wait().
+   */
+  void fire();
+
+  /** Short description used in the startup banner */
+  virtual const char *describe() const = 0;
+
+protected:
+  /**
+   * Consume a pending software trigger, if any
+   *
+   * @param edge_us Set to the time fire() was called
+   * @return 1 if one was pending, 0 otherwise
+   */
+  int take_fired(int64_t *edge_us);
+
+  int event_fd_; /// eventfd signalled by fire(), for subclass poll sets
+
+private:
+  std::atomic<int64_t> fired_us_;
+};
+
+/**
+ * Rising edge on a GPIO line, delivered by the kernel through the sysfs
+ * value file and epoll, so no CPU is used while waiting.
+ */
+class GpioTrigger : public TriggerSource {
+public:
+  explicit GpioTrigger(int pin);
+  ~GpioTrigger();
+
+  /** Export the pin and arm rising edge detection. @return 0 on success */
+  int open();
+
+  int wait(int timeout_ms, int64_t *edge_us);
+  const char *describe() const { return "GPIO edge (epoll)"; }
+
+private:
+  int pin_;
+  int value_fd_;
+  int epoll_fd_;
+};
+
+/**
+ * The original busy loop on digitalRead(), kept so trigger latency can be
+ * compared against it. Waits for the line to go low, then high.
+ */
+class SpinTrigger : public TriggerSource {
+public:
+  explicit SpinTrigger(int pin);
+
+  int wait(int timeout_ms, int64_t *edge_us);
+  const char *describe() const { return "GPIO busy poll"; }
+
+private:
+  int pin_;
+};
+
+/**
+ * Fires every period_ms, or only through fire() if the period is 0. Lets the
+ * capture loop run without any GPIO hardware.
+ */
+class SimulatedTrigger : public TriggerSource {
+public:
+  explicit SimulatedTrigger(int period_ms);
+
+  int wait(int timeout_ms, int64_t *edge_us);
+  const char *describe() const {
+    return period_ms_ ? "simulated (periodic)" : "software only";
+  }
+
+private:
+  int period_ms_;
+  int64_t next_us_;
+};
+
+/**
+ * Create a trigger source from a specification string
+ *
+ *   gpio:<pin>   edge interrupt on a BCM GPIO pin
+ *   spin:<pin>   busy poll of a BCM GPIO pin (previous behaviour)
+ *   sim:<ms>     simulated trigger every <ms> milliseconds
+ *   manual       software trigger only
+ *
+ * @param spec Specification string
+ * @return New trigger source, or NULL if the spec is invalid or the source
+ * could not be set up
+ */
+TriggerSource *trigger_create(const char *spec);
+
+#endif /* TRIGGER_H_ */
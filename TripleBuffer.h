@@ -0,0 +1,63 @@
+/**
+ * \file TripleBuffer.h
+ * Lock-free latest-value-wins hand-off between one producer and one consumer.
+ *
+ * The producer always has a slot of its own to fill and never waits. The
+ * consumer always gets the most recently published slot; anything published
+ * in between is overwritten. Nothing is copied on hand-off, the two sides
+ * just swap slot indices with the middle slot.
+ */
+
+#ifndef TRIPLEBUFFER_H_
+#define TRIPLEBUFFER_H_
+
+#include <atomic>
+
+template <typename T> class TripleBuffer {
+public:
+  TripleBuffer() : back_(0), middle_(1), front_(2) {}
+
+  /** Producer side: the slot to fill */
+  T &back() { return slots_[back_]; }
+
+  /**
+   * Producer side: hand the filled slot over and take a free one
+   *
+   * @return false if the previous value was never taken by the consumer
+   */
+  bool publish() {
+    int old = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel);
+    back_ = old & INDEX;
+    return !(old & FRESH);
+  }
+
+  /**
+   * Consumer side: switch to the latest published value, if there is one
+   *
+   * @return true if front() changed
+   */
+  bool update() {
+    if (!(middle_.load(std::memory_order_relaxed) & FRESH))
+      return false;
+    int old = middle_.exchange(front_, std::memory_order_acq_rel);
+    front_ = old & INDEX;
+    return true;
+  }
+
+  /** Consumer side: the value taken by the last update() */
+  T &front() { return slots_[front_]; }
+
+private:
+  enum { INDEX = 3, FRESH = 4 };
+
+  T slots_[3];
+  // Each index is only touched by one side, except the middle which is
+  // swapped atomically
+  int back_;
+  char pad0_[64];
+  std::atomic<int> middle_;
+  char pad1_[64];
+  int front_;
+};
+
+#endif /* TRIPLEBUFFER_H_ */
@@ -0,0 +1,327 @@
+#include "VideoRecorder.h"
+
+#include <stdio.h>
+
+#include "interface/vcos/vcos.h"
+#include "interface/mmal/mmal_logging.h"
+#include "interface/mmal/util/mmal_util.h"
+#include "interface/mmal/util/mmal_util_params.h"
+#include "interface/mmal/util/mmal_default_components.h"
+
+#include "Stats.h"
+
+/// Encoder output buffers. Enough to ride out a slow SD card write for about
+/// half a second at full bitrate before the encoder has to wait.
+#define ENCODER_OUTPUT_BUFFERS_NUM 16
+
+/// Buffers for the raw splitter output
+#define RAW_OUTPUT_BUFFERS_NUM 3
+
+VideoRecorder::VideoRecorder(const VIDEO_RECORDER_PARAMS &params)
+    : params_(params), splitter_(NULL), encoder_(NULL), encoder_pool_(NULL),
+      source_connection_(NULL), encoder_connection_(NULL), writer_(NULL),
+      segments_(NULL), events_(NULL) {}
+
+VideoRecorder::~VideoRecorder() { close(); }
+
+MMAL_PORT_T *VideoRecorder::raw_port() const {
+  return splitter_ ? splitter_->output[1] : NULL;
+}
+
+void VideoRecorder::trigger_event() {
+  if (events_)
+    events_->trigger();
+}
+
+uint64_t VideoRecorder::frames() const {
+  return segments_ ? segments_->frames() : 0;
+}
+
+uint64_t VideoRecorder::dropped() const {
+  return segments_ ? segments_->dropped() : 0;
+}
+
+MMAL_STATUS_T VideoRecorder::create_splitter(MMAL_PORT_T *source) {
+  MMAL_STATUS_T status;
+  unsigned i;
+
+  status =
+      mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_SPLITTER, &splitter_);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Unable to create video splitter component");
+    return status;
+  }
+  if (splitter_->output_num < 2) {
+    vcos_log_error("Video splitter doesn't have enough output ports");
+    return MMAL_ENOSYS;
+  }
+
+  mmal_format_copy(splitter_->input[0]->format, source->format);
+  status = mmal_port_format_commit(splitter_->input[0]);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Unable to set format on splitter input port");
+    return status;
+  }
+
+  for (i = 0; i < 2; i++) {
+    MMAL_PORT_T *output = splitter_->output[i];
+
+    mmal_format_copy(output->format, splitter_->input[0]->format);
+    status = mmal_port_format_commit(output);
+    if (status != MMAL_SUCCESS) {
+      vcos_log_error("Unable to set format on splitter output port %u", i);
+      return status;
+    }
+  }
+  splitter_->output[1]->buffer_num =
+      VCOS_MAX(splitter_->output[1]->buffer_num_min,
+               (uint32_t)RAW_OUTPUT_BUFFERS_NUM);
+  splitter_->output[1]->buffer_size =
+      splitter_->output[1]->buffer_size_recommended;
+
+  status = mmal_component_enable(splitter_);
+  if (status != MMAL_SUCCESS)
+    vcos_log_error("Unable to enable video splitter component");
+  return status;
+}
+
+MMAL_STATUS_T VideoRecorder::create_encoder() {
+  MMAL_PORT_T *input, *output;
+  MMAL_STATUS_T status;
+
+  status =
+      mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_ENCODER, &encoder_);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Unable to create video encoder component");
+    return status;
+  }
+  if (!encoder_->input_num || !encoder_->output_num) {
+    vcos_log_error("Video encoder doesn't have input/output ports");
+    return MMAL_ENOSYS;
+  }
+
+  input = encoder_->input[0];
+  output = encoder_->output[0];
+
+  mmal_format_copy(input->format, splitter_->output[0]->format);
+  status = mmal_port_format_commit(input);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Unable to set format on video encoder input port");
+    return status;
+  }
+
+  mmal_format_copy(output->format, input->format);
+  output->format->encoding = MMAL_ENCODING_H264;
+  output->format->bitrate = params_.bitrate;
+  // The encoder takes its rate from the input, 0 here
+  output->format->es->video.frame_rate.num = 0;
+  output->format->es->video.frame_rate.den = 1;
+
+  output->buffer_size = VCOS_MAX(output->buffer_size_recommended,
+                                 output->buffer_size_min);
+  output->buffer_num = VCOS_MAX(output->buffer_num_min,
+                                (uint32_t)ENCODER_OUTPUT_BUFFERS_NUM);
+
+  status = mmal_port_format_commit(output);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Unable to set format on video encoder output port");
+    return status;
+  }
+
+  {
+    MMAL_PARAMETER_UINT32_T intra_period = {
+        {MMAL_PARAMETER_INTRAPERIOD, sizeof(intra_period)},
+        (uint32_t)params_.intraperiod};
+    if (mmal_port_parameter_set(output, &intra_period.hdr) != MMAL_SUCCESS)
+      vcos_log_error("Unable to set intraperiod");
+  }
+
+  {
+    MMAL_PARAMETER_VIDEO_PROFILE_T profile;
+    profile.hdr.id = MMAL_PARAMETER_PROFILE;
+    profile.hdr.size = sizeof(profile);
+    profile.profile[0].profile = MMAL_VIDEO_PROFILE_H264_HIGH;
+    profile.profile[0].level = MMAL_VIDEO_LEVEL_H264_41;
+    if (mmal_port_parameter_set(output, &profile.hdr) != MMAL_SUCCESS)
+      vcos_log_error("Unable to set H264 profile");
+  }
+
+  // SPS/PPS in front of every keyframe, so a segment cut there plays alone
+  if (mmal_port_parameter_set_boolean(
+          output, MMAL_PARAMETER_VIDEO_ENCODE_INLINE_HEADER, 1) !=
+      MMAL_SUCCESS)
+    vcos_log_error("Unable to set inline header");
+
+  if (mmal_port_parameter_set_boolean(
+          output, MMAL_PARAMETER_VIDEO_ENCODE_SPS_TIMING, 1) != MMAL_SUCCESS)
+    vcos_log_error("Unable to set SPS timing");
+
+  // The splitter also hands the same frames to the raw output
+  if (mmal_port_parameter_set_boolean(
+          input, MMAL_PARAMETER_VIDEO_IMMUTABLE_INPUT, 1) != MMAL_SUCCESS)
+    vcos_log_error("Unable to set immutable input flag");
+
+  status = mmal_component_enable(encoder_);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Unable to enable video encoder component");
+    return status;
+  }
+
+  encoder_pool_ =
+      mmal_port_pool_create(output, output->buffer_num, output->buffer_size);
+  if (!encoder_pool_) {
+    vcos_log_error(
+        "Failed to create buffer header pool for encoder output port %s",
+        output->name);
+    return MMAL_ENOMEM;
+  }
+
+  return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T VideoRecorder::open(MMAL_PORT_T *source) {
+  MMAL_PORT_T *output;
+  MMAL_STATUS_T status;
+  unsigned num, q;
+
+  status = create_splitter(source);
+  if (status == MMAL_SUCCESS)
+    status = create_encoder();
+  if (status != MMAL_SUCCESS)
+    goto error;
+
+  status = mmal_connection_create(
+      &source_connection_, source, splitter_->input[0],
+      MMAL_CONNECTION_FLAG_TUNNELLING |
+          MMAL_CONNECTION_FLAG_ALLOCATION_ON_INPUT);
+  if (status == MMAL_SUCCESS)
+    status = mmal_connection_enable(source_connection_);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Failed to connect camera video port to splitter");
+    goto error;
+  }
+
+  status = mmal_connection_create(
+      &encoder_connection_, splitter_->output[0], encoder_->input[0],
+      MMAL_CONNECTION_FLAG_TUNNELLING |
+          MMAL_CONNECTION_FLAG_ALLOCATION_ON_INPUT);
+  if (status == MMAL_SUCCESS)
+    status = mmal_connection_enable(encoder_connection_);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Failed to connect splitter to video encoder");
+    goto error;
+  }
+
+  segments_ =
+      new SegmentRecorder(params_.directory, params_.segment_seconds,
+                          params_.segment_count, params_.framerate);
+  if (params_.pre_event_seconds > 0 || params_.post_event_seconds > 0)
+    events_ = new EventRecorder(params_.directory, params_.pre_event_seconds,
+                                params_.post_event_seconds,
+                                params_.event_buffer_bytes);
+
+  output = encoder_->output[0];
+  output->userdata = (struct MMAL_PORT_USERDATA_T *)this;
+  writer_ = new EncoderWriter(output, encoder_pool_, write_output, this);
+
+  status = mmal_port_enable(output, encoder_callback);
+  if (status != MMAL_SUCCESS) {
+    vcos_log_error("Failed to enable video encoder output port");
+    goto error;
+  }
+
+  num = mmal_queue_length(encoder_pool_->queue);
+  for (q = 0; q < num; q++) {
+    MMAL_BUFFER_HEADER_T *buffer = mmal_queue_get(encoder_pool_->queue);
+
+    if (!buffer || mmal_port_send_buffer(output, buffer) != MMAL_SUCCESS)
+      vcos_log_error("Unable to send a buffer to video encoder output (%u)",
+                     q);
+  }
+
+  return MMAL_SUCCESS;
+
+error:
+  close();
+  return status;
+}
+
+void VideoRecorder::close() {
+  if (encoder_ && encoder_->output[0]->is_enabled)
+    mmal_port_disable(encoder_->output[0]);
+
+  // Flushes whatever the I/O thread still holds into the last segment
+  delete writer_;
+  writer_ = NULL;
+  if (segments_)
+    fprintf(stderr, "Recorded %llu frames in %llu segments, %llu dropped\n",
+            (unsigned long long)segments_->frames(),
+            (unsigned long long)segments_->segments(),
+            (unsigned long long)segments_->dropped());
+  delete segments_;
+  segments_ = NULL;
+  // Completes an event in progress with what has been recorded
+  delete events_;
+  events_ = NULL;
+
+  if (encoder_connection_) {
+    mmal_connection_destroy(encoder_connection_);
+    encoder_connection_ = NULL;
+  }
+  if (source_connection_) {
+    mmal_connection_destroy(source_connection_);
+    source_connection_ = NULL;
+  }
+
+  if (encoder_pool_) {
+    mmal_port_pool_destroy(encoder_->output[0], encoder_pool_);
+    encoder_pool_ = NULL;
+  }
+  if (encoder_) {
+    mmal_component_disable(encoder_);
+    mmal_component_destroy(encoder_);
+    encoder_ = NULL;
+  }
+  if (splitter_) {
+    mmal_component_disable(splitter_);
+    mmal_component_destroy(splitter_);
+    splitter_ = NULL;
+  }
+}
+
+/**
+ * Encoder output callback, runs on the MMAL thread. Only queues the buffer.
+ */
+void VideoRecorder::encoder_callback(MMAL_PORT_T *port,
+                                     MMAL_BUFFER_HEADER_T *buffer) {
+  VideoRecorder *recorder = (VideoRecorder *)port->userdata;
+  // Video buffers belong to no still or burst
+  ENCODER_OUTPUT output = {buffer, 0, 0, wallclock_us()};
+
+  recorder->writer_->submit(output);
+}
+
+/**
+ * Write handler, runs on the EncoderWriter I/O thread
+ */
+void VideoRecorder::write_output(const ENCODER_OUTPUT *output, void *context) {
+  VideoRecorder *recorder = (VideoRecorder *)context;
+  MMAL_BUFFER_HEADER_T *buffer = output->buffer;
+  unsigned flags = 0;
+
+  if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_CONFIG)
+    flags |= SEGMENT_CONFIG;
+  if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_KEYFRAME)
+    flags |= SEGMENT_KEYFRAME;
+  if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END)
+    flags |= SEGMENT_FRAME_END;
+
+  int64_t pts =
+      buffer->pts == MMAL_TIME_UNKNOWN ? SEGMENT_NO_PTS : buffer->pts;
+
+  recorder->segments_->write(buffer->data + buffer->offset, buffer->length,
+                             pts, flags);
+  if (recorder->events_)
+    recorder->events_->write(buffer->data + buffer->offset, buffer->length,
+                             pts, flags);
+}
@@ -0,0 +1,92 @@
+/**
+ * \file VideoRecorder.h
+ * Continuous H.264 recording from the camera video port.
+ *
+ *   camera video port -> splitter -+-> output 0 -> H.264 encoder
+ *                                  +-> output 1 -> raw frames (I420)
+ *
+ * Both links into the encoder are tunnelled, the ARM only sees the encoded
+ * stream. Encoder output goes through an EncoderWriter to a SegmentRecorder,
+ * so file writes never hold up the encoder callback. The second splitter
+ * output is left to the caller for anything that wants the raw frames.
+ */
+
+#ifndef VIDEORECORDER_H_
+#define VIDEORECORDER_H_
+
+#include <stdint.h>
+
+#include "interface/mmal/mmal.h"
+#include "interface/mmal/util/mmal_connection.h"
+
+#include "EncoderWriter.h"
+#include "EventRecorder.h"
+#include "SegmentRecorder.h"
+
+typedef struct {
+  int width;               /// Frame size, must match the source port
+  int height;
+  int framerate;           /// Frames per second
+  uint32_t bitrate;        /// Bits per second
+  int intraperiod;         /// Frames between keyframes
+  const char *directory;   /// Where the segments go
+  int segment_seconds;     /// Length of each segment
+  int segment_count;       /// Segments kept before the oldest is overwritten
+  int pre_event_seconds;   /// Footage kept in RAM for events, 0 disables
+  int post_event_seconds;  /// Footage saved after an event
+  size_t event_buffer_bytes; /// Memory limit of the pre-event buffer
+} VIDEO_RECORDER_PARAMS;
+
+class VideoRecorder {
+public:
+  VideoRecorder(const VIDEO_RECORDER_PARAMS &params);
+  ~VideoRecorder();
+
+  /**
+   * Create the splitter and encoder and start recording from source
+   *
+   * @param source Camera video port, format already committed
+   * @return MMAL_SUCCESS if recording started
+   */
+  MMAL_STATUS_T open(MMAL_PORT_T *source);
+
+  /** Stop recording and tear the pipeline down */
+  void close();
+
+  /**
+   * Second splitter output, same format as the source. Not enabled, the
+   * caller sets up buffers and a callback if it wants the frames.
+   */
+  MMAL_PORT_T *raw_port() const;
+
+  /**
+   * Save the pre-event buffer and the following post_event_seconds to an
+   * event file. Only sets a flag, safe from any thread.
+   */
+  void trigger_event();
+
+  uint64_t frames() const;
+  uint64_t dropped() const;
+  const EventRecorder *events() const { return events_; }
+  const EncoderWriter *writer() const { return writer_; }
+
+private:
+  static void encoder_callback(MMAL_PORT_T *port,
+                               MMAL_BUFFER_HEADER_T *buffer);
+  static void write_output(const ENCODER_OUTPUT *output, void *context);
+
+  MMAL_STATUS_T create_splitter(MMAL_PORT_T *source);
+  MMAL_STATUS_T create_encoder();
+
+  VIDEO_RECORDER_PARAMS params_;
+  MMAL_COMPONENT_T *splitter_;
+  MMAL_COMPONENT_T *encoder_;
+  MMAL_POOL_T *encoder_pool_;
+  MMAL_CONNECTION_T *source_connection_;
+  MMAL_CONNECTION_T *encoder_connection_;
+  EncoderWriter *writer_;
+  SegmentRecorder *segments_;
+  EventRecorder *events_;
+};
+
+#endif /* VIDEORECORDER_H_ */
@@ -0,0 +1,146 @@
+#include "YKernels.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void downscale_scalar(const uint8_t *src, int width, int height,
+                             int stride, int scale, uint8_t *dst) {
+  int out_width = width / scale;
+  int out_height = height / scale;
+  int area = scale * scale;
+  int x, y, i, j;
+
+  for (y = 0; y < out_height; y++) {
+    for (x = 0; x < out_width; x++) {
+      const uint8_t *block = src + (size_t)y * scale * stride + x * scale;
+      unsigned sum = 0;
+
+      for (j = 0; j < scale; j++) {
+        for (i = 0; i < scale; i++)
+          sum += block[(size_t)j * stride + i];
+      }
+      *dst++ = (sum + area / 2) / area;
+    }
+  }
+}
+
+static void absdiff_scalar(const uint8_t *a, const uint8_t *b, uint8_t *dst,
+                           size_t n) {
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    dst[i] = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+}
+
+/**
+ * Four partial histograms, so runs of equal values don't serialise on one
+ * counter. Scatter doesn't vectorise, every kernel set uses this.
+ */
+static void histogram_scalar(const uint8_t *src, size_t n,
+                             uint32_t hist[256]) {
+  uint32_t part[4][256];
+  size_t i;
+
+  memset(part, 0, sizeof(part));
+  for (i = 0; i + 4 <= n; i += 4) {
+    part[0][src[i]]++;
+    part[1][src[i + 1]]++;
+    part[2][src[i + 2]]++;
+    part[3][src[i + 3]]++;
+  }
+  for (; i < n; i++)
+    part[0][src[i]]++;
+
+  for (i = 0; i < 256; i++)
+    hist[i] = part[0][i] + part[1][i] + part[2][i] + part[3][i];
+}
+
+static void sums_scalar(const uint8_t *src, int width, int height, int stride,
+                        uint64_t *sum, uint64_t *sum_sq) {
+  uint64_t s = 0, sq = 0;
+  int x, y;
+
+  for (y = 0; y < height; y++) {
+    const uint8_t *row = src + (size_t)y * stride;
+    uint32_t row_sum = 0, row_sq = 0;
+
+    for (x = 0; x < width; x++) {
+      row_sum += row[x];
+      row_sq += row[x] * row[x];
+    }
+    s += row_sum;
+    sq += row_sq;
+  }
+  *sum = s;
+  *sum_sq = sq;
+}
+
+static void tile_sad_scalar(const uint8_t *a, const uint8_t *b, int width,
+                            int height, int stride, int tile, uint32_t *sad) {
+  int tiles_x = width / tile;
+  int tiles_y = height / tile;
+  int tx, ty, x, y;
+
+  for (ty = 0; ty < tiles_y; ty++) {
+    for (tx = 0; tx < tiles_x; tx++) {
+      size_t offset = (size_t)ty * tile * stride + tx * tile;
+      uint32_t total = 0;
+
+      for (y = 0; y < tile; y++) {
+        const uint8_t *ra = a + offset + (size_t)y * stride;
+        const uint8_t *rb = b + offset + (size_t)y * stride;
+        for (x = 0; x < tile; x++)
+          total += abs(ra[x] - rb[x]);
+      }
+      *sad++ = total;
+    }
+  }
+}
+
+static const YKERNELS_T scalar_kernels = {
+    "scalar",       downscale_scalar, absdiff_scalar,
+    histogram_scalar, sums_scalar,    tile_sad_scalar};
+
+const YKERNELS_T *ykernels_scalar() { return &scalar_kernels; }
+
+static const YKERNELS_T *select_kernels() {
+  const char *forced = getenv("YKERNELS");
+  const YKERNELS_T *candidates[] = {ykernels_avx2(), ykernels_neon(),
+                                    ykernels_sse2(), ykernels_scalar()};
+  size_t i;
+
+  if (forced) {
+    for (i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+      if (candidates[i] && !strcmp(candidates[i]->name, forced))
+        return candidates[i];
+    }
+  }
+
+  for (i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+    if (candidates[i])
+      return candidates[i];
+  }
+  return ykernels_scalar();
+}
+
+const YKERNELS_T *ykernels() {
+  // Thread-safe one time initialisation
+  static const YKERNELS_T *selected = select_kernels();
+  return selected;
+}
+
+void ykernels_mean_variance(const YKERNELS_T *k, const uint8_t *src, int width,
+                            int height, int stride, double *mean,
+                            double *variance) {
+  uint64_t sum, sum_sq;
+  double n = (double)width * height;
+
+  if (n <= 0) {
+    *mean = *variance = 0.0;
+    return;
+  }
+
+  k->sums(src, width, height, stride, &sum, &sum_sq);
+  *mean = sum / n;
+  *variance = sum_sq / n - *mean * *mean;
+}
@@ -0,0 +1,67 @@
+/**
+ * \file YKernels.h
+ * Primitives for analysing 8-bit luma planes.
+ *
+ * Every kernel exists in a scalar version and, where the CPU has it, SSE2,
+ * AVX2 or NEON versions. ykernels() picks the best set once at run time.
+ * All versions give bit-identical results; ykernels_bench checks that.
+ *
+ * Setting the environment variable YKERNELS to "scalar", "sse2", "avx2" or
+ * "neon" forces a particular set, if it is available.
+ */
+
+#ifndef YKERNELS_H_
+#define YKERNELS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  const char *name;
+
+  /**
+   * Box downscale by an integer factor. Each output cell is the rounded mean
+   * of a scale x scale block; partial blocks at the edges are dropped.
+   *
+   * @param dst (width / scale) x (height / scale) cells, packed
+   */
+  void (*downscale)(const uint8_t *src, int width, int height, int stride,
+                    int scale, uint8_t *dst);
+
+  /** dst[i] = |a[i] - b[i]| */
+  void (*absdiff)(const uint8_t *a, const uint8_t *b, uint8_t *dst, size_t n);
+
+  /** Count of each value, hist is cleared first */
+  void (*histogram)(const uint8_t *src, size_t n, uint32_t hist[256]);
+
+  /** Sum and sum of squares over a plane, for mean and variance */
+  void (*sums)(const uint8_t *src, int width, int height, int stride,
+               uint64_t *sum, uint64_t *sum_sq);
+
+  /**
+   * Sum of absolute differences per tile x tile block, a and b share the
+   * stride. Partial tiles at the edges are dropped.
+   *
+   * @param sad (width / tile) x (height / tile) results, packed
+   */
+  void (*tile_sad)(const uint8_t *a, const uint8_t *b, int width, int height,
+                   int stride, int tile, uint32_t *sad);
+} YKERNELS_T;
+
+/** Best kernel set for this CPU, or the one named in $YKERNELS */
+const YKERNELS_T *ykernels();
+
+/** Reference versions, always available */
+const YKERNELS_T *ykernels_scalar();
+
+/** Each returns NULL if the CPU or the build doesn't support it */
+const YKERNELS_T *ykernels_sse2();
+const YKERNELS_T *ykernels_avx2();
+const YKERNELS_T *ykernels_neon();
+
+/** Mean and variance of a plane from the sums kernel */
+void ykernels_mean_variance(const YKERNELS_T *k, const uint8_t *src, int width,
+                            int height, int stride, double *mean,
+                            double *variance);
+
+#endif /* YKERNELS_H_ */
@@ -0,0 +1,169 @@
+/**
+ * \file YKernelsAvx2.cpp
+ * AVX2 versions of the luma kernels. Built with -mavx2 on x86 (see
+ * CMakeLists.txt), only handed out if the CPU supports it.
+ */
+
+#include "YKernels.h"
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+/** Add one row into 16-bit column sums */
+static void accumulate_row(const uint8_t *row, int width, uint16_t *colsum) {
+  int x;
+
+  for (x = 0; x + 32 <= width; x += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(row + x));
+    __m256i lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+    __m256i hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1));
+    __m256i c0 = _mm256_loadu_si256((const __m256i *)(colsum + x));
+    __m256i c1 = _mm256_loadu_si256((const __m256i *)(colsum + x + 16));
+
+    _mm256_storeu_si256((__m256i *)(colsum + x), _mm256_add_epi16(c0, lo));
+    _mm256_storeu_si256((__m256i *)(colsum + x + 16),
+                        _mm256_add_epi16(c1, hi));
+  }
+  for (; x < width; x++)
+    colsum[x] += row[x];
+}
+
+static void downscale_avx2(const uint8_t *src, int width, int height,
+                           int stride, int scale, uint8_t *dst) {
+  int out_width = width / scale;
+  int out_height = height / scale;
+  int used = out_width * scale;
+  unsigned area = scale * scale;
+  uint16_t colsum[4096];
+  int x, y, j, i;
+
+  if (scale > 16 || used > 4096) {
+    ykernels_scalar()->downscale(src, width, height, stride, scale, dst);
+    return;
+  }
+
+  for (y = 0; y < out_height; y++) {
+    for (x = 0; x < used; x++)
+      colsum[x] = 0;
+    for (j = 0; j < scale; j++)
+      accumulate_row(src + ((size_t)y * scale + j) * stride, used, colsum);
+
+    for (x = 0; x < out_width; x++) {
+      unsigned sum = 0;
+      for (i = 0; i < scale; i++)
+        sum += colsum[x * scale + i];
+      *dst++ = (sum + area / 2) / area;
+    }
+  }
+}
+
+static void absdiff_avx2(const uint8_t *a, const uint8_t *b, uint8_t *dst,
+                         size_t n) {
+  size_t i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+    __m256i d =
+        _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+    _mm256_storeu_si256((__m256i *)(dst + i), d);
+  }
+  if (i < n)
+    ykernels_scalar()->absdiff(a + i, b + i, dst + i, n - i);
+}
+
+static void sums_avx2(const uint8_t *src, int width, int height, int stride,
+                      uint64_t *sum, uint64_t *sum_sq) {
+  const __m256i zero = _mm256_setzero_si256();
+  uint64_t s = 0, sq = 0;
+  int x, y;
+
+  for (y = 0; y < height; y++) {
+    const uint8_t *row = src + (size_t)y * stride;
+    __m256i vsum = zero, vsq = zero;
+    uint64_t sums[4];
+    uint32_t lanes[8];
+    int i;
+
+    for (x = 0; x + 32 <= width; x += 32) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(row + x));
+      __m256i lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+      __m256i hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1));
+
+      vsum = _mm256_add_epi64(vsum, _mm256_sad_epu8(v, zero));
+      vsq = _mm256_add_epi32(vsq, _mm256_madd_epi16(lo, lo));
+      vsq = _mm256_add_epi32(vsq, _mm256_madd_epi16(hi, hi));
+    }
+
+    _mm256_storeu_si256((__m256i *)sums, vsum);
+    _mm256_storeu_si256((__m256i *)lanes, vsq);
+    s += sums[0] + sums[1] + sums[2] + sums[3];
+    for (i = 0; i < 8; i++)
+      sq += lanes[i];
+
+    for (; x < width; x++) {
+      s += row[x];
+      sq += row[x] * row[x];
+    }
+  }
+  *sum = s;
+  *sum_sq = sq;
+}
+
+static void tile_sad_avx2(const uint8_t *a, const uint8_t *b, int width,
+                          int height, int stride, int tile, uint32_t *sad) {
+  int tiles_x = width / tile;
+  int tiles_y = height / tile;
+  int tx, ty, x, y;
+
+  // 16 wide tiles gain nothing from the wider registers
+  if (tile % 32) {
+    const YKERNELS_T *fallback = ykernels_sse2();
+    if (!fallback)
+      fallback = ykernels_scalar();
+    fallback->tile_sad(a, b, width, height, stride, tile, sad);
+    return;
+  }
+
+  for (ty = 0; ty < tiles_y; ty++) {
+    for (tx = 0; tx < tiles_x; tx++) {
+      size_t offset = (size_t)ty * tile * stride + tx * tile;
+      __m256i total = _mm256_setzero_si256();
+      uint64_t lanes[4];
+
+      for (y = 0; y < tile; y++) {
+        const uint8_t *ra = a + offset + (size_t)y * stride;
+        const uint8_t *rb = b + offset + (size_t)y * stride;
+        for (x = 0; x < tile; x += 32) {
+          __m256i va = _mm256_loadu_si256((const __m256i *)(ra + x));
+          __m256i vb = _mm256_loadu_si256((const __m256i *)(rb + x));
+          total = _mm256_add_epi64(total, _mm256_sad_epu8(va, vb));
+        }
+      }
+      _mm256_storeu_si256((__m256i *)lanes, total);
+      *sad++ = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+  }
+}
+
+static YKERNELS_T avx2_kernels;
+
+const YKERNELS_T *ykernels_avx2() {
+  if (!__builtin_cpu_supports("avx2"))
+    return NULL;
+
+  avx2_kernels.name = "avx2";
+  avx2_kernels.downscale = downscale_avx2;
+  avx2_kernels.absdiff = absdiff_avx2;
+  avx2_kernels.histogram = ykernels_scalar()->histogram;
+  avx2_kernels.sums = sums_avx2;
+  avx2_kernels.tile_sad = tile_sad_avx2;
+  return &avx2_kernels;
+}
+
+#else
+
+const YKERNELS_T *ykernels_avx2() { return NULL; }
+
+#endif
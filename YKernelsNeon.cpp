@@ -0,0 +1,161 @@
+/**
+ * \file YKernelsNeon.cpp
+ * NEON versions of the luma kernels. Built with -mfpu=neon on 32 bit ARM
+ * (see CMakeLists.txt) and only handed out if the CPU has NEON, so the same
+ * binary still runs on a Pi Zero / Pi 1.
+ */
+
+#include "YKernels.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/** Add one row into 16-bit column sums */
+static void accumulate_row(const uint8_t *row, int width, uint16_t *colsum) {
+  int x;
+
+  for (x = 0; x + 16 <= width; x += 16) {
+    uint8x16_t v = vld1q_u8(row + x);
+    uint16x8_t lo = vld1q_u16(colsum + x);
+    uint16x8_t hi = vld1q_u16(colsum + x + 8);
+
+    vst1q_u16(colsum + x, vaddw_u8(lo, vget_low_u8(v)));
+    vst1q_u16(colsum + x + 8, vaddw_u8(hi, vget_high_u8(v)));
+  }
+  for (; x < width; x++)
+    colsum[x] += row[x];
+}
+
+static void downscale_neon(const uint8_t *src, int width, int height,
+                           int stride, int scale, uint8_t *dst) {
+  int out_width = width / scale;
+  int out_height = height / scale;
+  int used = out_width * scale;
+  unsigned area = scale * scale;
+  uint16_t colsum[4096];
+  int x, y, j, i;
+
+  if (scale > 16 || used > 4096) {
+    ykernels_scalar()->downscale(src, width, height, stride, scale, dst);
+    return;
+  }
+
+  for (y = 0; y < out_height; y++) {
+    for (x = 0; x < used; x++)
+      colsum[x] = 0;
+    for (j = 0; j < scale; j++)
+      accumulate_row(src + ((size_t)y * scale + j) * stride, used, colsum);
+
+    for (x = 0; x < out_width; x++) {
+      unsigned sum = 0;
+      for (i = 0; i < scale; i++)
+        sum += colsum[x * scale + i];
+      *dst++ = (sum + area / 2) / area;
+    }
+  }
+}
+
+static void absdiff_neon(const uint8_t *a, const uint8_t *b, uint8_t *dst,
+                         size_t n) {
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16)
+    vst1q_u8(dst + i, vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+  if (i < n)
+    ykernels_scalar()->absdiff(a + i, b + i, dst + i, n - i);
+}
+
+static uint64_t add_lanes_u32(uint32x4_t v) {
+  uint64x2_t pairs = vpaddlq_u32(v);
+  return vgetq_lane_u64(pairs, 0) + vgetq_lane_u64(pairs, 1);
+}
+
+static void sums_neon(const uint8_t *src, int width, int height, int stride,
+                      uint64_t *sum, uint64_t *sum_sq) {
+  uint64_t s = 0, sq = 0;
+  int x, y;
+
+  for (y = 0; y < height; y++) {
+    const uint8_t *row = src + (size_t)y * stride;
+    uint32x4_t vsum = vdupq_n_u32(0);
+    uint32x4_t vsq = vdupq_n_u32(0);
+
+    for (x = 0; x + 16 <= width; x += 16) {
+      uint8x16_t v = vld1q_u8(row + x);
+      // 255^2 still fits the 16-bit products
+      uint16x8_t sq_lo = vmull_u8(vget_low_u8(v), vget_low_u8(v));
+      uint16x8_t sq_hi = vmull_u8(vget_high_u8(v), vget_high_u8(v));
+
+      vsum = vpadalq_u16(vsum, vpaddlq_u8(v));
+      vsq = vpadalq_u16(vsq, sq_lo);
+      vsq = vpadalq_u16(vsq, sq_hi);
+    }
+    s += add_lanes_u32(vsum);
+    sq += add_lanes_u32(vsq);
+
+    for (; x < width; x++) {
+      s += row[x];
+      sq += row[x] * row[x];
+    }
+  }
+  *sum = s;
+  *sum_sq = sq;
+}
+
+static void tile_sad_neon(const uint8_t *a, const uint8_t *b, int width,
+                          int height, int stride, int tile, uint32_t *sad) {
+  int tiles_x = width / tile;
+  int tiles_y = height / tile;
+  int tx, ty, x, y;
+
+  if (tile % 16) {
+    ykernels_scalar()->tile_sad(a, b, width, height, stride, tile, sad);
+    return;
+  }
+
+  for (ty = 0; ty < tiles_y; ty++) {
+    for (tx = 0; tx < tiles_x; tx++) {
+      size_t offset = (size_t)ty * tile * stride + tx * tile;
+      uint32x4_t total = vdupq_n_u32(0);
+
+      for (y = 0; y < tile; y++) {
+        const uint8_t *ra = a + offset + (size_t)y * stride;
+        const uint8_t *rb = b + offset + (size_t)y * stride;
+        for (x = 0; x < tile; x += 16) {
+          uint8x16_t d = vabdq_u8(vld1q_u8(ra + x), vld1q_u8(rb + x));
+          total = vpadalq_u16(total, vpaddlq_u8(d));
+        }
+      }
+      *sad++ = (uint32_t)add_lanes_u32(total);
+    }
+  }
+}
+
+static YKERNELS_T neon_kernels;
+
+const YKERNELS_T *ykernels_neon() {
+#if !defined(__aarch64__)
+  if (!(getauxval(AT_HWCAP) & HWCAP_NEON))
+    return NULL;
+#endif
+
+  neon_kernels.name = "neon";
+  neon_kernels.downscale = downscale_neon;
+  neon_kernels.absdiff = absdiff_neon;
+  neon_kernels.histogram = ykernels_scalar()->histogram;
+  neon_kernels.sums = sums_neon;
+  neon_kernels.tile_sad = tile_sad_neon;
+  return &neon_kernels;
+}
+
+#else
+
+const YKERNELS_T *ykernels_neon() { return NULL; }
+
+#endif
@@ -0,0 +1,161 @@
+/**
+ * \file YKernelsSse2.cpp
+ * SSE2 versions of the luma kernels. SSE2 is part of x86-64, so on x86
+ * these are always available.
+ */
+
+#include "YKernels.h"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+/**
+ * Add one row into 16-bit column sums. Good for up to 257 rows before a
+ * column can overflow.
+ */
+static void accumulate_row(const uint8_t *row, int width, uint16_t *colsum) {
+  const __m128i zero = _mm_setzero_si128();
+  int x;
+
+  for (x = 0; x + 16 <= width; x += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(row + x));
+    __m128i lo = _mm_loadu_si128((const __m128i *)(colsum + x));
+    __m128i hi = _mm_loadu_si128((const __m128i *)(colsum + x + 8));
+
+    lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+    hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+    _mm_storeu_si128((__m128i *)(colsum + x), lo);
+    _mm_storeu_si128((__m128i *)(colsum + x + 8), hi);
+  }
+  for (; x < width; x++)
+    colsum[x] += row[x];
+}
+
+static void downscale_sse2(const uint8_t *src, int width, int height,
+                           int stride, int scale, uint8_t *dst) {
+  int out_width = width / scale;
+  int out_height = height / scale;
+  int used = out_width * scale;
+  unsigned area = scale * scale;
+  uint16_t colsum[4096];
+  int x, y, j, i;
+
+  if (scale > 16 || used > 4096) {
+    ykernels_scalar()->downscale(src, width, height, stride, scale, dst);
+    return;
+  }
+
+  for (y = 0; y < out_height; y++) {
+    // Vertical sums in SIMD, then the short horizontal runs
+    for (x = 0; x < used; x++)
+      colsum[x] = 0;
+    for (j = 0; j < scale; j++)
+      accumulate_row(src + ((size_t)y * scale + j) * stride, used, colsum);
+
+    for (x = 0; x < out_width; x++) {
+      unsigned sum = 0;
+      for (i = 0; i < scale; i++)
+        sum += colsum[x * scale + i];
+      *dst++ = (sum + area / 2) / area;
+    }
+  }
+}
+
+static void absdiff_sse2(const uint8_t *a, const uint8_t *b, uint8_t *dst,
+                         size_t n) {
+  size_t i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    __m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+    _mm_storeu_si128((__m128i *)(dst + i), d);
+  }
+  if (i < n)
+    ykernels_scalar()->absdiff(a + i, b + i, dst + i, n - i);
+}
+
+static void sums_sse2(const uint8_t *src, int width, int height, int stride,
+                      uint64_t *sum, uint64_t *sum_sq) {
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t s = 0, sq = 0;
+  int x, y;
+
+  for (y = 0; y < height; y++) {
+    const uint8_t *row = src + (size_t)y * stride;
+    __m128i vsum = zero, vsq = zero;
+    uint32_t lanes[4];
+
+    for (x = 0; x + 16 <= width; x += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(row + x));
+      __m128i lo = _mm_unpacklo_epi8(v, zero);
+      __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+      vsum = _mm_add_epi64(vsum, _mm_sad_epu8(v, zero));
+      vsq = _mm_add_epi32(vsq, _mm_madd_epi16(lo, lo));
+      vsq = _mm_add_epi32(vsq, _mm_madd_epi16(hi, hi));
+    }
+
+    _mm_storeu_si128((__m128i *)lanes, vsq);
+    sq += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    s += (uint64_t)_mm_cvtsi128_si32(vsum) +
+         _mm_cvtsi128_si32(_mm_srli_si128(vsum, 8));
+
+    for (; x < width; x++) {
+      s += row[x];
+      sq += row[x] * row[x];
+    }
+  }
+  *sum = s;
+  *sum_sq = sq;
+}
+
+static void tile_sad_sse2(const uint8_t *a, const uint8_t *b, int width,
+                          int height, int stride, int tile, uint32_t *sad) {
+  int tiles_x = width / tile;
+  int tiles_y = height / tile;
+  int tx, ty, x, y;
+
+  if (tile % 16) {
+    ykernels_scalar()->tile_sad(a, b, width, height, stride, tile, sad);
+    return;
+  }
+
+  for (ty = 0; ty < tiles_y; ty++) {
+    for (tx = 0; tx < tiles_x; tx++) {
+      size_t offset = (size_t)ty * tile * stride + tx * tile;
+      __m128i total = _mm_setzero_si128();
+
+      for (y = 0; y < tile; y++) {
+        const uint8_t *ra = a + offset + (size_t)y * stride;
+        const uint8_t *rb = b + offset + (size_t)y * stride;
+        for (x = 0; x < tile; x += 16) {
+          __m128i va = _mm_loadu_si128((const __m128i *)(ra + x));
+          __m128i vb = _mm_loadu_si128((const __m128i *)(rb + x));
+          total = _mm_add_epi64(total, _mm_sad_epu8(va, vb));
+        }
+      }
+      *sad++ = _mm_cvtsi128_si32(total) +
+               _mm_cvtsi128_si32(_mm_srli_si128(total, 8));
+    }
+  }
+}
+
+static YKERNELS_T sse2_kernels;
+
+const YKERNELS_T *ykernels_sse2() {
+  sse2_kernels.name = "sse2";
+  sse2_kernels.downscale = downscale_sse2;
+  sse2_kernels.absdiff = absdiff_sse2;
+  sse2_kernels.histogram = ykernels_scalar()->histogram;
+  sse2_kernels.sums = sums_sse2;
+  sse2_kernels.tile_sad = tile_sad_sse2;
+  return &sse2_kernels;
+}
+
+#else
+
+const YKERNELS_T *ykernels_sse2() { return NULL; }
+
+#endif
@@ -0,0 +1,308 @@
+/**
+ * \file capture_bench.cpp
+ * Benchmark of the capture to publish path, without a camera.
+ *
+ * A synthetic JPEG stream is fed through the same code dashcam and dashgrab
+ * run: the encoder output goes in chunks into a CaptureEngine, whose file
+ * and link sinks publish every still and send it to a GrabServer on
+ * loopback in the same process. Each stage is timed per frame:
+ *
+ *   encode output  chunks appended to the frame, with the link CRC
+ *   publish        file sink, temporary file and rename
+ *   link send      frame link to dashgrab
+ *   grab receive   header to last payload byte at the server
+ *   end to end     first chunk to the frame arriving at the server
+ *   shot to shot   interval between frames arriving at the server
+ *
+ * The last line of stdout is one JSON object with the throughput and the
+ * p50/p99/p999 of every stage, for comparing builds. Percentiles cover the
+ * most recent 4096 frames of the stages inside the sinks.
+ *
+ * Usage: capture_bench [--frames n] [--size bytes] [--jitter percent]
+ *          [--rate fps] [--chunk bytes] [--dir path] [--sync none|data|full]
+ *          [--port port] [--out file] [--trace file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "CaptureEngine.h"
+#include "Frame.h"
+#include "FrameSink.h"
+#include "GrabServer.h"
+#include "Publisher.h"
+#include "Stats.h"
+#include "Trace.h"
+
+/// Different stills cycled through, so sizes vary like a real scene
+#define BENCH_IMAGES 8
+/// How long to wait for the server to catch up after the last frame
+#define DRAIN_TIMEOUT_US (5 * 1000000)
+
+static int usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [--frames n] [--size bytes] [--jitter percent]\n"
+          "  [--rate fps] [--chunk bytes] [--dir path] [--sync none|data|full]\n"
+          "  [--port port] [--out file] [--trace file]\n",
+          name);
+  return 2;
+}
+
+/** xorshift32, so every run streams the same bytes */
+static uint32_t next_random(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+/**
+ * A JFIF-shaped buffer: SOI and APP0 markers, random bytes standing in for
+ * the entropy coded data (which doesn't compress either), and EOI. Nothing
+ * on the path decodes it.
+ */
+static void make_jpeg(size_t size, uint32_t *state, std::vector<uint8_t> *out) {
+  static const uint8_t head[] = {0xff, 0xd8, 0xff, 0xe0, 0x00, 0x10, 'J',
+                                 'F',  'I',  'F',  0x00, 0x01, 0x01, 0x00,
+                                 0x00, 0x01, 0x00, 0x01, 0x00, 0x00};
+  size_t i;
+
+  if (size < sizeof(head) + 2)
+    size = sizeof(head) + 2;
+  out->resize(size);
+  memcpy(&(*out)[0], head, sizeof(head));
+  for (i = sizeof(head); i < size - 2; i++)
+    (*out)[i] = next_random(state) & 0xff;
+  (*out)[size - 2] = 0xff;
+  (*out)[size - 1] = 0xd9;
+}
+
+typedef struct {
+  int frames;            /// Stills to push through
+  long size;             /// Mean still size in bytes
+  int jitter;            /// Still sizes spread over size +- this percent
+  double rate;           /// Stills per second, 0 as fast as the path goes
+  long chunk;            /// Encoder output buffer size
+  const char *dir;       /// Where the file sink publishes
+  PUBLISH_SYNC_T sync;   /// How far the file sink syncs
+  int port;              /// Loopback port of the grab server
+} BENCH_PARAMS;
+
+/** One stage as {"stage":...,"bytes_per_s":...,"latency":{...}} */
+static void report_stage(FILE *out, const char *stage, const LatencyStats &s,
+                         double frame_bytes, bool first) {
+  int64_t mean = s.mean();
+
+  fprintf(out, "%s{\"stage\":\"%s\",\"bytes_per_s\":%.0f,\"latency\":",
+          first ? "" : ",", stage, mean > 0 ? frame_bytes * 1e6 / mean : 0.0);
+  s.report_json(out);
+  fputc('}', out);
+}
+
+/**
+ * Run the stream and write the results to out. The server and the sinks are
+ * gone by the time this returns, so nothing they print comes after the JSON.
+ *
+ * @return 0 if every frame arrived intact
+ */
+static int run_bench(const BENCH_PARAMS *p, FILE *out) {
+  std::vector<uint8_t> images[BENCH_IMAGES];
+  uint32_t state = 0x2545f491;
+  uint64_t image_bytes = 0;
+  int i;
+
+  for (i = 0; i < BENCH_IMAGES; i++) {
+    // Spread evenly over size +- jitter percent
+    long spread = p->size * p->jitter / 100;
+    long size = p->size - spread + 2 * spread * i / (BENCH_IMAGES - 1);
+    make_jpeg(size, &state, &images[i]);
+    image_bytes += images[i].size();
+  }
+
+  // The receiving end, as dashgrab runs it
+  std::atomic<int> running(1);
+  std::atomic<uint64_t> received(0);
+  LatencyStats end_to_end("end to end", p->frames);
+  LatencyStats shot_to_shot("shot to shot", p->frames);
+  int64_t last_arrival = 0;
+  uint64_t bad_size = 0;
+
+  GrabServer server(p->port, [&](const FramePtr &frame, uint32_t address) {
+    int64_t now = monotonic_us();
+
+    if (frame->data.size() != images[frame->number % BENCH_IMAGES].size())
+      bad_size++;
+    end_to_end.add(now - frame->timestamp_us);
+    if (last_arrival)
+      shot_to_shot.add(now - last_arrival);
+    last_arrival = now;
+    received++;
+  });
+  if (server.open() != 0)
+    return 1;
+  std::thread server_thread([&] { server.run(running, 50); });
+
+  // The sending end, as dashcam runs it
+  char path[512];
+  snprintf(path, sizeof(path), "%s/capture_bench.jpg", p->dir);
+  CaptureEngine engine(CAMERA_RIGHT);
+  FileSink *file = new FileSink(path, p->sync);
+  LinkSink *link = new LinkSink("127.0.0.1", p->port);
+  engine.add_sink(file);
+  engine.add_sink(link);
+
+  LatencyStats encode("encode output", p->frames);
+  uint64_t sent_bytes = 0;
+  struct timespec next;
+  int64_t period_ns = p->rate > 0.0 ? (int64_t)(1e9 / p->rate) : 0;
+  int64_t start = monotonic_us();
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  for (i = 0; i < p->frames; i++) {
+    const std::vector<uint8_t> &image = images[i % BENCH_IMAGES];
+    CAMERA_OUTPUT output;
+    size_t offset;
+    int64_t first = monotonic_us();
+
+    memset(&output, 0, sizeof(output));
+    output.frame = i;
+    output.timestamp_us = first;
+    for (offset = 0; offset < image.size(); offset += p->chunk) {
+      output.data = image.data() + offset;
+      output.length = image.size() - offset < (size_t)p->chunk
+                          ? image.size() - offset
+                          : p->chunk;
+      engine.write(output);
+    }
+    encode.add(monotonic_us() - first);
+
+    // End of frame on its own, so the fan-out isn't counted as encode output
+    output.data = NULL;
+    output.length = 0;
+    output.flags = CAMERA_OUTPUT_FRAME_END;
+    engine.write(output);
+    sent_bytes += image.size();
+
+    if (period_ns) {
+      next.tv_nsec += period_ns;
+      while (next.tv_nsec >= 1000000000) {
+        next.tv_nsec -= 1000000000;
+        next.tv_sec++;
+      }
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+  }
+
+  uint64_t expected = p->frames - link->link().dropped();
+  while (received < expected && monotonic_us() - start < DRAIN_TIMEOUT_US)
+    usleep(1000);
+  int64_t elapsed = monotonic_us() - start;
+  running = 0;
+  server_thread.join();
+  unlink(path);
+
+  double frame_bytes = (double)image_bytes / BENCH_IMAGES;
+  double seconds = elapsed / 1e6;
+  fprintf(out,
+          "{\"bench\":\"capture\",\"frame_bytes\":%.0f,\"chunk_bytes\":%ld,"
+          "\"rate\":%g,\"sync\":%d,\"elapsed_us\":%" PRId64
+          ",\"frames\":{\"sent\":%d,\"received\":%" PRIu64
+          ",\"dropped\":%" PRIu64 ",\"publish_failed\":%" PRIu64
+          ",\"bad_size\":%" PRIu64 "},\"fps\":%.2f,"
+          "\"disk_bytes_per_s\":%.0f,\"net_bytes_per_s\":%.0f,\"stages\":[",
+          frame_bytes, p->chunk, p->rate, (int)p->sync, elapsed, p->frames,
+          (uint64_t)received, link->link().dropped(), file->failed(),
+          bad_size, received / seconds,
+          (sent_bytes - file->failed() * frame_bytes) / seconds,
+          (double)server.bytes() / seconds);
+  report_stage(out, "encode output", encode, frame_bytes, true);
+  report_stage(out, "publish", file->latency(), frame_bytes, false);
+  report_stage(out, "link send", link->link().transfer_stats(), frame_bytes,
+               false);
+  report_stage(out, "grab receive", server.transfer_stats(), frame_bytes,
+               false);
+  report_stage(out, "end to end", end_to_end, frame_bytes, false);
+  report_stage(out, "shot to shot", shot_to_shot, frame_bytes, false);
+  fprintf(out, "]}\n");
+
+  return received == (uint64_t)p->frames && !bad_size ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  BENCH_PARAMS params = {2000, 400000, 10, 0.0, 81920, "/tmp",
+                         PUBLISH_SYNC_NONE, 3334};
+  const char *out_path = NULL, *trace_path = NULL;
+  char *json = NULL;
+  size_t json_size = 0;
+  FILE *out;
+  int i, rc;
+
+  for (i = 1; i < argc; i++) {
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (!strcmp(argv[i], "--frames") && value)
+      params.frames = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--size") && value)
+      params.size = atol(argv[++i]);
+    else if (!strcmp(argv[i], "--jitter") && value)
+      params.jitter = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--rate") && value)
+      params.rate = atof(argv[++i]);
+    else if (!strcmp(argv[i], "--chunk") && value)
+      params.chunk = atol(argv[++i]);
+    else if (!strcmp(argv[i], "--dir") && value)
+      params.dir = argv[++i];
+    else if (!strcmp(argv[i], "--sync") && value) {
+      if (publish_sync_from_string(argv[++i], &params.sync) != 0)
+        return usage(argv[0]);
+    } else if (!strcmp(argv[i], "--port") && value)
+      params.port = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--out") && value)
+      out_path = argv[++i];
+    else if (!strcmp(argv[i], "--trace") && value)
+      trace_path = argv[++i];
+    else
+      return usage(argv[0]);
+  }
+  if (params.frames < 1 || params.size < 1 || params.chunk < 1 ||
+      params.rate < 0.0 || params.jitter < 0 || params.jitter > 90 ||
+      params.port <= 0)
+    return usage(argv[0]);
+
+  if (trace_path)
+    trace_enable();
+  out = open_memstream(&json, &json_size);
+  if (!out) {
+    perror("open_memstream");
+    return 1;
+  }
+  rc = run_bench(&params, out);
+  fclose(out);
+  if (trace_path && trace_dump(trace_path) != 0)
+    rc = 1;
+
+  if (out_path) {
+    FILE *file = fopen(out_path, "w");
+    if (!file) {
+      perror(out_path);
+      free(json);
+      return 1;
+    }
+    fwrite(json, 1, json_size, file);
+    fclose(file);
+  } else {
+    fwrite(json, 1, json_size, stdout);
+  }
+  free(json);
+  return rc;
+}
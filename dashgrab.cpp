@@ -1,6 +1,8 @@
 
 #include <stdio.h>
  #include <strings.h>
+#include <string.h>
+#include <stdlib.h>
 
 #include <sys/types.h>          
 #include <sys/socket.h>
@@ -8,88 +10,303 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#ifdef HAVE_WIRINGPI
 #include <wiringPi.h>
+#endif
+
+#include <opencv2/imgcodecs.hpp>
+
+#include "GrabServer.h"
+#include "LatestFrame.h"
+#include "MjpegServer.h"
+#include "Publisher.h"
+#include "StereoDepth.h"
+#include "Trace.h"
 
 const int portno=3333;
 
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <thread>
-#include <future>
 #include <sstream>
 
-int run;
+std::atomic<int> run;
+PUBLISH_SYNC_T publishSync = PUBLISH_SYNC_NONE;
+int httpPort = 8080;
+/// Chrome trace of the received frames, written on 't', SIGUSR1 and 'q'
+const char *tracePath = NULL;
+
+/// Live view slots, indexed by the camera id in the frame header
+LatestFrame latest[2];
+
+/// One publisher per camera address, only touched from the server thread
+std::map<uint32_t, std::unique_ptr<FilePublisher> > publishers;
+
+/// Written by dashcam on this machine, the left half of each stereo pair
+const char *leftPath = "/var/www/html/left.jpg";
+
+STEREO_PARAMS stereoParams;
+/// Null unless --stereo-calib or --stereo-maps was given
+std::unique_ptr<StereoDepth> stereo;
+/// Depth output, shared by the stereo workers
+std::mutex depthLock;
+std::unique_ptr<FilePublisher> depthPublisher;
+LatestFrame depthView;
 
 void error( char *msg ) {
   perror(  msg );
   exit(1);
 }
 
-void processClient(int fd, unsigned long address)
+/**
+ * Publish a received frame, one file per camera address
+ */
+void processFrame(const FramePtr &frame, uint32_t address)
 {
-  printf("Processing client %x\n\r", address);
-  std::ostringstream filename;
-  filename <<"/var/www/html/grab";
-  filename << address;
-  filename << ".jpeg";
-  int out=open(filename.str().c_str(), O_WRONLY | O_CREAT);
-  fchmod(out, S_IROTH);
-  char buffer[4*1024];
-  int len;
-  do
+  std::unique_ptr<FilePublisher> &publisher = publishers[address];
+
+  if (!publisher)
   {
-    len=read(fd,buffer, sizeof(buffer));
-    if(len>0)
-      write(out,buffer, len);
-  } while(len>0);
+    std::ostringstream filename;
+    filename <<"/var/www/html/grab";
+    filename << address;
+    filename << ".jpeg";
+    publisher.reset(new FilePublisher(filename.str().c_str(), publishSync));
+  }
+
+  if (publisher->publish(frame->data.data(), frame->data.size()) != 0)
+    fprintf(stderr, "grab publish failed for frame %u\n\r", frame->number);
 
+  // Same buffer, no copy
+  if (frame->camera < sizeof(latest) / sizeof(latest[0]))
+    latest[frame->camera].publish(frame);
+  if (stereo)
+    stereo->submit(frame->camera, frame, monotonic_us());
 }
 
-void acceptThread()
+/**
+ * Feed left.jpg into the stereo pipeline each time dashcam replaces it.
+ * dashcam publishes by rename(), so IN_MOVED_TO means a complete image.
+ */
+void leftThread()
 {
-     int sockfd, newsockfd;
-     sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	 if (sockfd < 0) 
-         error( const_cast<char *>("ERROR opening socket") );
-
- struct sockaddr_in serv_addr,cli_addr;
- bzero((char *) &serv_addr, sizeof(serv_addr));
-
-     serv_addr.sin_family = AF_INET;
-     serv_addr.sin_addr.s_addr = INADDR_ANY;
-     serv_addr.sin_port = htons( portno );
-     if (bind(sockfd, (struct sockaddr *) &serv_addr,   sizeof(serv_addr)) < 0) 
-       error( const_cast<char *>( "ERROR on binding" ) );
-     listen(sockfd,5);
-     while ( run ) {
-        fd_set fds;
-	struct timeval tv;
-        printf( "waiting for new client...\n\r" );
-        int clilen = sizeof(cli_addr);
-        FD_ZERO(&fds);
-        FD_SET(sockfd, &fds);
-        tv.tv_sec = 2; tv.tv_usec = 0;
-	if(select(sockfd+1, &fds, NULL, NULL, &tv)>0)
-	{
-        if ( ( newsockfd = accept( sockfd, (struct sockaddr *) &cli_addr, (socklen_t*) &clilen) ) < 0 )
-    		error( const_cast<char *>("ERROR on accept") );
-         printf( "opened new communication with client\n\r" );
-     std::async(std::launch::async,processClient, newsockfd, serv_addr.sin_addr.s_addr );
-        }
-	
+  std::string path(leftPath);
+  size_t slash = path.rfind('/');
+  std::string dir = path.substr(0, slash);
+  std::string name = path.substr(slash + 1);
+  uint32_t number = 0;
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
 
-   }
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_MOVED_TO) < 0)
+  {
+    perror("inotify on left image");
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
+
+  while (run)
+  {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    bool changed = false;
+
+    if (poll(&pfd, 1, 500) <= 0)
+      continue;
+
+    ssize_t len;
+    while ((len = read(fd, events, sizeof(events))) > 0)
+    {
+      for (char *p = events; p < events + len;)
+      {
+        struct inotify_event *ev = (struct inotify_event *)p;
+        if (ev->len && name == ev->name)
+          changed = true;
+        p += sizeof(struct inotify_event) + ev->len;
+      }
+    }
+    if (!changed)
+      continue;
+
+    int64_t arrival = monotonic_us();
+    int file = open(leftPath, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (file < 0)
+      continue;
+
+    FramePtr frame = std::make_shared<Frame>();
+    frame->camera = CAMERA_LEFT;
+    frame->number = number++;
+    frame->timestamp_us = wallclock_us();
+    if (fstat(file, &st) == 0 && st.st_size > 0)
+    {
+      frame->data.resize(st.st_size);
+      if (read(file, frame->data.data(), st.st_size) != st.st_size)
+        frame->data.clear();
+    }
+    close(file);
+
+    if (!frame->data.empty())
+    {
+      latest[CAMERA_LEFT].publish(frame);
+      stereo->submit(CAMERA_LEFT, frame, arrival);
+    }
+  }
+  close(fd);
 }
+
+/**
+ * Publish one depth map: 16-bit millimetres as PNG, and a scaled 8-bit
+ * disparity JPEG for the live view
+ */
+void processDepth(const StereoDepth::Result &result)
+{
+  std::vector<uchar> png;
+  FramePtr preview = std::make_shared<Frame>();
+  cv::Mat disparity8;
+
+  cv::imencode(".png", result.depth_mm, png);
+  result.disparity.convertTo(disparity8, CV_8U,
+                             255.0 / (stereoParams.num_disparities * 16));
+  cv::imencode(".jpg", disparity8, preview->data);
+  preview->number = result.left_number;
+  preview->timestamp_us = wallclock_us();
+
+  std::lock_guard<std::mutex> guard(depthLock);
+  if (depthPublisher->publish(png.data(), png.size()) != 0)
+    fprintf(stderr, "depth publish failed for pair %u/%u\n\r",
+            result.left_number, result.right_number);
+  depthView.publish(preview);
+}
+
+void serverThread()
+{
+  GrabServer server(portno, processFrame);
+
+  if (server.open() != 0)
+    error( const_cast<char *>("ERROR starting grab server") );
+
+  printf( "waiting for clients...\n\r" );
+  server.run(run);
+
+  printf("Received %llu frames, %llu bytes, %llu stream errors\n\r",
+         (unsigned long long)server.frames(),
+         (unsigned long long)server.bytes(),
+         (unsigned long long)server.errors());
+  server.transfer_stats().report(stdout);
+  for (auto &entry : publishers)
+    entry.second->latency().report(stdout);
+}
+
+void httpThread()
+{
+  MjpegServer server(httpPort);
+
+  server.add_stream("/left.mjpg", &latest[CAMERA_LEFT]);
+  server.add_stream("/right.mjpg", &latest[CAMERA_RIGHT]);
+  if (stereo)
+    server.add_stream("/depth.mjpg", &depthView);
+  if (server.open() != 0)
+  {
+    fprintf(stderr, "Live view disabled\n\r");
+    return;
+  }
+
+  server.run(run);
+
+  printf("Served %llu viewers\n\r", (unsigned long long)server.viewers());
+  server.delivery_stats().report(stdout);
+}
+
 void sendCaptureGpio()
 {
+#ifdef HAVE_WIRINGPI
  pinMode (21, OUTPUT) ;
  digitalWrite (21, HIGH) ; delay (500) ;
  digitalWrite (21,  LOW) ; delay (500) ;
+#else
+ fprintf(stderr, "Built without wiringPi, no capture line\n\r");
+#endif
 }
-int main()
+int main(int argc, char **argv)
 {
+  stereo_default_params(&stereoParams);
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (!strcmp(argv[i], "--fsync") && value &&
+        publish_sync_from_string(value, &publishSync) == 0)
+      i++;
+    else if (!strcmp(argv[i], "--http-port") && value)
+      httpPort = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--stereo-calib") && value)
+      stereoParams.calibration = argv[++i];
+    else if (!strcmp(argv[i], "--stereo-maps") && value)
+      stereoParams.map_cache = argv[++i];
+    else if (!strcmp(argv[i], "--stereo-threads") && value)
+      stereoParams.threads = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--stereo-skew") && value)
+      stereoParams.max_skew_ms = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--stereo-disparities") && value)
+      stereoParams.num_disparities = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--stereo-block") && value)
+      stereoParams.block_size = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--stereo-sgbm"))
+      stereoParams.sgbm = true;
+    else if (!strcmp(argv[i], "--trace") && value)
+      tracePath = argv[++i];
+    else
+    {
+      fprintf(stderr, "usage: %s [--fsync none|data|full] "
+              "[--http-port <port, 0 disables>]\n"
+              "  [--stereo-calib <file>] [--stereo-maps <file>] "
+              "[--stereo-threads <n>]\n"
+              "  [--stereo-skew <ms>]"
+              " [--stereo-disparities <n>] [--stereo-block <n>] "
+              "[--stereo-sgbm]\n"
+              "  [--trace <file>]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // Before any thread starts, they all have to block the dump signal
+  if (tracePath)
+  {
+    trace_enable();
+    if (trace_dump_on_signal(tracePath, SIGUSR1) != 0)
+      return 1;
+  }
+
+  if (stereoParams.calibration || stereoParams.map_cache)
+  {
+    depthPublisher.reset(new FilePublisher("/var/www/html/depth.png", publishSync));
+    stereo.reset(new StereoDepth(stereoParams, processDepth));
+    if (stereo->open() != 0)
+    {
+      fprintf(stderr, "Stereo depth disabled\n\r");
+      stereo.reset();
+    }
+  }
+
   run=1;
+#ifdef HAVE_WIRINGPI
   wiringPiSetupGpio();
+#endif
 
-    std::thread t2(acceptThread); 
+    std::thread t2(serverThread); 
+    std::thread t3;
+    if (httpPort)
+      t3 = std::thread(httpThread);
+    std::thread t4;
+    if (stereo)
+      t4 = std::thread(leftThread);
    char c;
  system ("/bin/stty raw");
    do {
@@ -98,10 +315,25 @@ int main()
      switch(c)
      {
        case 'c': sendCaptureGpio(); break;
+       case 't':
+         if (tracePath && trace_dump(tracePath) == 0)
+           printf("Trace written to %s\n\r", tracePath);
+         break;
      }
  
    }while(c!='q');
   system ("/bin/stty cooked");
   run=0;
    t2.join();
+   if (t3.joinable())
+     t3.join();
+   if (t4.joinable())
+     t4.join();
+   if (stereo)
+   {
+     stereo->report(stdout);
+     stereo.reset();
+   }
+   if (tracePath && trace_dump(tracePath) == 0)
+     printf("Trace written to %s\n", tracePath);
 }
@@ -0,0 +1,117 @@
+/**
+ * \file frameindex.cpp
+ * Look up stills by time in the index an index:<dir> sink writes.
+ *
+ * The records between two wall clock times are found by binary search over
+ * the mapped index and listed one per line. With --export each of their
+ * stills is read from the data file and written out as a JPEG of its own.
+ *
+ * Usage: frameindex <dir> [--from seconds] [--to seconds] [--export dir]
+ *   Times are Unix seconds, fractions allowed. The default is everything.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include <string>
+#include <vector>
+
+#include "FrameIndex.h"
+
+static int usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s <dir> [--from seconds] [--to seconds] [--export dir]\n",
+          name);
+  return 2;
+}
+
+/** Copy one still out of the data file. @return 0 on success */
+static int export_still(int data_fd, const FRAME_INDEX_RECORD &record,
+                        const char *dir) {
+  std::vector<uint8_t> still(record.size);
+  char path[512];
+  FILE *out;
+
+  if (pread(data_fd, still.data(), still.size(), record.offset) !=
+      (ssize_t)still.size()) {
+    fprintf(stderr, "Frame %u: data file too short\n", record.frame);
+    return -1;
+  }
+  snprintf(path, sizeof(path), "%s/still%06u.jpg", dir, record.frame);
+  out = fopen(path, "wb");
+  if (!out || fwrite(still.data(), 1, still.size(), out) != still.size()) {
+    fprintf(stderr, "Cannot write %s: %s\n", path, strerror(errno));
+    if (out)
+      fclose(out);
+    return -1;
+  }
+  fclose(out);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int64_t from_us = INT64_MIN, to_us = INT64_MAX;
+  const char *export_dir = NULL;
+  FrameIndexReader index;
+  int data_fd = -1;
+  int i, rc = 0;
+
+  if (argc < 2 || argv[1][0] == '-')
+    return usage(argv[0]);
+  for (i = 2; i < argc; i++) {
+    const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+    if (!strcmp(argv[i], "--from") && value)
+      from_us = (int64_t)(atof(argv[++i]) * 1e6);
+    else if (!strcmp(argv[i], "--to") && value)
+      to_us = (int64_t)(atof(argv[++i]) * 1e6);
+    else if (!strcmp(argv[i], "--export") && value)
+      export_dir = argv[++i];
+    else
+      return usage(argv[0]);
+  }
+
+  std::string dir(argv[1]);
+  if (index.open((dir + "/stills.idx").c_str()) != 0)
+    return 1;
+  if (export_dir) {
+    data_fd = open((dir + "/stills.dat").c_str(), O_RDONLY | O_CLOEXEC);
+    if (data_fd < 0) {
+      fprintf(stderr, "Cannot open %s/stills.dat: %s\n", dir.c_str(),
+              strerror(errno));
+      return 1;
+    }
+  }
+
+  printf("# frame camera wallclock_us pts_us offset size exposure_us "
+         "analog_gain digital_gain awb_red awb_blue latitude longitude "
+         "speed_mps\n");
+  for (size_t n = index.lower_bound(from_us); n < index.count(); n++) {
+    const FRAME_INDEX_RECORD &record = index.record(n);
+
+    if (record.wallclock_us > to_us)
+      break;
+    printf("%u %u %" PRId64 " %" PRId64 " %" PRIu64 " %u %u %.2f %.2f %.2f "
+           "%.2f",
+           record.frame, record.camera, record.wallclock_us, record.pts_us,
+           record.offset, record.size, record.exposure_us,
+           record.analog_gain, record.digital_gain, record.awb_red_gain,
+           record.awb_blue_gain);
+    if (record.gps_valid)
+      printf(" %.6f %.6f %.1f\n", record.latitude, record.longitude,
+             record.speed_mps);
+    else
+      printf(" - - -\n");
+    if (export_dir && export_still(data_fd, record, export_dir) != 0)
+      rc = 1;
+  }
+
+  if (data_fd >= 0)
+    close(data_fd);
+  return rc;
+}
@@ -0,0 +1,177 @@
+/**
+ * \file stereocalib.cpp
+ * Calibrate the camera pair from checkerboard photos.
+ *
+ * Each argument pair is a left and a right image of the same checkerboard
+ * pose. Writes the calibration for dashgrab --stereo-calib and, with
+ * --maps, the rectification tables for dashgrab --stereo-maps.
+ *
+ * Usage: stereocalib --board 9x6 --square 25 --out stereo.yml
+ *          [--maps stereo.maps] [--map-size 1920x1080]
+ *          left1.jpg right1.jpg [left2.jpg right2.jpg ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "Stats.h"
+#include "StereoCalibration.h"
+#include "StereoMapCache.h"
+
+/// Fewer poses than this can't constrain the distortion model
+#define MIN_PAIRS 3
+
+static int usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s --board <cols>x<rows> --square <mm> --out <file>\n"
+          "  [--maps <file>] [--map-size <width>x<height>]\n"
+          "  left1 right1 [left2 right2 ...]\n",
+          name);
+  return 1;
+}
+
+/**
+ * Find the inner corners of the board to subpixel accuracy
+ *
+ * @return true if the whole board was found
+ */
+static bool find_corners(const cv::Mat &image, cv::Size board,
+                         std::vector<cv::Point2f> *corners) {
+  if (!cv::findChessboardCorners(image, board, *corners,
+                                 cv::CALIB_CB_ADAPTIVE_THRESH |
+                                     cv::CALIB_CB_NORMALIZE_IMAGE))
+    return false;
+  cv::cornerSubPix(
+      image, *corners, cv::Size(11, 11), cv::Size(-1, -1),
+      cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 30,
+                       0.01));
+  return true;
+}
+
+int main(int argc, char **argv) {
+  cv::Size board(0, 0), size(0, 0), map_size(0, 0);
+  double square = 0.0;
+  const char *out = NULL, *maps_path = NULL;
+  std::vector<const char *> images;
+  std::vector<std::vector<cv::Point3f> > object_points;
+  std::vector<std::vector<cv::Point2f> > left_points, right_points;
+  std::vector<cv::Point3f> board_points;
+  StereoCalibration calib;
+  cv::Mat e, f;
+  size_t i;
+  int x, y;
+
+  for (x = 1; x < argc; x++) {
+    const char *value = x + 1 < argc ? argv[x + 1] : NULL;
+
+    if (!strcmp(argv[x], "--board") && value) {
+      if (sscanf(argv[++x], "%dx%d", &board.width, &board.height) != 2)
+        return usage(argv[0]);
+    } else if (!strcmp(argv[x], "--square") && value)
+      square = atof(argv[++x]);
+    else if (!strcmp(argv[x], "--out") && value)
+      out = argv[++x];
+    else if (!strcmp(argv[x], "--maps") && value)
+      maps_path = argv[++x];
+    else if (!strcmp(argv[x], "--map-size") && value) {
+      if (sscanf(argv[++x], "%dx%d", &map_size.width, &map_size.height) != 2)
+        return usage(argv[0]);
+    } else if (argv[x][0] != '-')
+      images.push_back(argv[x]);
+    else
+      return usage(argv[0]);
+  }
+  if (board.width < 2 || board.height < 2 || square <= 0.0 || !out ||
+      images.empty() || images.size() % 2)
+    return usage(argv[0]);
+
+  for (y = 0; y < board.height; y++) {
+    for (x = 0; x < board.width; x++)
+      board_points.push_back(cv::Point3f(x * square, y * square, 0));
+  }
+
+  for (i = 0; i < images.size(); i += 2) {
+    cv::Mat left = cv::imread(images[i], cv::IMREAD_GRAYSCALE);
+    cv::Mat right = cv::imread(images[i + 1], cv::IMREAD_GRAYSCALE);
+    std::vector<cv::Point2f> left_corners, right_corners;
+
+    if (left.empty() || right.empty()) {
+      fprintf(stderr, "Cannot read %s or %s\n", images[i], images[i + 1]);
+      return 1;
+    }
+    if (size.width == 0)
+      size = left.size();
+    if (left.size() != size || right.size() != size) {
+      fprintf(stderr, "%s / %s: all images must be %dx%d\n", images[i],
+              images[i + 1], size.width, size.height);
+      return 1;
+    }
+
+    if (!find_corners(left, board, &left_corners) ||
+        !find_corners(right, board, &right_corners)) {
+      printf("%s / %s: board not found, skipped\n", images[i],
+             images[i + 1]);
+      continue;
+    }
+    printf("%s / %s: ok\n", images[i], images[i + 1]);
+    object_points.push_back(board_points);
+    left_points.push_back(left_corners);
+    right_points.push_back(right_corners);
+  }
+
+  if (object_points.size() < MIN_PAIRS) {
+    fprintf(stderr, "Only %d usable pairs, need at least %d\n",
+            (int)object_points.size(), MIN_PAIRS);
+    return 1;
+  }
+
+  // Each camera on its own first, then only the pose between them
+  std::vector<cv::Mat> rvecs, tvecs;
+  double rms1 = cv::calibrateCamera(object_points, left_points, size,
+                                    calib.m1, calib.d1, rvecs, tvecs);
+  double rms2 = cv::calibrateCamera(object_points, right_points, size,
+                                    calib.m2, calib.d2, rvecs, tvecs);
+  double rms = cv::stereoCalibrate(
+      object_points, left_points, right_points, calib.m1, calib.d1, calib.m2,
+      calib.d2, size, calib.r, calib.t, e, f, cv::CALIB_FIX_INTRINSIC,
+      cv::TermCriteria(cv::TermCriteria::COUNT + cv::TermCriteria::EPS, 100,
+                       1e-6));
+  calib.width = size.width;
+  calib.height = size.height;
+
+  printf("%d pairs, reprojection error left %.3f right %.3f stereo %.3f px\n",
+         (int)object_points.size(), rms1, rms2, rms);
+  printf("baseline %.1f mm\n", cv::norm(calib.t));
+
+  if (calib.save(out) != 0)
+    return 1;
+  printf("calibration written to %s\n", out);
+
+  if (maps_path) {
+    StereoCalibration saved;
+    StereoMaps maps;
+    int64_t start = monotonic_us();
+
+    if (map_size.width <= 0 || map_size.height <= 0)
+      map_size = size;
+
+    // Build from what dashgrab will load, so the fingerprints agree
+    if (saved.load(out) != 0)
+      return 1;
+    saved.build_maps(map_size.width, map_size.height, &maps);
+    if (stereo_map_write(maps_path, maps, saved.fingerprint()) != 0)
+      return 1;
+    printf("%dx%d maps written to %s in %lld ms\n", map_size.width,
+           map_size.height, maps_path,
+           (long long)(monotonic_us() - start) / 1000);
+  }
+
+  return 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * \file ykernels_bench.cpp
+ * Microbenchmark and cross-check for the luma kernels.
+ *
+ * Runs every kernel set the CPU supports on the same synthetic frames,
+ * compares each result with the scalar version and prints the time per
+ * call. The last line is a checksum over the scalar outputs, which must be
+ * the same on every machine: compare the x86 and the Pi output to check the
+ * builds against each other.
+ *
+ * Usage: ykernels_bench [width height [iterations]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "Stats.h"
+#include "YKernels.h"
+
+struct Outputs {
+  std::vector<uint8_t> small;
+  std::vector<uint8_t> diff;
+  uint32_t hist[256];
+  uint64_t sum;
+  uint64_t sum_sq;
+  std::vector<uint32_t> sad;
+};
+
+static const int SCALE = 8;
+static const int TILE = 16;
+
+/** xorshift32, so the frames are the same everywhere */
+static uint32_t next_random(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+/**
+ * Gradient plus noise, with the second frame shifted and a bright block
+ * added, so the diff and SAD outputs aren't all zero. The stride is padded
+ * like the camera's.
+ */
+static void make_frames(int width, int height, int stride,
+                        std::vector<uint8_t> &a, std::vector<uint8_t> &b) {
+  uint32_t state = 0x2545f491;
+  int x, y;
+
+  a.assign((size_t)stride * height, 0);
+  b.assign((size_t)stride * height, 0);
+  for (y = 0; y < height; y++) {
+    for (x = 0; x < width; x++) {
+      size_t i = (size_t)y * stride + x;
+      int base = (x + y) & 0xff;
+      a[i] = (base + (next_random(&state) & 0x0f)) & 0xff;
+      b[i] = (base + 3 + (next_random(&state) & 0x0f)) & 0xff;
+      if (x > width / 3 && x < width / 2 && y > height / 3 && y < height / 2)
+        b[i] = 0xf0 | (next_random(&state) & 0x0f);
+    }
+  }
+}
+
+static void run_once(const YKERNELS_T *k, const std::vector<uint8_t> &a,
+                     const std::vector<uint8_t> &b, int width, int height,
+                     int stride, Outputs *out) {
+  k->downscale(&a[0], width, height, stride, SCALE, &out->small[0]);
+  k->absdiff(&a[0], &b[0], &out->diff[0], out->diff.size());
+  k->histogram(&a[0], a.size(), out->hist);
+  k->sums(&a[0], width, height, stride, &out->sum, &out->sum_sq);
+  k->tile_sad(&a[0], &b[0], width, height, stride, TILE, &out->sad[0]);
+}
+
+static bool same(const Outputs &x, const Outputs &y) {
+  return x.small == y.small && x.diff == y.diff &&
+         !memcmp(x.hist, y.hist, sizeof(x.hist)) && x.sum == y.sum &&
+         x.sum_sq == y.sum_sq && x.sad == y.sad;
+}
+
+/** FNV-1a over the raw bytes, x86 and ARM are both little endian */
+static uint64_t fnv1a(uint64_t h, const void *data, size_t n) {
+  const uint8_t *p = (const uint8_t *)data;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static uint64_t checksum(const Outputs &o) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  h = fnv1a(h, &o.small[0], o.small.size());
+  h = fnv1a(h, &o.diff[0], o.diff.size());
+  h = fnv1a(h, o.hist, sizeof(o.hist));
+  h = fnv1a(h, &o.sum, sizeof(o.sum));
+  h = fnv1a(h, &o.sum_sq, sizeof(o.sum_sq));
+  h = fnv1a(h, &o.sad[0], o.sad.size() * sizeof(o.sad[0]));
+  return h;
+}
+
+/** Mean microseconds per call of one kernel over the iterations */
+#define TIME_KERNEL(label, call)                                               \
+  do {                                                                         \
+    int64_t start = monotonic_us();                                            \
+    for (i = 0; i < iterations; i++)                                           \
+      call;                                                                    \
+    printf("  %-10s %9.1f us\n", label,                                        \
+           (double)(monotonic_us() - start) / iterations);                     \
+  } while (0)
+
+int main(int argc, char **argv) {
+  int width = 1920, height = 1080, iterations = 200;
+  const YKERNELS_T *sets[] = {ykernels_scalar(), ykernels_sse2(),
+                              ykernels_avx2(), ykernels_neon()};
+  std::vector<uint8_t> a, b;
+  Outputs reference, out;
+  int stride, failed = 0, i;
+  size_t s;
+
+  if (argc >= 3) {
+    width = atoi(argv[1]);
+    height = atoi(argv[2]);
+  }
+  if (argc >= 4)
+    iterations = atoi(argv[3]);
+  if (width < TILE || height < TILE || iterations < 1) {
+    fprintf(stderr, "usage: %s [width height [iterations]]\n", argv[0]);
+    return 2;
+  }
+
+  // Camera buffers are 32 byte aligned rows
+  stride = (width + 31) & ~31;
+  make_frames(width, height, stride, a, b);
+
+  reference.small.resize((size_t)(width / SCALE) * (height / SCALE));
+  reference.diff.resize(a.size());
+  reference.sad.resize((size_t)(width / TILE) * (height / TILE));
+  run_once(ykernels_scalar(), a, b, width, height, stride, &reference);
+
+  printf("%dx%d stride %d, %d iterations, selected %s\n", width, height,
+         stride, iterations, ykernels()->name);
+
+  for (s = 0; s < sizeof(sets) / sizeof(sets[0]); s++) {
+    const YKERNELS_T *k = sets[s];
+    if (!k)
+      continue;
+
+    // Same sizes as the reference, but none of its values
+    out = reference;
+    std::fill(out.small.begin(), out.small.end(), 0);
+    std::fill(out.diff.begin(), out.diff.end(), 0);
+    std::fill(out.sad.begin(), out.sad.end(), 0);
+    memset(out.hist, 0xff, sizeof(out.hist));
+    out.sum = out.sum_sq = 0;
+    run_once(k, a, b, width, height, stride, &out);
+    if (!same(out, reference)) {
+      printf("%s: MISMATCH against scalar\n", k->name);
+      failed++;
+      continue;
+    }
+
+    printf("%s:\n", k->name);
+    TIME_KERNEL("downscale", k->downscale(&a[0], width, height, stride, SCALE,
+                                          &out.small[0]));
+    TIME_KERNEL("absdiff",
+                k->absdiff(&a[0], &b[0], &out.diff[0], out.diff.size()));
+    TIME_KERNEL("histogram", k->histogram(&a[0], a.size(), out.hist));
+    TIME_KERNEL("sums",
+                k->sums(&a[0], width, height, stride, &out.sum, &out.sum_sq));
+    TIME_KERNEL("tile_sad", k->tile_sad(&a[0], &b[0], width, height, stride,
+                                        TILE, &out.sad[0]));
+  }
+
+  printf("checksum %016llx\n", (unsigned long long)checksum(reference));
+  return failed ? 1 : 0;
+}